@@ -0,0 +1,89 @@
+#!/bin/sh
+# memtest ISH [N]
+# drives ish through N mixed commands (1000000 by default) and fails
+# unless the line, parser and stages pools are back at zero, jobs holds
+# no more than the memstat job itself and rss is within MEMTEST_RSS_KB
+# (256) of what it was after a warm-up of the same commands.
+
+ISH=${1:?usage: memtest ISH [N]}
+N=${2:-1000000}
+WARMUP=20000
+RSS_SLACK_KB=${MEMTEST_RSS_KB:-256}
+
+dir=$(mktemp -d) || exit 2
+trap 'rm -rf "$dir"' EXIT
+mkdir "$dir/d"
+seq 1 1000 > "$dir/f"
+export ISH_Z_FILE="$dir/z"
+
+# n commands, mostly builtins in the shell, a few which fork in every 100
+commands() {
+    awk -v n="$1" -v d="$dir" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            k = i % 16
+            if (i % 100 == 99)  print "seq 3 | cat"
+            else if (i % 100 == 98)  print "no_such_command_" i
+            else if (i % 100 == 97)  { print "wc -c <<EOF"; print "line " i; print "EOF" }
+            else if (i % 100 == 96)  print "wc -w <<< \"a b " i "\""
+            else if (k == 0)  print "echo hello " i
+            else if (k == 1)  print "wc -l < " d "/f"
+            else if (k == 2)  print "grep -c 7 < " d "/f"
+            else if (k == 3)  print "echo a b c | wc -w"
+            else if (k == 4)  print "echo " i " | grep -c 1"
+            else if (k == 5)  print "cd " d "/d"
+            else if (k == 6)  print "cd -"
+            else if (k == 7)  print "pushd " d "/d"
+            else if (k == 8)  print "popd"
+            else if (k == 9)  print "alias hi=\"echo hi " i % 7 "\""
+            else if (k == 10) print "hi"
+            else if (k == 11) print "echo x >&5"
+            else if (k == 12) print "type echo"
+            else if (k == 13) print "dirs"
+            else if (k == 14) print "f"
+            else print "f() { echo " i % 5 "; }"
+        }
+    }'
+}
+
+# memstat FILE POOL -> its live bytes
+live() {
+    awk -v p="$2" '$1 == p { print $2 }' "$1"
+}
+
+{
+    commands $WARMUP
+    echo "memstat > $dir/warm"
+    commands "$N"
+    echo "memstat > $dir/end"
+} | "$ISH" > /dev/null 2>&1
+
+if [ ! -s "$dir/warm" ] || [ ! -s "$dir/end" ]; then
+    echo "memtest: FAILED, no memstat output"
+    exit 1
+fi
+cat "$dir/end"
+
+failures=0
+for pool in line parser stages; do
+    if [ "$(live "$dir/end" $pool)" != 0 ]; then
+        echo "FAIL: $pool holds $(live "$dir/end" $pool) bytes after $N commands"
+        failures=$((failures + 1))
+    fi
+done
+# the job of memstat itself is live while it prints
+if [ "$(live "$dir/end" jobs)" -gt "$(live "$dir/warm" jobs)" ]; then
+    echo "FAIL: jobs holds $(live "$dir/end" jobs) bytes, $(live "$dir/warm" jobs) after the warm-up"
+    failures=$((failures + 1))
+fi
+warm_rss=$(live "$dir/warm" rss)
+end_rss=$(live "$dir/end" rss)
+if [ $((end_rss - warm_rss)) -gt $((RSS_SLACK_KB * 1024)) ]; then
+    echo "FAIL: rss grew from $warm_rss to $end_rss bytes"
+    failures=$((failures + 1))
+fi
+
+if [ $failures -gt 0 ]; then
+    echo "memtest: FAILED"
+    exit 1
+fi
+echo "memtest: ok ($N commands, rss $warm_rss -> $end_rss)"
@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+/* ptybench ISH BUDGETS
+   drives ish through a pseudo terminal, measures interactive latencies
+   and checks the job control state on the way. exits 1 when a check
+   fails or the p95 of a metric is over its budget in BUDGETS. */
+
+#define PROMPT "ish$ "
+#define EXPECT_TIMEOUT_MS 3000
+#define MAX_SAMPLES 128
+#define MAX_METRICS 16
+
+typedef struct metric_ {
+    const char *name;
+    double samples[MAX_SAMPLES];
+    int n;
+} metric;
+
+static int master = -1;
+static pid_t shell_pid;
+static char buf[1 << 16];
+static size_t buf_len = 0;
+static char matched[1 << 16];//output consumed by the last expect
+static metric metrics[MAX_METRICS];
+static int metric_count = 0;
+static int failures = 0;
+static const char *shell_path;
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void sleep_ms(double ms) {
+    struct timespec ts = {(time_t) (ms / 1000), (long) ((ms - (time_t) (ms / 1000) * 1000) * 1e6)};
+    nanosleep(&ts, NULL);
+}
+
+static void record(const char *name, double ms) {
+    metric *m = NULL;
+    for (int i = 0; i < metric_count; i++) {
+        if (strcmp(metrics[i].name, name) == 0) {
+            m = &metrics[i];
+        }
+    }
+    if (m == NULL) {
+        m = &metrics[metric_count++];
+        m->name = name;
+        m->n = 0;
+    }
+    if (m->n < MAX_SAMPLES) {
+        m->samples[m->n++] = ms;
+    }
+}
+
+static void check(int ok, const char *what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void send_str(const char *s) {
+    if (write(master, s, strlen(s)) < 0) {
+        perror("write");
+    }
+}
+
+//read the pty until pattern shows up, the text up to it goes to matched[]
+static int expect(const char *pattern) {
+    double deadline = now_ms() + EXPECT_TIMEOUT_MS;
+
+    while (1) {
+        buf[buf_len] = '\0';
+        char *hit = strstr(buf, pattern);
+        if (hit != NULL) {
+            size_t used = hit - buf + strlen(pattern);
+            memcpy(matched, buf, used);
+            matched[used] = '\0';
+            memmove(buf, buf + used, buf_len - used);
+            buf_len -= used;
+            return 0;
+        }
+        double left = deadline - now_ms();
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (left <= 0 || poll(&pfd, 1, (int) left + 1) <= 0) {
+            printf("FAIL: timed out waiting for \"%s\"\n", pattern);
+            failures++;
+            return -1;
+        }
+        ssize_t n = read(master, buf + buf_len, sizeof(buf) - 1 - buf_len);
+        if (n <= 0) {
+            return -1;
+        }
+        buf_len += n;
+    }
+}
+
+//drop what the shell printed so far
+static void drain() {
+    struct pollfd pfd = {master, POLLIN, 0};
+    while (poll(&pfd, 1, 0) > 0 && read(master, buf, sizeof(buf) - 1) > 0);
+    buf_len = 0;
+}
+
+static char proc_state(pid_t pid) {
+    char path[64], stat[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    stat[n] = '\0';
+    char *p = strrchr(stat, ')');
+    return p != NULL ? p[2] : 0;
+}
+
+//wait until the foreground process group of the pty is pgid
+static double wait_foreground(pid_t pgid) {
+    double t0 = now_ms();
+    while (now_ms() - t0 < EXPECT_TIMEOUT_MS) {
+        if (tcgetpgrp(master) == pgid) {
+            return now_ms() - t0;
+        }
+        sleep_ms(0.05);
+    }
+    return -1;
+}
+
+static void start_shell(const char *ish) {
+    shell_path = ish;
+    master = posix_openpt(O_RDWR|O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        exit(2);
+    }
+    char *slave_name = ptsname(master);
+
+    shell_pid = fork();
+    if (shell_pid == 0) {
+        setsid();
+        int slave = open(slave_name, O_RDWR);
+        ioctl(slave, TIOCSCTTY, 0);
+        dup2(slave, 0);
+        dup2(slave, 1);
+        dup2(slave, 2);
+        close(slave);
+        close(master);
+        setenv("TERM", "dumb", 1);
+        execl(ish, ish, (char*) NULL);
+        _exit(127);
+    }
+    if (expect(PROMPT) < 0) {
+        exit(1);
+    }
+}
+
+static void bench_keystroke_echo() {
+    for (int i = 0; i < 50; i++) {
+        double t = now_ms();
+        send_str("x");
+        if (expect("x") < 0) {
+            return;
+        }
+        record("keystroke_echo", now_ms() - t);
+    }
+    send_str("\025\n");//^U, empty line
+    expect(PROMPT);
+}
+
+static void bench_prompt_return() {
+    for (int i = 0; i < 30; i++) {
+        double t = now_ms();
+        send_str("true\n");
+        if (expect(PROMPT) < 0) {
+            return;
+        }
+        record("prompt_return", now_ms() - t);
+    }
+}
+
+//sleep 30, ^Z, bg, fg, ^C
+static void bench_job_control() {
+    for (int i = 0; i < 10; i++) {
+        send_str("sleep 30\n");
+        sleep_ms(50);
+        drain();
+
+        double t = now_ms();
+        send_str("\032");
+        if (expect("suspended") < 0) {
+            return;
+        }
+        char *tab = strstr(matched, "\t");
+        pid_t pid = tab != NULL ? atoi(tab + 1) : -1;
+        if (expect(PROMPT) < 0) {
+            return;
+        }
+        record("suspend_prompt", now_ms() - t);
+
+        check(pid > 0, "suspended job printed with its pid");
+        check(proc_state(pid) == 'T', "^Z stops the job");
+        check(tcgetpgrp(master) == shell_pid, "^Z gives the terminal back to the shell");
+
+        t = now_ms();
+        send_str("bg\n");
+        if (expect(PROMPT) < 0) {
+            return;
+        }
+        record("bg_prompt", now_ms() - t);
+        double t_run = now_ms();
+        while (proc_state(pid) == 'T' && now_ms() - t_run < EXPECT_TIMEOUT_MS) {
+            sleep_ms(0.05);
+        }
+        check(proc_state(pid) != 'T' && proc_state(pid) != 0, "bg continues the job");
+        check(tcgetpgrp(master) == shell_pid, "bg keeps the terminal with the shell");
+
+        send_str("fg\n");
+        double handoff = wait_foreground(pid);
+        check(handoff >= 0, "fg hands the terminal to the job");
+        if (handoff >= 0) {
+            record("fg_handoff", handoff);
+        }
+
+        t = now_ms();
+        send_str("\003");
+        if (expect(PROMPT) < 0) {
+            return;
+        }
+        record("interrupt_prompt", now_ms() - t);
+        check(tcgetpgrp(master) == shell_pid, "the shell gets the terminal back after fg");
+        check(kill(pid, 0) < 0, "^C ends the foreground job");
+    }
+}
+
+//sleep 0.1 & -> time from its end to the "done" notification
+static void bench_bg_notify() {
+    for (int i = 0; i < 10; i++) {
+        double t = now_ms();
+        send_str("sleep 0.1 &\n");
+        if (expect(PROMPT) < 0 || expect("done") < 0) {
+            return;
+        }
+        record("bg_notify", now_ms() - t - 100);
+        expect(PROMPT);
+    }
+}
+
+//builtins in the background -> real jobs, reaped, the table does not fill up
+static void check_bg_builtins() {
+    char line[64];
+
+    send_str("enable -f plugins/paths.so basename\n");
+    expect(PROMPT);
+    for (int i = 0; i < 20; i++) {
+        snprintf(line, sizeof(line), "echo bg%d &\nbasename /bg/%d &\n", i, i);
+        send_str(line);
+        if (expect(PROMPT) < 0 || expect(PROMPT) < 0) {
+            return;
+        }
+    }
+    sleep_ms(100);
+    send_str("true\n");
+    expect(PROMPT);
+    drain();
+    send_str("jobs\n");
+    if (expect(PROMPT) < 0) {
+        return;
+    }
+    check(strstr(matched, "echo") == NULL && strstr(matched, "basename") == NULL,
+          "echo & and a loadable builtin & are reaped and leave the job table");
+    send_str("sleep 0.1 &\n");
+    check(expect("done\tsleep") == 0, "a job starts after many builtins in the background");
+    expect(PROMPT);
+}
+
+//output of a command run from the shell into path -> 1 when it is exactly want
+static int output_is(const char *command, const char *path, const char *want) {
+    char got[256];
+
+    unlink(path);
+    send_str(command);
+    if (expect(PROMPT) < 0) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    ssize_t n = fd >= 0 ? read(fd, got, sizeof(got) - 1) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(path);
+    got[n > 0 ? n : 0] = '\0';
+    return strcmp(got, want) == 0;
+}
+
+//a trailing cat is dropped when stdout is not a terminal, a script run of it too
+static void check_rewrite_cat() {
+    char line[512], path[64];
+
+    snprintf(path, sizeof(path), "/tmp/ptybench.%d", (int) getpid());
+    snprintf(line, sizeof(line), "seq 3 | cat > %s\n", path);
+    check(output_is(line, path, "1\n2\n3\n"), "a | cat > file");
+    snprintf(line, sizeof(line), "%s -c 'seq 3 | cat | cat' > %s\n", shell_path, path);
+    check(output_is(line, path, "1\n2\n3\n"), "a | cat | cat with stdout not a terminal");
+}
+
+//2>file besides >&N on a builtin in the shell and on a pipeline stage
+static void check_builtin_fds() {
+    char line[512], path[64];
+
+    snprintf(path, sizeof(path), "/tmp/ptybench.%d", (int) getpid());
+    snprintf(line, sizeof(line), "type echo 2>%s >&2\n", path);
+    check(output_is(line, path, "echo is a shell builtin\n"), "type 2>file >&2");
+    snprintf(line, sizeof(line), "echo a | echo b 2>%s >&2\n", path);
+    check(output_is(line, path, "b\n"), "pipeline echo 2>file >&2");
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(metric *m, double p) {
+    qsort(m->samples, m->n, sizeof(double), compare_double);
+    int i = (int) (p * (m->n - 1) + 0.5);
+    return m->samples[i];
+}
+
+//BUDGETS: "name p95_ms" per line
+static double budget_of(const char *path, const char *name) {
+    FILE *fp = fopen(path, "r");
+    char line[256], key[128];
+    double ms, budget = -1;
+
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] != '#' && sscanf(line, "%127s %lf", key, &ms) == 2 && strcmp(key, name) == 0) {
+            budget = ms;
+        }
+    }
+    fclose(fp);
+    return budget;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: ptybench ISH BUDGETS\n");
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    start_shell(argv[1]);
+    bench_keystroke_echo();
+    bench_prompt_return();
+    bench_job_control();
+    bench_bg_notify();
+    check_bg_builtins();
+    check_rewrite_cat();
+    check_builtin_fds();
+
+    send_str("exit\n");
+    int status;
+    waitpid(shell_pid, &status, 0);
+
+    printf("%-18s %5s %9s %9s %9s\n", "metric", "n", "p50 ms", "p95 ms", "budget");
+    for (int i = 0; i < metric_count; i++) {
+        metric *m = &metrics[i];
+        double p50 = percentile(m, 0.5), p95 = percentile(m, 0.95);
+        double budget = budget_of(argv[2], m->name);
+        int over = budget >= 0 && p95 > budget;
+        printf("%-18s %5d %9.3f %9.3f %9.1f %s\n", m->name, m->n, p50, p95, budget, over ? "OVER BUDGET" : "");
+        failures += over;
+    }
+    printf("%s\n", failures ? "ptybench: FAILED" : "ptybench: ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* cache -- cmd args [< file]
+   stores stdout and exit status of a command on disk and replays them
+   while argv, selected env, the executable and the input file are
+   unchanged. a command which could not run (126, 127) is not stored.
+   a hit marks its entry as used, after each store entries older than a
+   week go, then the least recently used ones until the directory is
+   within $ISH_CACHE_MAX bytes (64M) */
+
+#define CACHE_MAGIC "ISHCACHE"
+#define CACHE_DEFAULT_ENV "PATH:LANG:LC_ALL"
+#define CACHE_MAX_BYTES (64LL << 20)
+#define CACHE_MAX_AGE (7 * 24 * 3600)//seconds since last use
+#define CACHE_KEY_LEN 32//hex digits of an entry name
+
+//stored after the stdout bytes of each entry
+struct cache_trailer {
+    char magic[8];
+    uint64_t key[2];
+    int64_t length;//bytes of stdout
+    int32_t status;//exit status
+    int32_t reserved;
+};
+
+//fnv-1a, two offset bases -> 128 bit key
+static void cache_hash(uint64_t key[2], const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        key[0] = (key[0] ^ p[i]) * 0x100000001b3ULL;
+        key[1] = (key[1] ^ p[i]) * 0x100000001b3ULL;
+    }
+}
+
+static void cache_hash_string(uint64_t key[2], const char *s) {
+    cache_hash(key, s, strlen(s) + 1);
+}
+
+//argv, cwd, selected env and the state of the input file -> key
+static int cache_make_key(uint64_t key[2], int argc, char **argv, char *input_path) {
+    key[0] = 0xcbf29ce484222325ULL;
+    key[1] = 0x84222325cbf29ce4ULL;
+
+    for (int i = 0; i < argc; i++) {
+        cache_hash_string(key, argv[i]);
+    }
+    cache_hash_string(key, dirs_cwd());
+
+    //an upgraded or rebuilt command is another command
+    char *exe = names_search_path(argv[0]);
+    struct stat exe_st;
+    if (exe != NULL && stat(exe, &exe_st) == 0) {
+        cache_hash_string(key, exe);
+        cache_hash(key, &exe_st.st_dev, sizeof(exe_st.st_dev));
+        cache_hash(key, &exe_st.st_ino, sizeof(exe_st.st_ino));
+        cache_hash(key, &exe_st.st_mtim, sizeof(exe_st.st_mtim));
+    }
+    free(exe);
+
+    //ISH_CACHE_ENV=NAME:NAME:...
+    char *names = getenv("ISH_CACHE_ENV");
+    char *list = mem_strdup(MEM_CACHE, names != NULL ? names : CACHE_DEFAULT_ENV);
+    char *save;
+    for (char *name = strtok_r(list, ":", &save); name != NULL; name = strtok_r(NULL, ":", &save)) {
+        char *value = getenv(name);
+        cache_hash_string(key, name);
+        cache_hash_string(key, value != NULL ? value : "");
+    }
+    mem_free(MEM_CACHE, list);
+
+    if (input_path != NULL) {
+        struct stat st;
+        if (stat(input_path, &st) < 0) {
+            return -1;
+        }
+        cache_hash(key, &st.st_dev, sizeof(st.st_dev));
+        cache_hash(key, &st.st_ino, sizeof(st.st_ino));
+        cache_hash(key, &st.st_size, sizeof(st.st_size));
+        cache_hash(key, &st.st_mtim, sizeof(st.st_mtim));
+    }
+    return 0;
+}
+
+//$ISH_CACHE_DIR or ~/.cache/ish
+static int cache_get_dir(char *dir, size_t size) {
+    char *env = getenv("ISH_CACHE_DIR");
+
+    if (env != NULL) {
+        snprintf(dir, size, "%s", env);
+    }
+    else {
+        snprintf(dir, size, "%.*s/.cache", (int) size - 16, shell_home());
+        mkdir(dir, 0755);
+        strcat(dir, "/ish");
+    }
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+//mmap the entry and write the stored stdout -> output_fd
+static int cache_replay(char *path, uint64_t key[2], int output_fd, int *status) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct cache_trailer)) {
+        close(fd);
+        return -1;
+    }
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //used now -> the last one evicted
+    futimens(fd, NULL);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    struct cache_trailer tr;
+    memcpy(&tr, map + st.st_size - sizeof(tr), sizeof(tr));
+    if (memcmp(tr.magic, CACHE_MAGIC, sizeof(tr.magic)) != 0 || tr.key[0] != key[0] || tr.key[1] != key[1] ||
+        tr.length != st.st_size - (off_t) sizeof(tr)) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    madvise(map, tr.length, MADV_SEQUENTIAL);
+    for (int64_t off = 0; off < tr.length; ) {
+        ssize_t n = write(output_fd, map + off, tr.length - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += n;
+    }
+    munmap(map, st.st_size);
+
+    *status = tr.status;
+    return 0;
+}
+
+//stdout of a run which is not stored -> output_fd
+static void cache_pass_through(char *tmp, int output_fd) {
+    char buf[4096];
+    ssize_t n;
+    int fd = open(tmp, O_RDONLY|O_CLOEXEC);
+
+    if (fd < 0) {
+        return;
+    }
+    while ((n = read(fd, buf, sizeof(buf))) > 0 && write(output_fd, buf, n) == n);
+    close(fd);
+}
+
+//run the command with stdout -> tmp file, then add the trailer and rename
+static int cache_store(char *dir, char *path, uint64_t key[2], int argc, char **argv, char *input_path, int output_fd) {
+    if (!command_runs_as_job(get_command_type(argv[0]))) {
+        printf("cache: %s: builtin cannot be cached\n", argv[0]);
+        return -1;
+    }
+
+    char tmp[PATH_DIR_BUFSIZE + 16];
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", dir);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        printf("cache: %s: cannot create entry\n", dir);
+        return -1;
+    }
+    close(fd);
+
+    job *job_tmp = my_shell_make_job(argc, argv);
+    if (input_path != NULL) {
+        job_tmp->process_list->input_redirection = mem_strdup(MEM_JOBS, input_path);
+    }
+    job_tmp->process_list->output_redirection = mem_strdup(MEM_JOBS, tmp);
+
+    //suspended or failed to start
+    if (my_shell_launch_job(job_tmp) < 0 || shell->last_status >= 128) {
+        unlink(tmp);
+        return -1;
+    }
+    //not found / not executable -> its message is shown, not stored
+    if (shell->last_status == 126 || shell->last_status == 127) {
+        cache_pass_through(tmp, output_fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    fd = open(tmp, O_WRONLY|O_APPEND|O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    struct cache_trailer tr;
+    memset(&tr, 0, sizeof(tr));
+    memcpy(tr.magic, CACHE_MAGIC, sizeof(tr.magic));
+    tr.key[0] = key[0];
+    tr.key[1] = key[1];
+    tr.length = st.st_size;
+    tr.status = shell->last_status;
+
+    if (write(fd, &tr, sizeof(tr)) != sizeof(tr) || close(fd) < 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct cache_entry_ {
+    char name[CACHE_KEY_LEN + 1];
+    off_t size;
+    struct timespec used;
+} cache_entry;
+
+static int cache_entry_compare(const void *a, const void *b) {
+    const struct timespec *x = &((const cache_entry*) a)->used, *y = &((const cache_entry*) b)->used;
+    if (x->tv_sec != y->tv_sec) {
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    }
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+//entries unused for CACHE_MAX_AGE out, then the least recently used until the rest fits
+static void cache_evict(char *dir) {
+    char *env = getenv("ISH_CACHE_MAX");
+    long long max = env != NULL ? atoll(env) : CACHE_MAX_BYTES;
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    cache_entry *entries = NULL;
+    int n = 0, cap = 0;
+    long long total = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        struct stat st;
+        int entry = strlen(ent->d_name) == CACHE_KEY_LEN && strspn(ent->d_name, "0123456789abcdef") == CACHE_KEY_LEN;
+        //tmp.XXXXXX of a store which never finished
+        if ((!entry && strncmp(ent->d_name, "tmp.", 4) != 0) ||
+            fstatat(dirfd(d), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (now - st.st_mtime > CACHE_MAX_AGE) {
+            unlinkat(dirfd(d), ent->d_name, 0);
+            continue;
+        }
+        if (!entry) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = realloc(entries, cap * sizeof(cache_entry));
+        }
+        memcpy(entries[n].name, ent->d_name, CACHE_KEY_LEN + 1);
+        entries[n].size = st.st_size;
+        entries[n].used = st.st_mtim;
+        total += st.st_size;
+        n++;
+    }
+
+    if (total > max) {
+        qsort(entries, n, sizeof(cache_entry), cache_entry_compare);
+        for (int i = 0; i < n && total > max; i++) {
+            if (unlinkat(dirfd(d), entries[i].name, 0) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+    free(entries);
+    closedir(d);
+}
+
+//cache
+int my_shell_cache(int argc, char **argv, char *input_path, int output_fd) {
+    int start = 1;
+
+    if (start < argc && strcmp(argv[start], "--") == 0) {
+        start++;
+    }
+    if (start >= argc) {
+        printf("usage: cache -- command [args...]\n");
+        return 2;
+    }
+
+    uint64_t key[2];
+    if (cache_make_key(key, argc - start, argv + start, input_path) < 0) {
+        printf("no such file or directory\n");
+        return 1;
+    }
+
+    char dir[PATH_DIR_BUFSIZE];
+    char path[PATH_DIR_BUFSIZE + 64];
+    if (cache_get_dir(dir, sizeof(dir)) < 0) {
+        printf("cache: %s: cannot create directory\n", dir);
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/%016llx%016llx", dir, (unsigned long long) key[0], (unsigned long long) key[1]);
+
+    int status;
+    //hit
+    if (cache_replay(path, key, output_fd, &status) == 0) {
+        return status;
+    }
+    //miss
+    if (cache_store(dir, path, key, argc - start, argv + start, input_path, output_fd) < 0) {
+        return shell->last_status;
+    }
+    if (cache_replay(path, key, output_fd, &status) < 0) {
+        status = shell->last_status;
+    }
+    //after the replay, an entry larger than the limit is still shown once
+    cache_evict(dir);
+    return status;
+}
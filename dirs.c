@@ -0,0 +1,625 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* working directory.
+   cd [-L|-P] [dir|-|~/dir]
+   pushd [dir|+N]    popd [+N]    dirs [-c|-v]
+   z [word...]    z -l [word...]    z -x
+
+   the shell keeps the logical directory (PWD, symlinks as they were
+   followed) in shell->cur_dir and works it out from the path given
+   instead of asking getcwd, cd .. leaves a symlink the way it was
+   entered and a deep NFS path costs nothing per prompt. cd -P and a
+   logical path which cannot be entered fall back to the physical one. a
+   relative dir is looked for in CDPATH first. every directory entered
+   is counted in the z index, z words goes to the most frecent directory
+   whose path has the words in that order. the index is a file of fixed
+   slots mapped shared (shells update it in place under flock), found at
+   $ISH_Z_FILE or ~/.local/share/ish/z. */
+
+#define DIRS_MAX 64//pushd stack
+
+#define Z_MAGIC "ISHZ"
+#define Z_FORMAT 1
+#define Z_GROW 64//slots added when the file is full
+#define Z_MAX_RANK 9000.0//ranks age when their sum goes over this
+#define Z_PATH_MAX 248//longer paths are not indexed
+
+typedef struct z_header_ {
+    char magic[4];
+    uint32_t format;
+    uint32_t count;
+    uint32_t cap;
+} z_header;
+
+typedef struct z_slot_ {
+    float rank;//visits, aged
+    uint32_t last;//unix time of the last visit
+    char path[Z_PATH_MAX];
+} z_slot;
+
+static char *dirs_stack[DIRS_MAX];//below cur_dir, [0] is the top
+static int dirs_len = 0;
+
+static int z_fd = -1;//-2 -> no index
+static z_header *z_map = NULL;
+static size_t z_map_size = 0;
+
+//dir relative to base -> absolute path without ., .. and //, -1 when it does not fit
+static int dirs_logical(const char *base, const char *dir, char *out, size_t size) {
+    size_t len = 0;
+
+    if (dir[0] != '/') {
+        len = snprintf(out, size, "%s", base);
+        if (len >= size) {
+            return -1;
+        }
+        while (len > 0 && out[len - 1] == '/') {
+            len--;
+        }
+    }
+    out[len] = '\0';
+    for (const char *p = dir; *p != '\0'; ) {
+        size_t n = strcspn(p, "/");
+        if (n == 2 && strncmp(p, "..", 2) == 0) {
+            char *slash = strrchr(out, '/');
+            len = slash != NULL ? slash - out : 0;
+            out[len] = '\0';
+        }
+        else if (n > 0 && !(n == 1 && p[0] == '.')) {
+            if (len + n + 2 > size) {
+                return -1;
+            }
+            out[len++] = '/';
+            memcpy(out + len, p, n);
+            len += n;
+            out[len] = '\0';
+        }
+        p += n + (p[n] == '/');
+    }
+    if (len == 0) {
+        snprintf(out, size, "/");
+    }
+    return 0;
+}
+
+//logical cwd, the first time $PWD when it is where the shell is, else getcwd
+const char* dirs_cwd() {
+    struct stat here, pwd;
+    char *env = getenv("PWD");
+
+    if (shell->cur_dir[0] != '\0') {
+        return shell->cur_dir;
+    }
+    if (env != NULL && env[0] == '/' && strlen(env) < sizeof(shell->cur_dir) &&
+        stat(".", &here) == 0 && stat(env, &pwd) == 0 && here.st_dev == pwd.st_dev && here.st_ino == pwd.st_ino) {
+        dirs_logical("/", env, shell->cur_dir, sizeof(shell->cur_dir));
+    }
+    else if (getcwd(shell->cur_dir, sizeof(shell->cur_dir)) == NULL) {
+        snprintf(shell->cur_dir, sizeof(shell->cur_dir), ".");
+    }
+    setenv("PWD", shell->cur_dir, 1);
+    return shell->cur_dir;
+}
+
+//z file -> mapped (again when another shell made it bigger), -1 -> no index
+static int z_open() {
+    if (z_fd == -2) {
+        return -1;
+    }
+    if (z_fd < 0) {
+        char path[PATH_DIR_BUFSIZE];
+        char *env = getenv("ISH_Z_FILE");
+        if (env != NULL) {
+            snprintf(path, sizeof(path), "%s", env);
+        }
+        else {
+            //~/.local/share/ish/z, made on the way
+            const char *parts[] = {"/.local", "/share", "/ish"};
+            snprintf(path, sizeof(path), "%.*s", PATH_DIR_BUFSIZE - 32, shell_home());
+            for (int i = 0; i < 3; i++) {
+                strcat(path, parts[i]);
+                mkdir(path, 0755);
+            }
+            strcat(path, "/z");
+        }
+        z_fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+        if (z_fd < 0) {
+            z_fd = -2;
+            return -1;
+        }
+        //new file -> header
+        flock(z_fd, LOCK_EX);
+        struct stat st;
+        if (fstat(z_fd, &st) == 0 && st.st_size == 0) {
+            z_header hdr = {{Z_MAGIC[0], Z_MAGIC[1], Z_MAGIC[2], Z_MAGIC[3]}, Z_FORMAT, 0, 0};
+            write(z_fd, &hdr, sizeof(hdr));
+        }
+        flock(z_fd, LOCK_UN);
+    }
+
+    size_t size = z_map != NULL ? sizeof(z_header) + (size_t) z_map->cap * sizeof(z_slot) : sizeof(z_header);
+    if (z_map == NULL || size != z_map_size) {
+        struct stat st;
+        if (z_map != NULL) {
+            munmap(z_map, z_map_size);
+            z_map = NULL;
+        }
+        if (fstat(z_fd, &st) < 0 || st.st_size < (off_t) sizeof(z_header)) {
+            return -1;
+        }
+        z_map_size = st.st_size;
+        z_map = mmap(NULL, z_map_size, PROT_READ|PROT_WRITE, MAP_SHARED, z_fd, 0);
+        if (z_map == MAP_FAILED || memcmp(z_map->magic, Z_MAGIC, 4) != 0 || z_map->format != Z_FORMAT ||
+            sizeof(z_header) + (size_t) z_map->cap * sizeof(z_slot) > z_map_size) {
+            if (z_map != MAP_FAILED) {
+                munmap(z_map, z_map_size);
+            }
+            z_map = NULL;
+            close(z_fd);
+            z_fd = -2;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static z_slot* z_slots() {
+    return (z_slot*) (z_map + 1);
+}
+
+//slot i goes, the last one takes its place
+static void z_remove(uint32_t i) {
+    z_slot *slots = z_slots();
+    slots[i] = slots[--z_map->count];
+}
+
+//one more visit of path (shorter than Z_PATH_MAX, under the lock of the caller)
+static void z_visit(const char *path) {
+    z_slot *slots = z_slots();
+    double sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < z_map->count && strcmp(slots[i].path, path) != 0; i++);
+    if (i == z_map->count) {
+        if (z_map->count == z_map->cap) {
+            uint32_t cap = z_map->cap + Z_GROW;
+            if (ftruncate(z_fd, sizeof(z_header) + (size_t) cap * sizeof(z_slot)) < 0) {
+                return;
+            }
+            z_map->cap = cap;
+            if (z_open() < 0) {
+                return;
+            }
+            slots = z_slots();
+        }
+        memset(&slots[i], 0, sizeof(z_slot));
+        memcpy(slots[i].path, path, strlen(path) + 1);
+        z_map->count++;
+    }
+    slots[i].rank += 1;
+    slots[i].last = time(NULL);
+
+    for (i = 0; i < z_map->count; i++) {
+        sum += slots[i].rank;
+    }
+    if (sum > Z_MAX_RANK) {
+        for (i = 0; i < z_map->count; ) {
+            slots[i].rank *= 0.99;
+            if (slots[i].rank < 1) {
+                z_remove(i);
+            }
+            else {
+                i++;
+            }
+        }
+    }
+}
+
+//cd to path -> counted in the index (home and / are not)
+static void z_add(const char *path) {
+    if (strlen(path) >= Z_PATH_MAX || strcmp(path, "/") == 0 || strcmp(path, shell_home()) == 0 || z_open() < 0) {
+        return;
+    }
+    flock(z_fd, LOCK_EX);
+    //another shell may have grown it
+    if (z_open() == 0) {
+        z_visit(path);
+    }
+    flock(z_fd, LOCK_UN);
+}
+
+//rank weighted by how long ago the last visit was
+static double z_frecency(z_slot *slot, time_t now) {
+    double age = difftime(now, slot->last);
+    if (age < 3600) {
+        return slot->rank * 4;
+    }
+    if (age < 86400) {
+        return slot->rank * 2;
+    }
+    if (age < 604800) {
+        return slot->rank / 2;
+    }
+    return slot->rank / 4;
+}
+
+//words found in path in this order
+static int z_match(const char *path, char **words, int n, int nocase) {
+    for (int i = 0; i < n; i++) {
+        const char *at = nocase ? strcasestr(path, words[i]) : strstr(path, words[i]);
+        if (at == NULL) {
+            return 0;
+        }
+        path = at + strlen(words[i]);
+    }
+    return 1;
+}
+
+static time_t z_sort_now;
+
+static int z_compare(const void *a, const void *b) {
+    double fa = z_frecency(*(z_slot**) a, z_sort_now), fb = z_frecency(*(z_slot**) b, z_sort_now);
+    return fa < fb ? -1 : fa > fb;
+}
+
+//slots matching words, best last -> how many (in *out, malloc'd)
+static int z_query(char **words, int n, z_slot ***out) {
+    uint32_t count = z_map->count;
+    z_slot **found = (z_slot**) malloc((count + 1) * sizeof(z_slot*));
+    int len = 0;
+
+    for (int nocase = 0; nocase < 2 && len == 0; nocase++) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (z_match(z_slots()[i].path, words, n, nocase)) {
+                found[len++] = &z_slots()[i];
+            }
+        }
+    }
+    z_sort_now = time(NULL);
+    qsort(found, len, sizeof(z_slot*), z_compare);
+    *out = found;
+    return len;
+}
+
+//dir -> cwd (the logical path unless physical), 0 on success
+static int dirs_enter(const char *dir, int physical) {
+    char path[PATH_DIR_BUFSIZE];
+
+    if (!physical && dirs_logical(shell->cur_dir, dir, path, sizeof(path)) == 0 && chdir(path) == 0) {
+        setenv("OLDPWD", shell->cur_dir, 1);
+        snprintf(shell->cur_dir, sizeof(shell->cur_dir), "%s", path);
+    }
+    //cd -P, or the logical path goes through a .. the file system does not have
+    else if (chdir(dir) == 0) {
+        setenv("OLDPWD", shell->cur_dir, 1);
+        if (getcwd(shell->cur_dir, sizeof(shell->cur_dir)) == NULL) {
+            snprintf(shell->cur_dir, sizeof(shell->cur_dir), "%s", dir);
+        }
+    }
+    else {
+        return -1;
+    }
+    setenv("PWD", shell->cur_dir, 1);
+    z_add(shell->cur_dir);
+    return 0;
+}
+
+//dir through CDPATH -> cwd, 0 on success, 1 -> found in CDPATH (the new cwd is printed)
+static int dirs_cd(const char *dir, int physical) {
+    char *cdpath = getenv("CDPATH");
+    int err;
+
+    if (dir[0] != '/' && strncmp(dir, "./", 2) != 0 && strncmp(dir, "../", 3) != 0 &&
+        strcmp(dir, ".") != 0 && strcmp(dir, "..") != 0 && cdpath != NULL) {
+        for (const char *p = cdpath; ; ) {
+            size_t n = strcspn(p, ":");
+            char candidate[PATH_DIR_BUFSIZE];
+            struct stat st;
+            //an empty entry is .
+            snprintf(candidate, sizeof(candidate), "%.*s%s%s", (int) n, p, n > 0 ? "/" : "", dir);
+            if (stat(candidate, &st) == 0 && S_ISDIR(st.st_mode) && dirs_enter(candidate, physical) == 0) {
+                return n > 0;
+            }
+            if (p[n] == '\0') {
+                break;
+            }
+            p += n + 1;
+        }
+    }
+    if (dirs_enter(dir, physical) == 0) {
+        return 0;
+    }
+    err = errno;
+    printf("cd: %s: %s\n", dir, strerror(err));
+    return -1;
+}
+
+//cd [-L|-P] [dir|-]
+int my_shell_cd(int argc, char **argv) {
+    int physical = 0, i = 1;
+    const char *dir;
+    char home_dir[PATH_DIR_BUFSIZE];
+
+    dirs_cwd();
+    for (; i < argc && (strcmp(argv[i], "-P") == 0 || strcmp(argv[i], "-L") == 0); i++) {
+        physical = argv[i][1] == 'P';
+    }
+    if (i + 1 < argc) {
+        printf("cd: too many arguments\n");
+        return 1;
+    }
+    if (i == argc) {
+        dir = shell_home();
+    }
+    else if (strcmp(argv[i], "-") == 0) {
+        dir = getenv("OLDPWD");
+        if (dir == NULL) {
+            printf("cd: OLDPWD not set\n");
+            return 1;
+        }
+        //dir points into the environment, which the cd rewrites
+        char old[PATH_DIR_BUFSIZE];
+        snprintf(old, sizeof(old), "%s", dir);
+        if (dirs_enter(old, physical) < 0) {
+            printf("cd: %s: %s\n", old, strerror(errno));
+            return 1;
+        }
+        printf("%s\n", shell->cur_dir);
+        return 0;
+    }
+    //~ and ~/dir, nothing else in the shell expands it
+    else if (argv[i][0] == '~' && (argv[i][1] == '/' || argv[i][1] == '\0')) {
+        snprintf(home_dir, sizeof(home_dir), "%s%s", shell_home(), argv[i] + 1);
+        dir = home_dir;
+    }
+    else {
+        dir = argv[i];
+    }
+
+    int found = dirs_cd(dir, physical);
+    if (found < 0) {
+        return 1;
+    }
+    if (found > 0) {
+        printf("%s\n", shell->cur_dir);
+    }
+    return 0;
+}
+
+//path with ~ for home
+static void dirs_print_path(FILE *fp, const char *path) {
+    const char *home = shell_home();
+    size_t len = strlen(home);
+    if (len > 1 && strncmp(path, home, len) == 0 && (path[len] == '/' || path[len] == '\0')) {
+        fprintf(fp, "~%s", path + len);
+    }
+    else {
+        fprintf(fp, "%s", path);
+    }
+}
+
+//cwd and the stack, one line or -v one per line
+static void dirs_print(FILE *fp, int verbose) {
+    for (int i = 0; i <= dirs_len; i++) {
+        if (verbose) {
+            fprintf(fp, "%2d  ", i);
+        }
+        dirs_print_path(fp, i == 0 ? shell->cur_dir : dirs_stack[i - 1]);
+        fprintf(fp, "%s", verbose || i == dirs_len ? "\n" : " ");
+    }
+}
+
+//+N -> N, -1 when arg is no such index
+static int dirs_index(const char *arg) {
+    char *end;
+    if (arg[0] != '+') {
+        return -1;
+    }
+    long n = strtol(arg + 1, &end, 10);
+    return *end == '\0' && end != arg + 1 && n >= 0 && n <= dirs_len ? (int) n : -1;
+}
+
+//pushd [dir|+N]
+static int dirs_pushd(int argc, char **argv) {
+    char *top;
+
+    if (argc > 2) {
+        printf("usage: pushd [dir|+N]\n");
+        return 2;
+    }
+    //no dir -> the two on top change places, +N -> the stack turns until N is on top
+    if (argc == 1 || argv[1][0] == '+') {
+        int n = argc == 1 ? 1 : dirs_index(argv[1]);
+        if (n < 0 || (argc == 1 && dirs_len == 0)) {
+            printf("pushd: %s\n", argc == 1 ? "no other directory" : "bad index");
+            return 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        char *prev = mem_strdup(MEM_DIRS, shell->cur_dir);
+        if (dirs_enter(dirs_stack[n - 1], 0) < 0) {
+            printf("pushd: %s: %s\n", dirs_stack[n - 1], strerror(errno));
+            mem_free(MEM_DIRS, prev);
+            return 1;
+        }
+        //the old cwd and the ones above N go to the bottom in their order
+        char *old[DIRS_MAX + 1];
+        int len = 0;
+        old[len++] = prev;
+        for (int i = 0; i < n - 1; i++) {
+            old[len++] = dirs_stack[i];
+        }
+        mem_free(MEM_DIRS, dirs_stack[n - 1]);
+        memmove(dirs_stack, dirs_stack + n, (dirs_len - n) * sizeof(char*));
+        dirs_len -= n;
+        if (argc == 1) {
+            memmove(dirs_stack + 1, dirs_stack, dirs_len * sizeof(char*));
+            dirs_stack[0] = old[0];
+            dirs_len++;
+        }
+        else {
+            memcpy(dirs_stack + dirs_len, old, len * sizeof(char*));
+            dirs_len += len;
+        }
+        return 0;
+    }
+
+    if (dirs_len >= DIRS_MAX) {
+        printf("pushd: directory stack full\n");
+        return 1;
+    }
+    top = mem_strdup(MEM_DIRS, shell->cur_dir);
+    if (dirs_cd(argv[1], 0) < 0) {
+        mem_free(MEM_DIRS, top);
+        return 1;
+    }
+    memmove(dirs_stack + 1, dirs_stack, dirs_len * sizeof(char*));
+    dirs_stack[0] = top;
+    dirs_len++;
+    return 0;
+}
+
+//popd [+N]
+static int dirs_popd(int argc, char **argv) {
+    int n = argc > 1 ? dirs_index(argv[1]) : 0;
+
+    if (argc > 2 || n < 0) {
+        printf("usage: popd [+N]\n");
+        return 2;
+    }
+    if (dirs_len == 0) {
+        printf("popd: directory stack empty\n");
+        return 1;
+    }
+    //+0 is the cwd -> the entry below it becomes the cwd
+    if (n == 0) {
+        if (dirs_enter(dirs_stack[0], 0) < 0) {
+            printf("popd: %s: %s\n", dirs_stack[0], strerror(errno));
+            return 1;
+        }
+        n = 1;
+    }
+    mem_free(MEM_DIRS, dirs_stack[n - 1]);
+    memmove(dirs_stack + n - 1, dirs_stack + n, (dirs_len - n) * sizeof(char*));
+    dirs_len--;
+    return 0;
+}
+
+//z [word...], z -l [word...], z -x
+static int dirs_z(int argc, char **argv, FILE *fp) {
+    int list = argc == 1 || strcmp(argv[1], "-l") == 0;
+    int skip = argc > 1 && argv[1][0] == '-' ? 2 : 1;
+
+    if (z_open() < 0) {
+        fprintf(fp, "z: no index\n");
+        return 1;
+    }
+    if (argc > 1 && strcmp(argv[1], "-x") == 0) {
+        flock(z_fd, LOCK_EX);
+        if (z_open() == 0) {
+            for (uint32_t i = 0; i < z_map->count; i++) {
+                if (strcmp(z_slots()[i].path, shell->cur_dir) == 0) {
+                    z_remove(i);
+                    break;
+                }
+            }
+        }
+        flock(z_fd, LOCK_UN);
+        return 0;
+    }
+    if (argc > 1 && argv[1][0] == '-' && !list) {
+        fprintf(fp, "usage: z [word...]\n       z -l [word...]\n       z -x\n");
+        return 2;
+    }
+
+    z_slot **found;
+    int len = z_query(argv + skip, argc - skip, &found);
+    int status = 0;
+    if (list) {
+        time_t now = time(NULL);
+        for (int i = 0; i < len; i++) {
+            fprintf(fp, "%-10.1f %s\n", z_frecency(found[i], now), found[i]->path);
+        }
+    }
+    else {
+        //z proj1 -> .../proj1 rather than a more frecent .../proj17
+        int exact = 0;
+        for (int i = 0; i < len && argc > skip; i++) {
+            const char *slash = strrchr(found[i]->path, '/');
+            if (slash != NULL && strcmp(slash + 1, argv[argc - 1]) == 0) {
+                found[exact++] = found[i];
+            }
+        }
+        len = exact > 0 ? exact : len;
+        //a directory which is gone is skipped, the next best is tried
+        status = 1;
+        for (int i = len - 1; i >= 0; i--) {
+            char path[Z_PATH_MAX];
+            snprintf(path, sizeof(path), "%s", found[i]->path);
+            if (dirs_enter(path, 0) == 0) {
+                status = 0;
+                break;
+            }
+        }
+        if (status != 0) {
+            fprintf(fp, "z: no match\n");
+        }
+    }
+    free(found);
+    return status;
+}
+
+//pushd, popd, dirs, z
+int my_shell_dirs(int argc, char **argv, int output_fd) {
+    int status = 0;
+
+    dirs_cwd();
+    if (strcmp(argv[0], "pushd") == 0) {
+        status = dirs_pushd(argc, argv);
+    }
+    else if (strcmp(argv[0], "popd") == 0) {
+        status = dirs_popd(argc, argv);
+    }
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    if (strcmp(argv[0], "z") == 0) {
+        status = dirs_z(argc, argv, fp);
+    }
+    else if (strcmp(argv[0], "dirs") == 0) {
+        if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+            for (int i = 0; i < dirs_len; i++) {
+                mem_free(MEM_DIRS, dirs_stack[i]);
+            }
+            dirs_len = 0;
+        }
+        else if (argc > 1 && strcmp(argv[1], "-v") != 0) {
+            fprintf(fp, "usage: dirs [-c|-v]\n");
+            status = 2;
+        }
+        else {
+            dirs_print(fp, argc > 1);
+        }
+    }
+    //pushd and popd show the stack they left
+    else if (status == 0) {
+        dirs_print(fp, 0);
+    }
+    fclose(fp);
+    return status;
+}
@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* numbered file descriptors.
+   cmd 2>file  cmd 2>>file  cmd 3<file  cmd 2>&1  cmd >&3  cmd 3>&-
+   exec 3>>log  exec 3<file  exec 2>/dev/null  exec 3>&-
+   exec cmd args
+   exec
+
+   the redirections of a command are applied by its child in the order
+   written, after stdin and stdout (pipes, < and >) are in place. exec
+   without a command keeps them in the shell: 0-2 are replaced for the
+   shell itself, 3-9 are held close-on-exec above 9 and reach a command
+   only when it names them (echo x >&3), so a loop writing to a log opens
+   it once. a builtin running in the shell takes <&N / >&N as its
+   input / output, with any other redirection it forks if it runs as a
+   job (echo, find, filters, plugins) and otherwise runs with 0-9 of the
+   shell redirected until it returns. everything the shell opens is close-on-exec, a child gets
+   0-2 and the descriptors it asks for, nothing else. exec alone lists
+   the descriptors kept by exec. */
+
+#define FDS_HIGH 10//user descriptors are held from here on
+
+//user descriptor -> descriptor of the shell, -1 -> not open
+static int user_fd[FDS_USER] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+
+//N of a redirection -> descriptor it refers to in the shell, -1 -> 3-9 not opened by exec
+static int fds_resolve(int n) {
+    if (n >= 3 && n < FDS_USER) {
+        return user_fd[n];
+    }
+    return n;
+}
+
+static int fds_open(fd_redirect *r) {
+    int flags = O_CLOEXEC;
+    switch (r->action) {
+        case REDIR_READ:
+            flags |= O_RDONLY;
+            break;
+        case REDIR_WRITE:
+            flags |= O_WRONLY|O_CREAT|O_TRUNC;
+            break;
+        default:
+            flags |= O_WRONLY|O_CREAT|O_APPEND;
+            break;
+    }
+    return open(r->path, flags, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+}
+
+//in the child after stdin / stdout are set up (no allocation), -1 -> something could not be opened
+int fds_apply(process *proc) {
+    int set = 0;//descriptors already redirected by proc, they refer to themselves
+
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        if (r->action == REDIR_CLOSE) {
+            close(r->fd);
+            set &= ~(1 << r->fd);
+            continue;
+        }
+        int fd = r->action == REDIR_DUP ? ((set & (1 << r->source)) ? r->source : fds_resolve(r->source)) : fds_open(r);
+        if (fd < 0 && r->action != REDIR_DUP) {
+            fprintf(stderr, "%s: %s\n", r->path, strerror(errno));
+            return -1;
+        }
+        if (r->action == REDIR_DUP && (fd < 0 || fcntl(fd, F_GETFD) < 0)) {
+            fprintf(stderr, "%d: bad file descriptor\n", r->source);
+            return -1;
+        }
+        if (fd == r->fd) {
+            //2>&2, or open() happened to return N -> only close-on-exec has to go
+            fcntl(fd, F_SETFD, 0);
+        }
+        else {
+            dup2(fd, r->fd);
+            if (r->action != REDIR_DUP) {
+                close(fd);
+            }
+        }
+        set |= 1 << r->fd;
+    }
+    return 0;
+}
+
+//fd (0 or 1) of a builtin running in the shell: >&N / <&N -> duplicate of what N is, else -1,
+//FDS_BAD -> N is not open (printed)
+int fds_stage_fd(process *proc, int fd) {
+    fd_redirect *dup = NULL;
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        if (r->fd == fd) {
+            dup = r->action == REDIR_DUP ? r : NULL;
+        }
+    }
+    if (dup == NULL) {
+        return -1;
+    }
+    int source = fds_resolve(dup->source);
+    int copy = source >= 0 ? fcntl(source, F_DUPFD_CLOEXEC, 3) : -1;
+    if (copy < 0) {
+        printf("%d: bad file descriptor\n", dup->source);
+        return FDS_BAD;
+    }
+    return copy;
+}
+
+//1 -> proc has redirections besides the <&N / >&N of fds_stage_fd
+int fds_other(process *proc) {
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        if (r->action != REDIR_DUP || r->fd > 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void fds_hold(fds_saved *saved, int n) {
+    if (saved->mask & (1 << n)) {
+        return;
+    }
+    saved->mask |= 1 << n;
+    saved->flags[n] = fcntl(n, F_GETFD);
+    saved->fd[n] = saved->flags[n] >= 0 ? fcntl(n, F_DUPFD_CLOEXEC, FDS_HIGH) : -1;
+}
+
+//builtin in the shell with 2>file, 3>&1 ... -> its input / output on 0 / 1 and its redirections applied,
+//-1 -> one failed (printed), fds_leave either way
+int fds_enter(process *proc, int input_fd, int output_fd, fds_saved *saved) {
+    saved->mask = 0;
+    fds_hold(saved, 0);
+    fds_hold(saved, 1);
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        fds_hold(saved, r->fd);
+    }
+    fflush(stdout);
+    if (input_fd != 0) {
+        dup2(input_fd, 0);
+    }
+    if (output_fd != 1) {
+        dup2(output_fd, 1);
+    }
+    return fds_apply(proc);
+}
+
+//0-9 held by fds_enter as they were, close-on-exec too
+void fds_leave(fds_saved *saved) {
+    fflush(stdout);
+    for (int n = 0; n < FDS_USER; n++) {
+        if (!(saved->mask & (1 << n))) {
+            continue;
+        }
+        if (saved->fd[n] >= 0) {
+            dup3(saved->fd[n], n, (saved->flags[n] & FD_CLOEXEC) ? O_CLOEXEC : 0);
+            close(saved->fd[n]);
+        }
+        else {
+            close(n);
+        }
+    }
+}
+
+//exec N>file ... in the shell itself
+static int fds_keep(fd_redirect *r) {
+    int fd = -1;
+
+    if (r->action == REDIR_CLOSE) {
+        if (r->fd < 3) {
+            close(r->fd);
+        }
+        else if (user_fd[r->fd] >= 0) {
+            close(user_fd[r->fd]);
+            user_fd[r->fd] = -1;
+        }
+        return 0;
+    }
+    if (r->action == REDIR_DUP) {
+        int source = fds_resolve(r->source);
+        fd = source >= 0 ? fcntl(source, F_DUPFD_CLOEXEC, FDS_HIGH) : -1;
+        if (fd < 0) {
+            printf("exec: %d: bad file descriptor\n", r->source);
+            return -1;
+        }
+    }
+    else if ((fd = fds_open(r)) < 0) {
+        printf("exec: %s: %s\n", r->path, strerror(errno));
+        return -1;
+    }
+
+    if (r->fd < 3) {
+        if (r->fd == 1) {
+            fflush(stdout);
+        }
+        dup2(fd, r->fd);
+        close(fd);
+        return 0;
+    }
+    //above the range a command can name, so no redirection of a child overwrites it
+    if (fd < FDS_HIGH) {
+        int high = fcntl(fd, F_DUPFD_CLOEXEC, FDS_HIGH);
+        close(fd);
+        fd = high;
+    }
+    if (user_fd[r->fd] >= 0) {
+        close(user_fd[r->fd]);
+    }
+    user_fd[r->fd] = fd;
+    return 0;
+}
+
+//exec alone -> descriptors kept by exec
+static int fds_list(int output_fd) {
+    char path[64], target[4096];
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    for (int n = 3; n < FDS_USER; n++) {
+        if (user_fd[n] < 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", user_fd[n]);
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        target[len > 0 ? len : 0] = '\0';
+        int mode = fcntl(user_fd[n], F_GETFL) & O_ACCMODE;
+        fprintf(fp, "%d%s %s\n", n, mode == O_RDONLY ? "<" : (mode == O_WRONLY ? ">" : "<>"), target);
+    }
+    fclose(fp);
+    return 0;
+}
+
+static const int EXEC_SIGNALS[] = {SIGINT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE};
+#define EXEC_NSIGNALS (sizeof(EXEC_SIGNALS) / sizeof(EXEC_SIGNALS[0]))
+
+//0-9 of the shell before exec cmd applies its redirections, -1 -> not open
+static void fds_save(int *saved) {
+    for (int n = 0; n < FDS_USER; n++) {
+        saved[n] = fcntl(n, F_DUPFD_CLOEXEC, FDS_HIGH);
+    }
+}
+
+//exec cmd failed -> 0-9 of the shell as they were
+static void fds_restore(int *saved) {
+    fflush(stdout);
+    for (int n = 0; n < FDS_USER; n++) {
+        if (saved[n] >= 0) {
+            dup2(saved[n], n);
+            close(saved[n]);
+        }
+        else {
+            close(n);
+        }
+    }
+}
+
+//exec [redirections] / exec cmd args [redirections]
+int my_shell_exec(process *proc, int input_fd, int output_fd) {
+    if (proc->process_argc > 1) {
+        struct sigaction dfl, old[EXEC_NSIGNALS];
+        int saved[FDS_USER];
+
+        fflush(stdout);
+        fds_save(saved);
+        if (input_fd != 0) {
+            dup2(input_fd, 0);
+        }
+        if (output_fd != 1) {
+            dup2(output_fd, 1);
+        }
+        if (fds_apply(proc) < 0) {
+            fds_restore(saved);
+            return 1;
+        }
+        //the shell ignores these, the command must not inherit that
+        memset(&dfl, 0, sizeof(dfl));
+        dfl.sa_handler = SIG_DFL;
+        for (int i = 0; i < EXEC_NSIGNALS; i++) {
+            sigaction(EXEC_SIGNALS[i], &dfl, &old[i]);
+        }
+        execvp(proc->argument_list[1], proc->argument_list + 1);
+        int err = errno;
+        for (int i = 0; i < EXEC_NSIGNALS; i++) {
+            sigaction(EXEC_SIGNALS[i], &old[i], NULL);
+        }
+        fds_restore(saved);
+        printf("exec: %s: %s\n", proc->argument_list[1], strerror(err));
+        return 127;
+    }
+    if (proc->input_redirection == NULL && proc->output_redirection == NULL && proc->fd_redirects == NULL) {
+        return fds_list(output_fd);
+    }
+
+    //exec < file / exec > file -> stdin / stdout of the shell
+    if (input_fd != 0) {
+        dup2(input_fd, 0);
+    }
+    if (output_fd != 1) {
+        fflush(stdout);
+        dup2(output_fd, 1);
+    }
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        if (fds_keep(r) < 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
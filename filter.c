@@ -0,0 +1,823 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include "shell.h"
+
+/* in-process text filters.
+   wc [-lwc] < FILE
+   grep [-F] [-c] [-v] PATTERN < FILE
+   head [-n N | -N | -c N] < FILE
+
+   when the input is a redirected regular file the shell maps it and scans
+   it itself, with SSE2/AVX2 kernels picked at startup, and big files are
+   split over one thread per cpu. as a stage of a foreground pipeline the
+   same filters run on a shell thread (stage.c) and stream from the pipe.
+   anything else (other options, a regex pattern, background jobs) runs
+   the real command. */
+
+#define FILTER_MAX_THREADS 16
+#define FILTER_MIN_CHUNK (16 << 20)//bytes, smaller inputs are not split
+#define FILTER_ROUND_CHUNK (64 << 20)//grep output is written every nthreads * this
+
+#define FILTER_STREAM_BUFSIZE (256 << 10)
+
+#define WC_LINES (1 << 0)
+#define WC_WORDS (1 << 1)
+#define WC_BYTES (1 << 2)
+
+typedef struct filter_opts_ {
+    char kind;//'w'c, 'g'rep, 'h'ead
+    int what;//wc
+    char *pat;//grep
+    size_t pat_len;
+    int invert;
+    int count_only;
+    long lines;//head
+    long bytes;//-1 -> lines
+} filter_opts;
+
+static volatile sig_atomic_t filter_interrupted = 0;
+
+/* scalar kernels */
+
+static size_t count_newlines_scalar(const char *s, size_t n) {
+    size_t count = 0;
+    const char *end = s + n;
+    while ((s = memchr(s, '\n', end - s)) != NULL) {
+        count++;
+        s++;
+    }
+    return count;
+}
+
+static int is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+//prev_space -> whether the byte before s was white space
+static size_t count_words_scalar(const char *s, size_t n, int prev_space) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        int space = is_space(s[i]);
+        count += prev_space && !space;
+        prev_space = space;
+    }
+    return count;
+}
+
+static const char* find_scalar(const char *s, size_t n, const char *pat, size_t k) {
+    return memmem(s, n, pat, k);
+}
+
+#ifdef __x86_64__
+/* SSE2 (always there on x86-64) */
+
+static size_t count_newlines_sse2(const char *s, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0, i = 0;
+
+    while (i + 16 <= n) {
+        //byte counters overflow after 255 rounds, fold them with psadbw
+        __m128i acc = _mm_setzero_si128();
+        for (int r = 0; r < 255 && i + 16 <= n; r++, i += 16) {
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (s + i)), nl));
+        }
+        __m128i sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += _mm_cvtsi128_si64(sum) + _mm_extract_epi16(sum, 4);
+    }
+    return count + count_newlines_scalar(s + i, n - i);
+}
+
+//bit i of the result -> s[i] is white space
+static unsigned space_mask_sse2(const char *s) {
+    __m128i v = _mm_loadu_si128((const __m128i*) s);
+    __m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    __m128i in_ctl = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8('\r' - '\t')), ctl);
+    __m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return (unsigned) _mm_movemask_epi8(_mm_or_si128(in_ctl, sp));
+}
+
+static size_t count_words_sse2(const char *s, size_t n, int prev_space) {
+    size_t count = 0, i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        unsigned space = space_mask_sse2(s + i);
+        unsigned starts = ~space & ((space << 1) | prev_space) & 0xffff;
+        count += __builtin_popcount(starts);
+        prev_space = space >> 15;
+    }
+    return count + count_words_scalar(s + i, n - i, prev_space);
+}
+
+//compare the first and the last byte of pat at 16 positions at once, memcmp the candidates
+static const char* find_sse2(const char *s, size_t n, const char *pat, size_t k) {
+    if (k < 2 || n < k) {
+        return k == 1 ? memchr(s, pat[0], n) : memmem(s, n, pat, k);
+    }
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last = _mm_set1_epi8(pat[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*) (s + i)));
+        __m128i b = _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i*) (s + i + k - 1)));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(s + i + bit + 1, pat + 1, k - 2) == 0) {
+                return s + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return memmem(s + i, n - i, pat, k);
+}
+
+/* AVX2, used when the cpu has it */
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char *s, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0, i = 0;
+
+    while (i + 32 <= n) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int r = 0; r < 255 && i + 32 <= n; r++, i += 32) {
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (s + i)), nl));
+        }
+        __m256i sum = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        count += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) +
+                 _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+    }
+    return count + count_newlines_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_words_avx2(const char *s, size_t n, int prev_space) {
+    size_t count = 0, i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (s + i));
+        __m256i ctl = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+        __m256i in_ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8('\r' - '\t')), ctl);
+        __m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+        unsigned space = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(in_ctl, sp));
+        unsigned starts = ~space & ((space << 1) | prev_space);
+        count += __builtin_popcount(starts);
+        prev_space = space >> 31;
+    }
+    return count + count_words_sse2(s + i, n - i, prev_space);
+}
+
+__attribute__((target("avx2")))
+static const char* find_avx2(const char *s, size_t n, const char *pat, size_t k) {
+    if (k < 2 || n < k) {
+        return k == 1 ? memchr(s, pat[0], n) : memmem(s, n, pat, k);
+    }
+    const __m256i first = _mm256_set1_epi8(pat[0]);
+    const __m256i last = _mm256_set1_epi8(pat[k - 1]);
+    size_t i = 0;
+
+    for (; i + k - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*) (s + i)));
+        __m256i b = _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i*) (s + i + k - 1)));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(s + i + bit + 1, pat + 1, k - 2) == 0) {
+                return s + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(s + i, n - i, pat, k);
+}
+#endif
+
+static size_t (*count_newlines)(const char *s, size_t n) = count_newlines_scalar;
+static size_t (*count_words)(const char *s, size_t n, int prev_space) = count_words_scalar;
+static const char* (*find)(const char *s, size_t n, const char *pat, size_t k) = find_scalar;
+
+//pick the kernels for this cpu, once
+static void filter_dispatch() {
+    static int done = 0;
+    if (done) {
+        return;
+    }
+    done = 1;
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        count_newlines = count_newlines_avx2;
+        count_words = count_words_avx2;
+        find = find_avx2;
+    }
+    else {
+        count_newlines = count_newlines_sse2;
+        count_words = count_words_sse2;
+        find = find_sse2;
+    }
+#endif
+}
+
+/* splitting the input over threads */
+
+typedef struct filter_task_ {
+    const char *begin;
+    const char *end;
+    const char *map_begin;//start of the whole input
+    //wc
+    int what;
+    size_t lines;
+    size_t words;
+    //grep
+    const char *pat;
+    size_t pat_len;
+    int invert;
+    int count_only;
+    size_t matched;
+    struct iovec *iov;
+    int iov_len;
+    int iov_cap;
+} filter_task;
+
+static int filter_threads(size_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n = size / FILTER_MIN_CHUNK;
+    if (n > (size_t) cpus) n = cpus;
+    if (n > FILTER_MAX_THREADS) n = FILTER_MAX_THREADS;
+    return n < 1 ? 1 : n;
+}
+
+//split [begin, end) into n pieces ending at a newline
+static void filter_split(filter_task *tasks, int n, const char *begin, const char *end) {
+    const char *p = begin;
+    size_t step = (end - begin) / n;
+
+    for (int i = 0; i < n; i++) {
+        tasks[i].begin = p;
+        if (i == n - 1) {
+            p = end;
+        }
+        else {
+            const char *cut = p + step < end ? p + step : end;
+            const char *nl = memchr(cut, '\n', end - cut);
+            p = nl != NULL ? nl + 1 : end;
+        }
+        tasks[i].end = p;
+    }
+}
+
+static void filter_run_tasks(filter_task *tasks, int n, void *(*fn)(void*)) {
+    pthread_t tid[FILTER_MAX_THREADS];
+    int started[FILTER_MAX_THREADS] = {0};
+
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&tid[i], NULL, fn, &tasks[i]) == 0;
+        if (!started[i]) {
+            fn(&tasks[i]);
+        }
+    }
+    fn(&tasks[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(tid[i], NULL);
+        }
+    }
+}
+
+//write everything, 0 on success
+static int filter_write(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n < IOV_MAX ? n : IOV_MAX);
+        if (w < 0) {
+            if (errno == EINTR && !filter_interrupted) {
+                continue;
+            }
+            return -1;
+        }
+        while (n > 0 && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+/* wc */
+
+static void* wc_task(void *arg) {
+    filter_task *t = arg;
+    size_t n = t->end - t->begin;
+
+    madvise((void*) ((uintptr_t) t->begin & ~(uintptr_t) 4095), n, MADV_SEQUENTIAL|MADV_WILLNEED);
+    //blocks, so that ^C is noticed
+    for (const char *p = t->begin; p < t->end && !filter_interrupted; p += FILTER_MIN_CHUNK) {
+        size_t len = t->end - p < FILTER_MIN_CHUNK ? t->end - p : FILTER_MIN_CHUNK;
+        if (t->what & WC_LINES) {
+            t->lines += count_newlines(p, len);
+        }
+        if (t->what & WC_WORDS) {
+            int prev_space = p == t->map_begin || is_space(p[-1]);
+            t->words += count_words(p, len, prev_space);
+        }
+    }
+    return NULL;
+}
+
+//same layout as wc: several counts are as wide as the byte count of a file, 7 for a pipe
+static int wc_report(filter_opts *o, size_t lines, size_t words, size_t bytes, int width, int output_fd) {
+    char out[128];
+    int len = 0;
+
+    if (o->what == WC_LINES || o->what == WC_WORDS || o->what == WC_BYTES) {
+        width = 1;
+    }
+    if (o->what & WC_LINES) len += snprintf(out + len, sizeof(out) - len, "%*zu ", width, lines);
+    if (o->what & WC_WORDS) len += snprintf(out + len, sizeof(out) - len, "%*zu ", width, words);
+    if (o->what & WC_BYTES) len += snprintf(out + len, sizeof(out) - len, "%*zu ", width, bytes);
+    out[len - 1] = '\n';
+
+    struct iovec iov = {out, len};
+    return filter_write(output_fd, &iov, 1);
+}
+
+static int filter_wc_map(filter_opts *o, const char *data, size_t size, int output_fd) {
+    filter_task tasks[FILTER_MAX_THREADS];
+    int n = (o->what & (WC_LINES|WC_WORDS)) ? filter_threads(size) : 1;
+    memset(tasks, 0, sizeof(tasks));
+    filter_split(tasks, n, data, data + size);
+    for (int i = 0; i < n; i++) {
+        tasks[i].map_begin = data;
+        tasks[i].what = o->what & (WC_LINES|WC_WORDS);
+    }
+    filter_run_tasks(tasks, n, wc_task);
+    if (filter_interrupted) {
+        return 0;
+    }
+
+    size_t lines = 0, words = 0;
+    for (int i = 0; i < n; i++) {
+        lines += tasks[i].lines;
+        words += tasks[i].words;
+    }
+    int width = 1;
+    for (size_t v = size; v >= 10; v /= 10) {
+        width++;
+    }
+    return wc_report(o, lines, words, size, width, output_fd);
+}
+
+static int filter_wc_stream(filter_opts *o, char *buf, int input_fd, int output_fd) {
+    size_t lines = 0, words = 0, bytes = 0;
+    int prev_space = 1;
+    ssize_t n;
+
+    while (!filter_interrupted && (n = read(input_fd, buf, FILTER_STREAM_BUFSIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        lines += count_newlines(buf, n);
+        if (o->what & WC_WORDS) {
+            words += count_words(buf, n, prev_space);
+            prev_space = is_space(buf[n - 1]);
+        }
+        bytes += n;
+    }
+    return filter_interrupted ? 0 : wc_report(o, lines, words, bytes, 7, output_fd);
+}
+
+/* grep */
+
+//[a, b) whole lines -> output (adjacent spans merged) or count
+static void grep_emit(filter_task *t, const char *a, const char *b) {
+    if (a >= b) {
+        return;
+    }
+    if (t->count_only) {
+        t->matched += t->invert ? count_newlines(a, b - a) + (b[-1] != '\n') : 1;
+        return;
+    }
+    t->matched++;
+    if (t->iov_len > 0) {
+        struct iovec *last = &t->iov[t->iov_len - 1];
+        if ((char*) last->iov_base + last->iov_len == a) {
+            last->iov_len += b - a;
+            return;
+        }
+    }
+    if (t->iov_len == t->iov_cap) {
+        t->iov_cap = t->iov_cap ? t->iov_cap * 2 : 256;
+        t->iov = realloc(t->iov, t->iov_cap * sizeof(struct iovec));
+    }
+    t->iov[t->iov_len++] = (struct iovec) {(void*) a, b - a};
+}
+
+static void* grep_task(void *arg) {
+    filter_task *t = arg;
+    const char *p = t->begin;
+    const char *end = t->end;
+
+    if (t->map_begin != NULL) {
+        madvise((void*) ((uintptr_t) p & ~(uintptr_t) 4095), end - p, MADV_SEQUENTIAL|MADV_WILLNEED);
+    }
+    while (p < end && !filter_interrupted) {
+        const char *m = find(p, end - p, t->pat, t->pat_len);
+        const char *line = end;
+        if (m != NULL) {
+            const char *nl = memrchr(p, '\n', m - p);
+            line = nl != NULL ? nl + 1 : p;
+        }
+        //[p, line) has no match
+        if (t->invert) {
+            grep_emit(t, p, line);
+        }
+        if (m == NULL) {
+            break;
+        }
+        const char *nl = memchr(m, '\n', end - m);
+        const char *next = nl != NULL ? nl + 1 : end;
+        if (!t->invert) {
+            grep_emit(t, line, next);
+        }
+        p = next;
+    }
+    return NULL;
+}
+
+//lines of the task -> output_fd, *last_newline tells whether the output ends a line
+static int grep_flush(filter_task *t, int output_fd, int *last_newline) {
+    if (t->iov_len == 0) {
+        return 0;
+    }
+    struct iovec *last = &t->iov[t->iov_len - 1];
+    *last_newline = ((char*) last->iov_base)[last->iov_len - 1] == '\n';
+    int r = filter_write(output_fd, t->iov, t->iov_len);
+    t->iov_len = 0;
+    return r;
+}
+
+//the last line of an input without a final newline still gets one
+static int grep_finish(filter_opts *o, size_t total, int last_newline, int failed, int output_fd) {
+    char out[32];
+    struct iovec iov = {out, 0};
+
+    if (o->count_only) {
+        iov.iov_len = snprintf(out, sizeof(out), "%zu\n", total);
+    }
+    else if (!last_newline) {
+        out[0] = '\n';
+        iov.iov_len = 1;
+    }
+    if (!failed && iov.iov_len > 0) {
+        failed = filter_write(output_fd, &iov, 1) < 0;
+    }
+    return failed ? -1 : (total > 0 ? 0 : 1);
+}
+
+static void grep_task_init(filter_task *t, filter_opts *o) {
+    t->pat = o->pat;
+    t->pat_len = o->pat_len;
+    t->invert = o->invert;
+    t->count_only = o->count_only;
+    t->iov_len = 0;
+}
+
+static int filter_grep_map(filter_opts *o, const char *data, size_t size, int output_fd) {
+    size_t total = 0;
+    int failed = 0;
+    int last_newline = 1;
+    const char *p = data, *end = data + size;
+    filter_task tasks[FILTER_MAX_THREADS];
+    memset(tasks, 0, sizeof(tasks));
+
+    //rounds of nthreads chunks, each round's lines are written in order before the next
+    while (p < end && !filter_interrupted && !failed) {
+        int n = filter_threads(end - p);
+        size_t round = (size_t) n * FILTER_ROUND_CHUNK;
+        const char *stop = (size_t) (end - p) > round ? p + round : end;
+        if (stop < end) {
+            const char *nl = memchr(stop, '\n', end - stop);
+            stop = nl != NULL ? nl + 1 : end;
+        }
+
+        filter_split(tasks, n, p, stop);
+        for (int i = 0; i < n; i++) {
+            grep_task_init(&tasks[i], o);
+            tasks[i].map_begin = data;
+        }
+        filter_run_tasks(tasks, n, grep_task);
+
+        for (int i = 0; i < n; i++) {
+            total += tasks[i].matched;
+            tasks[i].matched = 0;
+            failed |= grep_flush(&tasks[i], output_fd, &last_newline) < 0;
+        }
+        p = stop;
+    }
+    for (int i = 0; i < FILTER_MAX_THREADS; i++) {
+        free(tasks[i].iov);
+    }
+    return grep_finish(o, total, last_newline, failed, output_fd);
+}
+
+//whole lines of every read are searched, the unfinished one waits for the next read
+static int filter_grep_stream(filter_opts *o, int input_fd, int output_fd) {
+    size_t cap = FILTER_STREAM_BUFSIZE, len = 0, total = 0;
+    int failed = 0, last_newline = 1, eof = 0;
+    char *buf = malloc(cap);
+    filter_task t;
+    memset(&t, 0, sizeof(t));
+    grep_task_init(&t, o);
+
+    while (!eof && !failed && !filter_interrupted) {
+        if (len == cap) {
+            cap *= 2;//a line longer than the buffer
+            buf = realloc(buf, cap);
+        }
+        ssize_t n = read(input_fd, buf + len, cap - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            failed = 1;
+            break;
+        }
+        eof = n == 0;
+        len += n;
+
+        char *nl = eof ? buf + len - 1 : memrchr(buf, '\n', len);
+        if (nl == NULL || len == 0) {
+            continue;
+        }
+        t.begin = buf;
+        t.end = nl + 1;
+        grep_task(&t);
+        total += t.matched;
+        t.matched = 0;
+        failed |= grep_flush(&t, output_fd, &last_newline) < 0;
+        len -= nl + 1 - buf;
+        memmove(buf, nl + 1, len);
+    }
+    free(t.iov);
+    free(buf);
+    return grep_finish(o, total, last_newline, failed, output_fd);
+}
+
+/* head */
+
+//where the first lines lines of [data, data + size) end, *left -> lines still missing
+static size_t head_cut(const char *data, size_t size, long *left) {
+    size_t pos = 0;
+
+    //count newlines a block at a time, then find the exact one inside the block
+    while (*left > 0 && pos < size) {
+        size_t block = size - pos < (1 << 16) ? size - pos : (1 << 16);
+        size_t c = count_newlines(data + pos, block);
+        if ((long) c < *left) {
+            *left -= c;
+            pos += block;
+            continue;
+        }
+        const char *q = data + pos;
+        while ((*left)-- > 0) {
+            q = (const char*) memchr(q, '\n', data + pos + block - q) + 1;
+        }
+        *left = 0;
+        pos = q - data;
+    }
+    return pos;
+}
+
+static int filter_head_map(filter_opts *o, const char *data, size_t size, int output_fd) {
+    long left = o->lines;
+    size_t len = o->bytes >= 0 ? ((size_t) o->bytes < size ? (size_t) o->bytes : size) : head_cut(data, size, &left);
+    struct iovec iov = {(void*) data, len};
+    return filter_write(output_fd, &iov, 1);
+}
+
+//stops reading as soon as enough is written
+static int filter_head_stream(filter_opts *o, char *buf, int input_fd, int output_fd) {
+    long left = o->bytes >= 0 ? o->bytes : o->lines;
+    ssize_t n;
+
+    while (left > 0 && !filter_interrupted && (n = read(input_fd, buf, FILTER_STREAM_BUFSIZE)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        size_t len = n;
+        if (o->bytes >= 0) {
+            len = (long) len < left ? len : (size_t) left;
+            left -= len;
+        }
+        else {
+            len = head_cut(buf, n, &left);
+        }
+        struct iovec iov = {buf, len};
+        if (filter_write(output_fd, &iov, 1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* options */
+
+//argv -> opts, -1 when the real command has to do it
+static int filter_parse(int argc, char **argv, filter_opts *o) {
+    memset(o, 0, sizeof(*o));
+    o->kind = argv[0][0];
+    o->lines = 10;
+    o->bytes = -1;
+
+    if (strcmp(argv[0], "wc") == 0) {
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] != '-' || argv[i][1] == '\0') {
+                return -1;
+            }
+            for (char *c = argv[i] + 1; *c != '\0'; c++) {
+                if (*c == 'l') o->what |= WC_LINES;
+                else if (*c == 'w') o->what |= WC_WORDS;
+                else if (*c == 'c') o->what |= WC_BYTES;
+                else return -1;
+            }
+        }
+        if (o->what == 0) {
+            o->what = WC_LINES|WC_WORDS|WC_BYTES;
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[0], "grep") == 0) {
+        int fixed = 0;
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-' && argv[i][1] != '\0' && o->pat == NULL) {
+                for (char *c = argv[i] + 1; *c != '\0'; c++) {
+                    if (*c == 'F') fixed = 1;
+                    else if (*c == 'v') o->invert = 1;
+                    else if (*c == 'c') o->count_only = 1;
+                    else return -1;
+                }
+            }
+            else if (o->pat == NULL) {
+                o->pat = argv[i];
+            }
+            else {
+                return -1;//grep PATTERN FILE
+            }
+        }
+        //a pattern without regex characters matches the same as -F
+        if (o->pat == NULL || o->pat[0] == '\0' || (!fixed && strpbrk(o->pat, ".[]*^$\\+?(){}|") != NULL)) {
+            return -1;
+        }
+        o->pat_len = strlen(o->pat);
+        return 0;
+    }
+
+    if (strcmp(argv[0], "head") == 0) {
+        for (int i = 1; i < argc; i++) {
+            char *end;
+            if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-c") == 0) && i + 1 < argc) {
+                long v = strtol(argv[i + 1], &end, 10);
+                if (*end != '\0' || v < 0) {
+                    return -1;
+                }
+                if (argv[i][1] == 'n') o->lines = v;
+                else o->bytes = v;
+                i++;
+            }
+            else if (argv[i][0] == '-' && argv[i][1] >= '0' && argv[i][1] <= '9') {
+                o->lines = strtol(argv[i] + 1, &end, 10);
+                if (*end != '\0') {
+                    return -1;
+                }
+            }
+            else {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    return -1;
+}
+
+int filter_supported(int argc, char **argv) {
+    filter_opts o;
+    return filter_parse(argc, argv, &o) == 0;
+}
+
+//the status a failed write ends the filter with
+static int filter_write_status(filter_opts *o) {
+    return errno == EPIPE ? 128 + SIGPIPE : (o->kind == 'g' ? 2 : 1);
+}
+
+static int filter_map(filter_opts *o, const char *data, size_t size, int output_fd) {
+    int r;
+    if (o->kind == 'w') r = filter_wc_map(o, data, size, output_fd);
+    else if (o->kind == 'g') r = filter_grep_map(o, data, size, output_fd);
+    else r = filter_head_map(o, data, size, output_fd);
+    return r < 0 ? filter_write_status(o) : r;
+}
+
+//input_fd regular -> mapped, else streamed. exit status of the filter
+static int filter_run(filter_opts *o, int input_fd, int output_fd) {
+    struct stat st;
+    filter_dispatch();
+
+    if (fstat(input_fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t size = st.st_size;
+        const char *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, input_fd, 0) : "";
+        if (data != MAP_FAILED) {
+            int status = filter_map(o, data, size, output_fd);
+            if (size > 0) {
+                munmap((void*) data, size);
+            }
+            return status;
+        }
+    }
+
+    if (o->kind == 'g') {
+        int r = filter_grep_stream(o, input_fd, output_fd);
+        return r < 0 ? filter_write_status(o) : r;
+    }
+    char *buf = malloc(FILTER_STREAM_BUFSIZE);
+    int r = o->kind == 'w' ? filter_wc_stream(o, buf, input_fd, output_fd) : filter_head_stream(o, buf, input_fd, output_fd);
+    free(buf);
+    return r < 0 ? filter_write_status(o) : r;
+}
+
+//a pipeline stage on a shell thread (stage.c)
+int filter_stage(int argc, char **argv, int input_fd, int output_fd) {
+    filter_opts o;
+    if (filter_parse(argc, argv, &o) < 0) {
+        return 2;
+    }
+    int status = filter_run(&o, input_fd, output_fd);
+    return filter_interrupted ? 128 + SIGINT : status;
+}
+
+//^C while stage threads run, 0 -> clear
+void filter_set_interrupted(int v) {
+    filter_interrupted = v;
+}
+
+static void handler_of_filter_sigint(int signal) {
+    filter_interrupted = 1;
+}
+
+//wc/grep/head < FILE -> 1 when it ran here (status in proc->exit_status), 0 -> run the real command
+int my_shell_filter(job *job_tmp, process *proc, int input_fd, int output_fd) {
+    struct stat st;
+    filter_opts o;
+
+    //the shell would block on a background job, and deadlines need a process group.
+    //pipelines run the filter on a stage thread instead
+    if (job_tmp->mode == BACKGROUND || job_tmp->timeout > 0 || job_tmp->process_list->next != NULL ||
+        proc->input_redirection == NULL || input_fd == 0 ||
+        fstat(input_fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        filter_parse(proc->process_argc, proc->argument_list, &o) < 0) {
+        return 0;
+    }
+
+    struct sigaction sa, old_int, old_pipe;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler_of_filter_sigint;
+    sigaction(SIGINT, &sa, &old_int);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &old_pipe);
+    filter_interrupted = 0;
+    fflush(stdout);
+
+    int status = filter_run(&o, input_fd, output_fd);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+
+    proc->exit_status = filter_interrupted ? 128 + SIGINT : status;
+    proc->process_status = STATUS_PROC_DONE;
+    return 1;
+}
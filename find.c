@@ -0,0 +1,520 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "shell.h"
+
+/* find [PATH...] [-name GLOB] [-iname GLOB] [-type f|d|l|p|s|b|c] [-size [+-]N[ckMG]]
+        [-mtime [+-]N] [-mmin [+-]N] [-mindepth N] [-maxdepth N] [-print | -print0]
+
+   directories are read with getdents64 by a pool of threads. each thread
+   keeps its own deque of directories still to read, steals from the
+   others when it runs dry and sleeps until a directory is queued when
+   there is nothing to steal. d_type decides the type, so entries are
+   only stat'ed for -size/-mtime/-mmin or on file systems without d_type.
+   results come out in no particular order. other expressions run the real find. */
+
+#define WALK_MAX_THREADS 64
+#define WALK_DENTS_BUFSIZE (64 << 10)
+#define WALK_OUT_BUFSIZE (64 << 10)
+
+typedef struct walk_cmp_ {
+    int set;
+    int sign;//-1 less than, 0 exactly, +1 greater than
+    long long value;
+} walk_cmp;
+
+typedef struct walk_expr_ {
+    char **names;//-name / -iname globs, all must match
+    int *name_flags;
+    int name_cnt;
+    char type;//0 -> any
+    walk_cmp size;
+    long long size_unit;
+    walk_cmp mtime;//days
+    walk_cmp mmin;//minutes
+    int min_depth;
+    int max_depth;//-1 -> no limit
+    char sep;
+} walk_expr;
+
+typedef struct walk_dir_ {
+    char *path;
+    int depth;
+} walk_dir;
+
+//owner pushes and pops at the tail, thieves take from the head
+typedef struct walk_queue_ {
+    pthread_mutex_t lock;
+    walk_dir *items;
+    int head;
+    int tail;
+    int cap;
+} walk_queue;
+
+typedef struct walk_worker_ {
+    int id;
+    walk_queue queue;
+    char *dents;
+    char out[WALK_OUT_BUFSIZE];
+    size_t out_len;
+} walk_worker;
+
+static walk_expr expr;
+static walk_worker *workers;
+static int worker_cnt;
+static atomic_long pending;//directories queued or being read
+//idle workers sleep until a directory is queued or the walk is over
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int idle_cnt;
+static atomic_ulong work_seq;//directories queued so far
+static atomic_int walk_status;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static int out_fd;
+static time_t walk_start;
+static volatile sig_atomic_t walk_interrupted = 0;
+
+static void queue_push(walk_queue *q, walk_dir d) {
+    pthread_mutex_lock(&q->lock);
+    if (q->head > 0 && q->tail == q->cap) {
+        memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(walk_dir));
+        q->tail -= q->head;
+        q->head = 0;
+    }
+    if (q->tail == q->cap) {
+        q->cap = q->cap ? q->cap * 2 : 64;
+        q->items = realloc(q->items, q->cap * sizeof(walk_dir));
+    }
+    q->items[q->tail++] = d;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int queue_pop(walk_queue *q, walk_dir *d) {
+    int got = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) {
+        *d = q->items[--q->tail];
+        got = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+static int queue_steal(walk_queue *q, walk_dir *d) {
+    int got = 0;
+    if (pthread_mutex_trylock(&q->lock) != 0) {
+        return 0;
+    }
+    if (q->head < q->tail) {
+        *d = q->items[q->head++];
+        got = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return got;
+}
+
+static void walk_flush(walk_worker *w) {
+    pthread_mutex_lock(&out_lock);
+    for (size_t off = 0; off < w->out_len; ) {
+        ssize_t n = write(out_fd, w->out + off, w->out_len - off);
+        if (n < 0) {
+            if (errno == EINTR && !walk_interrupted) {
+                continue;
+            }
+            walk_status = 128 + SIGPIPE;//the reader is gone
+            walk_interrupted = 1;
+            break;
+        }
+        off += n;
+    }
+    pthread_mutex_unlock(&out_lock);
+    w->out_len = 0;
+}
+
+static void walk_emit(walk_worker *w, const char *path, size_t len) {
+    if (w->out_len + len + 1 > sizeof(w->out)) {
+        walk_flush(w);
+    }
+    if (len + 1 > sizeof(w->out)) {
+        return;
+    }
+    memcpy(w->out + w->out_len, path, len);
+    w->out_len += len;
+    w->out[w->out_len++] = expr.sep;
+}
+
+static int cmp_match(walk_cmp *c, long long v) {
+    return !c->set || (c->sign < 0 ? v < c->value : c->sign > 0 ? v > c->value : v == c->value);
+}
+
+static char type_of_mode(mode_t mode) {
+    if (S_ISREG(mode)) return 'f';
+    if (S_ISDIR(mode)) return 'd';
+    if (S_ISLNK(mode)) return 'l';
+    if (S_ISFIFO(mode)) return 'p';
+    if (S_ISSOCK(mode)) return 's';
+    if (S_ISBLK(mode)) return 'b';
+    if (S_ISCHR(mode)) return 'c';
+    return '?';
+}
+
+static char type_of_dirent(unsigned char d_type) {
+    switch (d_type) {
+        case DT_REG: return 'f';
+        case DT_DIR: return 'd';
+        case DT_LNK: return 'l';
+        case DT_FIFO: return 'p';
+        case DT_SOCK: return 's';
+        case DT_BLK: return 'b';
+        case DT_CHR: return 'c';
+        default: return 0;
+    }
+}
+
+static int need_stat() {
+    return expr.size.set || expr.mtime.set || expr.mmin.set;
+}
+
+//the predicates without the stat ones
+static int walk_match_name(const char *name, char type, int depth) {
+    if (depth < expr.min_depth || (expr.type != 0 && expr.type != type)) {
+        return 0;
+    }
+    for (int i = 0; i < expr.name_cnt; i++) {
+        if (fnmatch(expr.names[i], name, expr.name_flags[i]) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int walk_match_stat(struct stat *st) {
+    long long units = (st->st_size + expr.size_unit - 1) / expr.size_unit;
+    long long age = walk_start - st->st_mtime;
+    return cmp_match(&expr.size, units) && cmp_match(&expr.mtime, age / 86400) &&
+           cmp_match(&expr.mmin, (age + 59) / 60);
+}
+
+static void walk_error(const char *path) {
+    char msg[PATH_DIR_BUFSIZE + 64];
+    int len = snprintf(msg, sizeof(msg), "find: '%s': %s\n", path, strerror(errno));
+    write(2, msg, len < (int) sizeof(msg) ? len : (int) sizeof(msg) - 1);
+    walk_status = 1;
+}
+
+//a directory was queued -> one sleeper up, the walk is over -> all of them
+static void walk_wake(int all) {
+    atomic_fetch_add(&work_seq, 1);
+    if (atomic_load(&idle_cnt) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        if (all) {
+            pthread_cond_broadcast(&idle_cond);
+        }
+        else {
+            pthread_cond_signal(&idle_cond);
+        }
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+//nothing to pop or steal since seq -> sleep until something is queued, 0 -> the walk is over
+static int walk_idle(unsigned long seq) {
+    pthread_mutex_lock(&idle_lock);
+    atomic_fetch_add(&idle_cnt, 1);
+    //checked after idle_cnt is up, a push in between has moved work_seq
+    while (atomic_load(&work_seq) == seq && atomic_load(&pending) > 0) {
+        pthread_cond_wait(&idle_cond, &idle_lock);
+    }
+    atomic_fetch_sub(&idle_cnt, 1);
+    pthread_mutex_unlock(&idle_lock);
+    return atomic_load(&pending) > 0;
+}
+
+static void walk_read_dir(walk_worker *w, walk_dir *d) {
+    int fd = open(d->path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd < 0) {
+        walk_error(d->path);
+        return;
+    }
+    size_t dir_len = strlen(d->path);
+    int slash = dir_len > 0 && d->path[dir_len - 1] == '/';
+    char path[PATH_MAX];
+
+    while (!walk_interrupted) {
+        long n = syscall(SYS_getdents64, fd, w->dents, WALK_DENTS_BUFSIZE);
+        if (n <= 0) {
+            if (n < 0) {
+                walk_error(d->path);
+            }
+            break;
+        }
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 {
+                ino64_t d_ino;
+                off64_t d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+            } *ent = (struct linux_dirent64*) (w->dents + off);
+            off += ent->d_reclen;
+
+            const char *name = ent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            int len = snprintf(path, sizeof(path), "%s%s%s", d->path, slash ? "" : "/", name);
+            if (len >= (int) sizeof(path)) {
+                continue;
+            }
+
+            char type = type_of_dirent(ent->d_type);
+            struct stat st;
+            int have_stat = 0;
+            if (type == 0 || need_stat()) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                    walk_error(path);
+                    continue;
+                }
+                type = type_of_mode(st.st_mode);
+                have_stat = 1;
+            }
+
+            int depth = d->depth + 1;
+            if (walk_match_name(name, type, depth) && (!have_stat || walk_match_stat(&st))) {
+                walk_emit(w, path, len);
+            }
+            if (type == 'd' && (expr.max_depth < 0 || depth < expr.max_depth)) {
+                walk_dir sub = {strdup(path), depth};
+                atomic_fetch_add(&pending, 1);
+                queue_push(&w->queue, sub);
+                walk_wake(0);
+            }
+        }
+    }
+    close(fd);
+}
+
+static void* walk_worker_main(void *arg) {
+    walk_worker *w = arg;
+    walk_dir d;
+
+    while (1) {
+        unsigned long seq = atomic_load(&work_seq);
+        int got = queue_pop(&w->queue, &d);
+        for (int i = 1; !got && i < worker_cnt; i++) {
+            got = queue_steal(&workers[(w->id + i) % worker_cnt].queue, &d);
+        }
+        if (!got) {
+            //one worker stuck in getdents on a slow server must not keep the rest spinning
+            if (!walk_idle(seq)) {
+                break;
+            }
+            continue;
+        }
+        if (!walk_interrupted) {
+            walk_read_dir(w, &d);
+        }
+        free(d.path);
+        if (atomic_fetch_sub(&pending, 1) == 1) {
+            walk_wake(1);
+        }
+    }
+    walk_flush(w);
+    return NULL;
+}
+
+//"+N", "-N", "N" [suffix] -> cmp, suffix in *rest
+static int parse_cmp(char *s, walk_cmp *c, char **rest) {
+    c->set = 1;
+    c->sign = s[0] == '+' ? 1 : s[0] == '-' ? -1 : 0;
+    if (c->sign != 0) {
+        s++;
+    }
+    char *end;
+    c->value = strtoll(s, &end, 10);
+    if (end == s) {
+        return -1;
+    }
+    if (rest != NULL) {
+        *rest = end;
+        return 0;
+    }
+    return *end == '\0' ? 0 : -1;
+}
+
+//argv -> expr, index of the first predicate in *first, -1 when find has to do it
+static int walk_parse(int argc, char **argv, int *first) {
+    int i = 1;
+
+    memset(&expr, 0, sizeof(expr));
+    expr.names = malloc(argc * sizeof(char*));
+    expr.name_flags = malloc(argc * sizeof(int));
+    expr.max_depth = -1;
+    expr.sep = '\n';
+    expr.size_unit = 512;
+
+    while (i < argc && argv[i][0] != '-' && strcmp(argv[i], "!") != 0 && strcmp(argv[i], "(") != 0) {
+        i++;
+    }
+    *first = i;
+    for (; i < argc; i++) {
+        char *opt = argv[i];
+        char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(opt, "-print") == 0) {
+            expr.sep = '\n';
+            continue;
+        }
+        if (strcmp(opt, "-print0") == 0) {
+            expr.sep = '\0';
+            continue;
+        }
+        if (val == NULL) {
+            return -1;
+        }
+        i++;
+        if (strcmp(opt, "-name") == 0 || strcmp(opt, "-iname") == 0) {
+            expr.names[expr.name_cnt] = val;
+            expr.name_flags[expr.name_cnt++] = opt[1] == 'i' ? FNM_CASEFOLD : 0;
+        }
+        else if (strcmp(opt, "-type") == 0) {
+            if (strlen(val) != 1 || strchr("fdlpsbc", val[0]) == NULL) {
+                return -1;
+            }
+            expr.type = val[0];
+        }
+        else if (strcmp(opt, "-size") == 0) {
+            char *suffix;
+            if (parse_cmp(val, &expr.size, &suffix) < 0) {
+                return -1;
+            }
+            if (strcmp(suffix, "c") == 0) expr.size_unit = 1;
+            else if (strcmp(suffix, "k") == 0) expr.size_unit = 1024;
+            else if (strcmp(suffix, "M") == 0) expr.size_unit = 1024 * 1024;
+            else if (strcmp(suffix, "G") == 0) expr.size_unit = 1024 * 1024 * 1024;
+            else if (*suffix != '\0') return -1;
+        }
+        else if (strcmp(opt, "-mtime") == 0) {
+            if (parse_cmp(val, &expr.mtime, NULL) < 0) {
+                return -1;
+            }
+        }
+        else if (strcmp(opt, "-mmin") == 0) {
+            if (parse_cmp(val, &expr.mmin, NULL) < 0) {
+                return -1;
+            }
+        }
+        else if (strcmp(opt, "-mindepth") == 0 || strcmp(opt, "-maxdepth") == 0) {
+            char *end;
+            int v = strtol(val, &end, 10);
+            if (*end != '\0' || v < 0) {
+                return -1;
+            }
+            if (opt[2] == 'i') expr.min_depth = v;
+            else expr.max_depth = v;
+        }
+        else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void handler_of_walk_sigint(int signal) {
+    walk_interrupted = 1;
+}
+
+//find ... -> exit status, -1 when the expression needs the real find
+int my_shell_find(int argc, char **argv, int output_fd) {
+    int first;
+    if (walk_parse(argc, argv, &first) < 0) {
+        free(expr.names);
+        free(expr.name_flags);
+        return -1;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    //reads block on the disk or the server, so more threads than cpus
+    worker_cnt = cpus * 4 < 8 ? 8 : (cpus * 4 > WALK_MAX_THREADS ? WALK_MAX_THREADS : cpus * 4);
+    workers = calloc(worker_cnt, sizeof(walk_worker));
+    for (int i = 0; i < worker_cnt; i++) {
+        workers[i].id = i;
+        pthread_mutex_init(&workers[i].queue.lock, NULL);
+        workers[i].dents = malloc(WALK_DENTS_BUFSIZE);
+    }
+    out_fd = output_fd;
+    walk_start = time(NULL);
+    walk_status = 0;
+    walk_interrupted = 0;
+    atomic_store(&pending, 0);
+    atomic_store(&idle_cnt, 0);
+
+    struct sigaction sa, old_int, old_pipe;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler_of_walk_sigint;
+    sigaction(SIGINT, &sa, &old_int);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, &old_pipe);
+
+    //the start points themselves, then their directories go to the pool
+    char *dot[] = {"."};
+    char **roots = first > 1 ? argv + 1 : dot;
+    int root_cnt = first > 1 ? first - 1 : 1;
+    for (int i = 0; i < root_cnt; i++) {
+        struct stat st;
+        if (lstat(roots[i], &st) < 0) {
+            walk_error(roots[i]);
+            continue;
+        }
+        const char *base = strrchr(roots[i], '/');
+        base = base != NULL && base[1] != '\0' ? base + 1 : roots[i];
+        if (walk_match_name(base, type_of_mode(st.st_mode), 0) && walk_match_stat(&st)) {
+            walk_emit(&workers[0], roots[i], strlen(roots[i]));
+        }
+        if (S_ISDIR(st.st_mode) && expr.max_depth != 0) {
+            walk_dir d = {strdup(roots[i]), 0};
+            atomic_fetch_add(&pending, 1);
+            queue_push(&workers[i % worker_cnt].queue, d);
+        }
+    }
+
+    //a thread which did not start leaves its queue to be stolen
+    pthread_t *tid = malloc(worker_cnt * sizeof(pthread_t));
+    int *started = calloc(worker_cnt, sizeof(int));
+    for (int i = 1; i < worker_cnt; i++) {
+        started[i] = pthread_create(&tid[i], NULL, walk_worker_main, &workers[i]) == 0;
+    }
+    walk_worker_main(&workers[0]);
+    for (int i = 1; i < worker_cnt; i++) {
+        if (started[i]) {
+            pthread_join(tid[i], NULL);
+        }
+    }
+    free(started);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    for (int i = 0; i < worker_cnt; i++) {
+        pthread_mutex_destroy(&workers[i].queue.lock);
+        free(workers[i].queue.items);
+        free(workers[i].dents);
+    }
+    free(workers);
+    free(tid);
+    free(expr.names);
+    free(expr.name_flags);
+    return walk_interrupted && walk_status == 0 ? 128 + SIGINT : walk_status;
+}
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "shell.h"
+
+/* here-documents and here-strings.
+   cmd <<EOF    cmd <<-EOF (leading tabs dropped)    cmd <<<word
+
+   the parser keeps the word after << as the end of the body, whoever
+   read the command line (terminal, script, replay) hands the lines after
+   it to heredoc_collect. at launch the body becomes stdin of its stage
+   with no file on disk and no process feeding it: a body which fits
+   into a pipe is written into one before anything starts, a larger one
+   goes into a memfd, which commands can also seek and mmap. the body is
+   taken as written, there is no expansion in it. */
+
+#define HEREDOC_PIPE_MAX 65536//default pipe capacity, larger bodies skip the pipe
+
+static int heredoc_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//body -> descriptor reading it from the start (close-on-exec), -1 on failure
+int heredoc_fd(const char *body) {
+    size_t len = strlen(body);
+    int fd[2];
+
+    //fits the pipe -> the write cannot block, nobody reads yet
+    if (len <= HEREDOC_PIPE_MAX && pipe2(fd, O_CLOEXEC) == 0) {
+        int cap = fcntl(fd[1], F_GETPIPE_SZ);
+        if (cap >= 0 && len <= (size_t) cap && heredoc_write_all(fd[1], body, len) == 0) {
+            close(fd[1]);
+            return fd[0];
+        }
+        close(fd[0]);
+        close(fd[1]);
+    }
+    int mfd = memfd_create("heredoc", MFD_CLOEXEC);
+    if (mfd < 0) {
+        return -1;
+    }
+    if (heredoc_write_all(mfd, body, len) < 0 || lseek(mfd, 0, SEEK_SET) < 0) {
+        close(mfd);
+        return -1;
+    }
+    return mfd;
+}
+
+//line of text (no '\n') -> appended to the body of proc unless it ends it, 1 -> it ended it
+static int heredoc_add_line(process *proc, const char *line, size_t len, size_t *body_len, size_t *cap) {
+    if (proc->heredoc_tabs) {
+        while (len > 0 && *line == '\t') {
+            line++;
+            len--;
+        }
+    }
+    if (len == strlen(proc->heredoc_end) && strncmp(line, proc->heredoc_end, len) == 0) {
+        return 1;
+    }
+    //doubled, a generated config can have a lot of lines
+    if (*body_len + len + 2 > *cap) {
+        *cap = (*body_len + len + 2) * 2;
+        proc->heredoc = (char*) mem_realloc(MEM_JOBS, proc->heredoc, *cap);
+    }
+    memcpy(proc->heredoc + *body_len, line, len);
+    *body_len += len;
+    proc->heredoc[(*body_len)++] = '\n';
+    proc->heredoc[*body_len] = '\0';
+    return 0;
+}
+
+//bodies of the <<EOF of job (in the order written) from next_line, -1 -> one ended at eof
+int heredoc_collect(job *job_tmp, heredoc_reader next_line, void *ctx) {
+    int status = 0;
+
+    for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        if (proc->heredoc_end == NULL) {
+            continue;
+        }
+        size_t body_len = strlen(proc->heredoc), cap = body_len + 1, len;
+        const char *line;
+        while (1) {
+            if ((line = next_line(ctx, &len)) == NULL) {
+                printf("here-document ended by end of file (wanted '%s')\n", proc->heredoc_end);
+                status = -1;
+                break;
+            }
+            if (heredoc_add_line(proc, line, len, &body_len, &cap)) {
+                break;
+            }
+        }
+        mem_free(MEM_JOBS, proc->heredoc_end);
+        proc->heredoc_end = NULL;
+    }
+    return status;
+}
+
+//heredoc_reader over text in memory, ctx is a heredoc_text
+const char* heredoc_text_line(void *ctx, size_t *len) {
+    heredoc_text *text = ctx;
+    if (text->p >= text->end) {
+        return NULL;
+    }
+    const char *line = text->p;
+    const char *nl = memchr(line, '\n', text->end - line);
+    *len = (nl != NULL ? nl : text->end) - line;
+    text->p = line + *len + 1;
+    return line;
+}
+
+//heredoc_reader over stdin with "> " on a terminal, ctx is a heredoc_input
+const char* heredoc_input_line(void *ctx, size_t *len) {
+    heredoc_input *input = ctx;
+
+    mem_free(MEM_LINE, input->line);
+    if (isatty(0)) {
+        printf("> ");
+        fflush(stdout);
+    }
+    input->line = my_get_line();
+    if (input->line == NULL) {
+        return NULL;
+    }
+    *len = strlen(input->line);
+    //--record -> the body is part of the command line
+    if (input->record != NULL) {
+        size_t have = strlen(input->record);
+        input->record = (char*) mem_realloc(MEM_LINE, input->record, have + *len + 2);
+        input->record[have] = '\n';
+        memcpy(input->record + have + 1, input->line, *len + 1);
+    }
+    return input->line;
+}
@@ -0,0 +1,50 @@
+#ifndef __ISH_PLUGIN_H__
+#define __ISH_PLUGIN_H__
+#include <stdint.h>
+
+/* ABI of loadable builtins.
+   enable -f lib.so name...
+
+   a library offers the builtin NAME by exporting
+       int ish_builtin_NAME(const ish_call *call);
+   (a - in NAME is _ in the symbol) and states once which ABI it was
+   built against with ISH_PLUGIN("what it is"). the shell refuses a
+   library of another major version. a minor version only adds fields at
+   the end of ish_call, a builtin looks at call->size before using a
+   field newer than the header it was built with.
+
+   the builtin reads call->in_fd and writes call->out_fd and
+   call->err_fd, not 0-2 or stdio, and returns its exit status. it runs
+   in the shell itself when it is a command of its own, on a thread of
+   the shell as a stage of a foreground pipeline and in a forked child
+   otherwise: it must not exit(), must return promptly and must not keep
+   state two stages of one pipeline would share. setenv works only when
+   the builtin runs in the shell, elsewhere it fails with -1. */
+
+#define ISH_PLUGIN_ABI_MAJOR 1
+#define ISH_PLUGIN_ABI_MINOR 0
+
+typedef struct ish_call_ {
+    uint32_t size;//sizeof(ish_call) in the shell
+    uint32_t abi_minor;//of the shell
+    int argc;
+    char **argv;//argv[0] is the name it was called by, argv[argc] is NULL
+    int in_fd;
+    int out_fd;
+    int err_fd;
+    const char* (*getenv)(const char *name);//NULL -> not set
+    int (*setenv)(const char *name, const char *value);//value NULL -> unset, 0 on success
+} ish_call;
+
+typedef struct ish_plugin_info_ {
+    uint32_t abi_major;
+    uint32_t abi_minor;
+    const char *description;
+} ish_plugin_info;
+
+typedef int (*ish_builtin_fn)(const ish_call *call);
+
+#define ISH_PLUGIN(text) \
+    const ish_plugin_info ish_plugin = {ISH_PLUGIN_ABI_MAJOR, ISH_PLUGIN_ABI_MINOR, text}
+
+#endif
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* make jobserver.
+   jobserver
+   jobserver N
+
+   under make -jN (MAKEFLAGS --jobserver-auth=R,W or =fifo:PATH) every
+   background job takes a token before it starts and gives it back when
+   it is reaped, the first one runs on the token the shell was started
+   with. run -jN takes one for each task. jobserver N makes the shell the
+   server of N slots: a pipe holding N-1 tokens is named in MAKEFLAGS and
+   its two descriptors are the only ones every child inherits, so makes
+   and shells started from here share the limit. jobserver alone prints
+   the state. the pipe is opened a second time through /proc, waiting on
+   it without blocking must not switch make's descriptor to O_NONBLOCK. */
+
+#define JS_UNKNOWN -1//MAKEFLAGS not looked at yet
+#define JS_NONE 0
+#define JS_CLIENT 1
+#define JS_SERVER 2
+
+static int js_mode = JS_UNKNOWN;
+static int js_read = -1;//O_NONBLOCK, ours
+static int js_write = -1;
+static int js_implicit_free = 1;
+static int js_held = 0;//tokens taken from the pipe
+static int js_slots = 0;//server
+static char js_auth[64];//R,W or fifo:PATH as found in MAKEFLAGS
+static volatile sig_atomic_t js_interrupted = 0;
+
+static int is_fifo(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+//descriptors of make's pipe -> ours, 0 on success
+static int jobserver_attach(int r, int w) {
+    char path[64];
+
+    if (!is_fifo(r) || !is_fifo(w)) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+    js_read = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+    js_write = fcntl(w, F_DUPFD_CLOEXEC, 10);
+    if (js_read < 0 || js_write < 0) {
+        close(js_read);
+        close(js_write);
+        js_read = js_write = -1;
+        return -1;
+    }
+    return 0;
+}
+
+//the shell exits with jobs still running -> make gets their tokens anyway
+static void jobserver_exit() {
+    for (; js_held > 0; js_held--) {
+        while (write(js_write, "+", 1) < 0 && errno == EINTR);
+    }
+}
+
+//MAKEFLAGS -> client of make's jobserver
+static void jobserver_init() {
+    if (js_mode != JS_UNKNOWN) {
+        return;
+    }
+    js_mode = JS_NONE;
+    char *flags = getenv("MAKEFLAGS");
+    char *auth = NULL;
+    if (flags == NULL) {
+        return;
+    }
+    //the last one counts, make appends
+    for (char *p = flags; (p = strstr(p, "--jobserver-")) != NULL; p++) {
+        if (strncmp(p, "--jobserver-auth=", 17) == 0) {
+            auth = p + 17;
+        }
+        else if (strncmp(p, "--jobserver-fds=", 16) == 0) {
+            auth = p + 16;
+        }
+    }
+    if (auth == NULL) {
+        return;
+    }
+    snprintf(js_auth, sizeof(js_auth), "%.*s", (int) strcspn(auth, " "), auth);
+
+    int r, w;
+    if (strncmp(js_auth, "fifo:", 5) == 0) {
+        js_read = js_write = open(js_auth + 5, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+        if (js_read < 0) {
+            return;
+        }
+    }
+    else if (sscanf(js_auth, "%d,%d", &r, &w) != 2 || jobserver_attach(r, w) < 0) {
+        //make did not pass the pipe (recipe without +)
+        return;
+    }
+    js_mode = JS_CLIENT;
+    atexit(jobserver_exit);
+}
+
+static void handler_of_jobserver_sigint(int signal) {
+    js_interrupted = 1;
+}
+
+static int jobserver_try(int *token) {
+    unsigned char c;
+
+    if (js_implicit_free) {
+        js_implicit_free = 0;
+        *token = JOBSERVER_IMPLICIT;
+        return 1;
+    }
+    if (read(js_read, &c, 1) == 1) {
+        js_held++;
+        *token = c;
+        return 1;
+    }
+    return 0;
+}
+
+//a token for one more job (waits for it), 0 -> got one or there is no jobserver, -1 -> ^C
+int jobserver_get(int *token) {
+    struct sigaction sa, old_int;
+
+    *token = JOBSERVER_NONE;
+    jobserver_init();
+    if (js_mode == JS_NONE || jobserver_try(token)) {
+        return 0;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler_of_jobserver_sigint;
+    sigaction(SIGINT, &sa, &old_int);
+    js_interrupted = 0;
+    while (!js_interrupted && !jobserver_try(token)) {
+        //jobs of the shell which finished give theirs back when reaped
+        check_zombi_process();
+        struct pollfd pfd = {js_read, POLLIN, 0};
+        poll(&pfd, 1, 100);
+    }
+    sigaction(SIGINT, &old_int, NULL);
+    return js_interrupted ? -1 : 0;
+}
+
+//a token if one is free (or waits with wait), 1 -> got one or there is no jobserver
+int jobserver_take(int *token, int wait) {
+    if (wait) {
+        return jobserver_get(token) == 0;
+    }
+    *token = JOBSERVER_NONE;
+    jobserver_init();
+    return js_mode == JS_NONE || jobserver_try(token);
+}
+
+//the token goes back to the pool
+void jobserver_put(int *token) {
+    if (*token == JOBSERVER_IMPLICIT) {
+        js_implicit_free = 1;
+    }
+    else if (*token >= 0) {
+        unsigned char c = *token;
+        while (write(js_write, &c, 1) < 0 && errno == EINTR);
+        js_held--;
+    }
+    *token = JOBSERVER_NONE;
+}
+
+//jobserver N
+static int jobserver_serve(int slots) {
+    int fd[2];
+    char *flags = getenv("MAKEFLAGS");
+
+    if (pipe(fd) < 0) {
+        printf("jobserver: %s\n", strerror(errno));
+        return 1;
+    }
+    //above 9, exec 3>file and cmd 3>file must not hit them; inherited by every child
+    int r = fcntl(fd[0], F_DUPFD, 10), w = fcntl(fd[1], F_DUPFD, 10);
+    close(fd[0]);
+    close(fd[1]);
+    for (int i = 1; i < slots; i++) {
+        write(w, "+", 1);
+    }
+    if (jobserver_attach(r, w) < 0) {
+        printf("jobserver: cannot open the token pipe\n");
+        close(r);
+        close(w);
+        return 1;
+    }
+
+    snprintf(js_auth, sizeof(js_auth), "%d,%d", r, w);
+    size_t len = (flags != NULL ? strlen(flags) : 0) + 64;
+    char *value = (char*) malloc(len);
+    snprintf(value, len, "%s%s-j%d --jobserver-auth=%s", flags != NULL ? flags : "",
+             flags != NULL && flags[0] != '\0' ? " " : "", slots, js_auth);
+    setenv("MAKEFLAGS", value, 1);
+    free(value);
+
+    js_mode = JS_SERVER;
+    js_slots = slots;
+    atexit(jobserver_exit);
+    return 0;
+}
+
+//jobserver [N]
+int my_shell_jobserver(int argc, char **argv) {
+    jobserver_init();
+    if (argc > 2) {
+        printf("usage: jobserver [N]\n");
+        return 2;
+    }
+    if (argc == 2) {
+        char *end;
+        long slots = strtol(argv[1], &end, 10);
+        if (*end != '\0' || slots < 1 || slots > 4096) {
+            printf("jobserver: %s: invalid number of slots\n", argv[1]);
+            return 2;
+        }
+        if (js_mode != JS_NONE) {
+            printf("jobserver: already %s\n", js_mode == JS_CLIENT ? "a client of make" : "serving");
+            return 1;
+        }
+        return jobserver_serve(slots);
+    }
+
+    switch (js_mode) {
+        case JS_CLIENT:
+            printf("client of %s, %d token(s) taken, own token %s\n", js_auth, js_held,
+                   js_implicit_free ? "free" : "in use");
+            break;
+        case JS_SERVER:
+            printf("server of %d slot(s) at %s, %d token(s) taken, own token %s\n", js_slots, js_auth, js_held,
+                   js_implicit_free ? "free" : "in use");
+            break;
+        default:
+            printf("no jobserver\n");
+            break;
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -5,22 +6,21 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <glob.h>
-#include <pwd.h>
-#include "parse.h"
-
-#define MAX_JOBS_ID 16
+#include "shell.h"
 
 #define PROCESS_INIT 0
 #define PROCESS_DONE 1
 #define PROCESS_REMAIN 2
 
-#define STATUS_PROC_RUNNING 0
-#define STATUS_PROC_SUSPENDED 1
-#define STATUS_PROC_CONTINUED 2
-#define STATUS_PROC_TERMINATED 3
-#define STATUS_PROC_DONE 4
 
+const char* SHELL_OPTION_NAME[] = {
+    "pipemeter",
+    "pinpipes",
+    "explain",
+    NULL
+};
 
 const char* PROCESS_STATUS_MODE[] = {
     "running",
@@ -30,13 +30,6 @@ const char* PROCESS_STATUS_MODE[] = {
     "done"
 };
 
-struct shell_information{
-    char cur_user[TOKEN_BUFSIZE];
-    char cur_dir[PATH_DIR_BUFSIZE];
-    char pw_dir[PATH_DIR_BUFSIZE];
-    job *jobs[MAX_JOBS_ID + 1];
-};
-
 struct shell_information *shell;
 
 //pid -> job id
@@ -129,24 +122,50 @@ int my_free_job(int id){
     if(id > MAX_JOBS_ID || shell->jobs[id] == NULL){
         return -1;//fault
     }
+    destroy_job(shell->jobs[id]);
+    return 0;
+}
 
-    job* job_temp = shell->jobs[id];
-    process* proc;
+//free process and the ones after it
+void destroy_process(process* proc){
     process* tmp;
-    for(proc = job_temp->process_list;proc != NULL; ){
+    for(;proc != NULL; ){
         tmp = proc->next;//leave next process
         //free this process
-        free(proc->program_name);
-        free(proc->argument_list);
-        free(proc->input_redirection);
-        free(proc->output_redirection);
-        free(proc);
+        mem_free(MEM_JOBS, proc->program_name);
+        for (int i = 0; proc->argument_list[i] != NULL; i++) {
+            mem_free(MEM_JOBS, proc->argument_list[i]);
+        }
+        mem_free(MEM_JOBS, proc->argument_list);
+        mem_free(MEM_JOBS, proc->input_redirection);
+        mem_free(MEM_JOBS, proc->heredoc);
+        mem_free(MEM_JOBS, proc->heredoc_end);
+        mem_free(MEM_JOBS, proc->output_redirection);
+        while (proc->more_outputs != NULL) {
+            output_target *out = proc->more_outputs;
+            proc->more_outputs = out->next;
+            mem_free(MEM_JOBS, out->path);
+            mem_free(MEM_JOBS, out);
+        }
+        while (proc->fd_redirects != NULL) {
+            fd_redirect *r = proc->fd_redirects;
+            proc->fd_redirects = r->next;
+            mem_free(MEM_JOBS, r->path);
+            mem_free(MEM_JOBS, r);
+        }
+        mem_free(MEM_JOBS, proc);
         proc = tmp;
     }
+}
+
+//free job (with or without id)
+void destroy_job(job* job_temp){
+    destroy_process(job_temp->process_list);
+    jobserver_put(&job_temp->token);
     //complete free job
-    free(job_temp->job_command);
-    free(job_temp);
-    return 0;
+    mem_free(MEM_JOBS, job_temp->cpu_list);
+    mem_free(MEM_JOBS, job_temp->job_command);
+    mem_free(MEM_JOBS, job_temp);
 }
 
 //job -> give id to job
@@ -167,6 +186,10 @@ int remove_id_from_job(int id){
     if(id > MAX_JOBS_ID || shell->jobs[id] == NULL){
         return -1;
     }
+    deadline_cancel(shell->jobs[id]->pgid);
+    stage_wait(shell->jobs[id]);
+    metrics_count(METRIC_JOBS_COMPLETED);
+    metrics_observe(METRIC_HIST_JOB, metrics_now() - shell->jobs[id]->started);
     my_free_job(id);
     shell->jobs[id] = NULL;
     return 0;
@@ -181,7 +204,7 @@ int search_job_is_completed_or_not(int id){
     process* proc;
 
     for (proc = shell->jobs[id]->process_list; proc != NULL;proc = proc->next){
-        if(proc->process_status != STATUS_PROC_DONE){
+        if(proc->process_status != STATUS_PROC_DONE && proc->process_status != STATUS_PROC_TERMINATED){
             return 0;//not
         }
     }
@@ -206,6 +229,27 @@ int give_status_to_process(int pid,int status){
     return -1;
 }
 
+//process (have pid) and wait status -> process (have exit status)
+int give_exit_status_to_process(int pid,int status){
+    process* proc;
+    int id = get_job_id_by_pid(pid);
+    if(id < 0){
+        return -1;
+    }
+    for(proc = shell->jobs[id]->process_list; proc != NULL;proc = proc->next){
+        if(proc->pid == pid){
+            if(WIFEXITED(status)){
+                proc->exit_status = WEXITSTATUS(status);
+            }
+            else if(WIFSIGNALED(status)){
+                proc->exit_status = 128 + WTERMSIG(status);
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
 //set all process in job[id] satatus
 int give_status_to_job(int id,int status){
     if(id > MAX_JOBS_ID || shell->jobs[id] == NULL){
@@ -224,13 +268,15 @@ int give_status_to_job(int id,int status){
 //wait process (which have pid) 
 int wait_for_pid(int pid){
     int status = 0;//status running
-    waitpid(pid,&status,WUNTRACED);
+    deadline_waitpid(pid,&status);
     //done
     if(WIFEXITED(status)){
+        give_exit_status_to_process(pid,status);
         give_status_to_process(pid,STATUS_PROC_DONE);
     }
     //terminated
     else if(WIFSIGNALED(status)){
+        give_exit_status_to_process(pid,status);
         give_status_to_process(pid,STATUS_PROC_TERMINATED);
     }
     //suspended
@@ -241,6 +287,17 @@ int wait_for_pid(int pid){
     return status;
 }
 
+//number of jobs in the table
+int count_jobs(){
+    int cnt = 0;
+    for(int i = 1;i <= MAX_JOBS_ID;i++){
+        if(shell->jobs[i] != NULL){
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
 //count process (which need wait) in job[id]
 int get_proc_count(int id,int filter){
     if(id > MAX_JOBS_ID || shell->jobs[id] == NULL){
@@ -271,13 +328,15 @@ int wait_for_job(int id) {
     int status = 0;//running
 
     do {
-        wait_pid = waitpid(shell->jobs[id]->pgid, &status, WUNTRACED);
+        wait_pid = deadline_waitpid(-shell->jobs[id]->pgid, &status);
         wait_cnt++;
 
         if (WIFEXITED(status)) {
+            give_exit_status_to_process(wait_pid, status);
             give_status_to_process(wait_pid, STATUS_PROC_DONE);
         } 
         else if (WIFSIGNALED(status)) {
+            give_exit_status_to_process(wait_pid, status);
             give_status_to_process(wait_pid, STATUS_PROC_TERMINATED);
         } 
         else if (WSTOPSIG(status)) {
@@ -293,107 +352,175 @@ int wait_for_job(int id) {
 }
 
 
-//prepare for cd command
-void my_shell_prepare_for_my_cd() {
-    if(getcwd(shell->cur_dir, sizeof(shell->cur_dir)) == NULL){
-        printf("my_shell_prepare_for_my_cd\n");
-    }
-}
-
-//cd
-int my_shell_cd(int argc, char** argv) {
-
-    if (argc == 1) {
-        if(chdir(shell->pw_dir) == -1){
-            printf("my_shell_cd\n");
-            return 0;
+//fg/bg argument (%N or N) -> job id, else the newest background or suspended job
+int search_job_id_for_fg_bg(int argc, char **argv){
+    if(argc > 1){
+        int id = atoi(argv[1][0] == '%' ? argv[1] + 1 : argv[1]);
+        if(id > 0 && id <= MAX_JOBS_ID && shell->jobs[id] != NULL && shell->jobs[id]->notify){
+            return id;
         }
-        my_shell_prepare_for_my_cd();
-        return 0;
-    }
-
-    if (chdir(argv[1]) == 0) {
-        my_shell_prepare_for_my_cd();
-        return 0;
-    } 
-    else {
-        printf("No such file or directory\n");
-        return 0;
+        return -1;
     }
-}
-
-//search background job
-pid_t search_background_job(){
-    //process* proc;
-    for(int i = 1;i <= MAX_JOBS_ID;++i){
-        if(shell->jobs[i] == NULL){
+    process* proc;
+    for(int i = MAX_JOBS_ID;i >= 1;--i){
+        if(shell->jobs[i] == NULL || !shell->jobs[i]->notify){
             continue;
         }
         if(shell->jobs[i]->mode == BACKGROUND){
-            return shell->jobs[i]->process_list->pid;
+            return i;
+        }
+        for(proc = shell->jobs[i]->process_list; proc != NULL;proc = proc->next){
+            if(proc->process_status == STATUS_PROC_SUSPENDED){
+                return i;
+            }
         }
     }
-    return -100;
+    return -1;
 }
 
 //fg
-int my_shell_fg() {
-
-    pid_t pid;
-    
-    pid = search_background_job();
-    if(pid == -100){
+int my_shell_fg(int argc, char **argv) {
+    int id = search_job_id_for_fg_bg(argc, argv);
+    if(id < 0){
         printf("no background job\n");
+        return -1;
     }
+    job* job_tmp = shell->jobs[id];
 
-    if (kill(pid, SIGCONT) < 0) {
+    //tcsetgrp
+    tcsetpgrp(0, job_tmp->pgid);
+    if (kill(-job_tmp->pgid, SIGCONT) < 0) {
         printf("job not found\n");
-        return -1;
     }
-    //tcsetgrp
-    tcsetpgrp(0, pid);
+    job_tmp->mode = FOREGROUND;
+    give_status_to_job(id, STATUS_PROC_CONTINUED);
 
-    wait_for_pid(pid);
+    int status = wait_for_job(id);
 
     signal(SIGTTOU, SIG_IGN);
     tcsetpgrp(0, getpid());
     signal(SIGTTOU, SIG_DFL);
 
+    if (status >= 0 && search_job_is_completed_or_not(id)) {
+        stage_wait(job_tmp);
+        process* proc;
+        for (proc = job_tmp->process_list; proc->next != NULL; proc = proc->next);
+        shell->last_status = job_tmp->timed_out ? 124 : proc->exit_status;
+        remove_id_from_job(id);
+    }
     return 0;
 }
 
-//search suspended process
-pid_t search_process_status(){
-    process* proc;
-    for(int i = 1;i <= MAX_JOBS_ID;++i){
-        if(shell->jobs[i] == NULL){
-            continue;
+//bg
+int my_shell_bg(int argc, char **argv) {
+    int id = search_job_id_for_fg_bg(argc, argv);
+    if(id < 0){
+        printf("no suspended job\n");
+        return -1;
+    }
+
+    if (kill(-shell->jobs[id]->pgid, SIGCONT) < 0) {
+        printf("my_shell: bg %d: job not found\n", id);
+        return -1;
+    }
+    shell->jobs[id]->mode = BACKGROUND;
+    give_status_to_job(id, STATUS_PROC_CONTINUED);
+    return 0;
+}
+
+//jobs [-l] [--watch]
+int my_shell_jobs(int argc, char **argv) {
+    int watch = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
         }
-        for(proc = shell->jobs[i]->process_list; proc != NULL;proc = proc->next){
-            if(proc->process_status == STATUS_PROC_SUSPENDED){
-                return proc->pid;
+    }
+    if (watch) {
+        return my_shell_jtop(argc, argv);
+    }
+
+    check_zombi_process();
+    for (int i = 1; i <= MAX_JOBS_ID; i++) {
+        print_job_status_by_job_id(i);
+    }
+    return 0;
+}
+
+//set -o name / set +o name / set -o
+int my_shell_set(int argc, char **argv) {
+    if (argc < 3) {
+        for (int i = 0; SHELL_OPTION_NAME[i] != NULL; i++) {
+            printf("%-12s %s\n", SHELL_OPTION_NAME[i], (shell->options & (1 << i)) ? "on" : "off");
+        }
+        return 0;
+    }
+    if (strcmp(argv[1], "-o") != 0 && strcmp(argv[1], "+o") != 0) {
+        printf("usage: set [-o|+o] option\n");
+        return 2;
+    }
+    for (int i = 0; SHELL_OPTION_NAME[i] != NULL; i++) {
+        if (strcmp(argv[2], SHELL_OPTION_NAME[i]) == 0) {
+            if (argv[1][0] == '-') {
+                shell->options |= 1 << i;
+            }
+            else {
+                shell->options &= ~(1 << i);
             }
+            return 0;
         }
     }
-    return -100;
+    printf("set: %s: invalid option name\n", argv[2]);
+    return 1;
 }
 
-//bg
-int my_shell_bg(/*int argc, char **argv*/) {
-    
-    pid_t pid;
-
-    pid = search_process_status();
-    if(pid == -100){
-        printf("no suspended job\n");
+//output_fd of a builtin as a stream (fclose when done), after what the shell has buffered
+FILE* builtin_output(int output_fd) {
+    fflush(stdout);
+    int fd = dup(output_fd);
+    FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (fp == NULL && fd >= 0) {
+        close(fd);
     }
+    return fp;
+}
 
-    if (kill(-pid, SIGCONT) < 0) {
-        printf("my_shell: bg %d: job not found\n", pid);
-        return -1;
+//echo [-n] args
+int my_shell_echo(int argc, char **argv, int output_fd) {
+    int newline = !(argc > 1 && strcmp(argv[1], "-n") == 0);
+    size_t len = 0;
+
+    for (int i = 2 - newline; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *buf = malloc(len + 1);
+    char *p = buf;
+    for (int i = 2 - newline; i < argc; i++) {
+        p = stpcpy(p, argv[i]);
+        *p++ = ' ';
+    }
+    if (p > buf) {
+        p--;
+    }
+    if (newline) {
+        *p++ = '\n';
     }
 
-    return 0;
+    int status = 0;
+    for (char *q = buf; q < p; ) {
+        ssize_t n = write(output_fd, q, p - q);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            status = 1;
+            break;
+        }
+        q += n;
+    }
+    free(buf);
+    return status;
 }
 
 //exit
@@ -401,27 +528,46 @@ int my_shell_exit() {
     exit(0);
 }
 
-//check
-void check_zombi_process() {
+//process (have pid) and wait status -> process status, report the job if it finished
+int reap_process(int pid, int status) {
+    //give status to process
+    if (WIFEXITED(status)) {
+        give_exit_status_to_process(pid, status);
+        give_status_to_process(pid, STATUS_PROC_DONE);
+    } else if (WIFSIGNALED(status)) {
+        give_exit_status_to_process(pid, status);
+        give_status_to_process(pid, STATUS_PROC_TERMINATED);
+    } else if (WIFSTOPPED(status)) {
+        give_status_to_process(pid, STATUS_PROC_SUSPENDED);
+    } else if (WIFCONTINUED(status)) {
+        give_status_to_process(pid, STATUS_PROC_CONTINUED);
+    }
+
+    int job_id = get_job_id_by_pid(pid);
+    //reaped -> the next job may have its token
+    if (job_id > 0 && search_job_is_completed_or_not(job_id)) {
+        jobserver_put(&shell->jobs[job_id]->token);
+    }
+    if (job_id > 0 && shell->jobs[job_id]->notify && search_job_is_completed_or_not(job_id)) {
+        print_job_status_by_job_id(job_id);
+        remove_id_from_job(job_id);
+        return 1;
+    }
+    return 0;
+}
+
+//check -> number of finished jobs reported
+int check_zombi_process() {
     int status;
     int pid;
+    int reported = 0;
 
+    deadline_dispatch();
     while ((pid = waitpid(-1, &status, WNOHANG|WUNTRACED|WCONTINUED)) > 0) {
-        //give status to process
-        if (WIFEXITED(status)) {
-            give_status_to_process(pid, STATUS_PROC_DONE);
-        } else if (WIFSTOPPED(status)) {
-            give_status_to_process(pid, STATUS_PROC_SUSPENDED);
-        } else if (WIFCONTINUED(status)) {
-            give_status_to_process(pid, STATUS_PROC_CONTINUED);
-        }
-
-        int job_id = get_job_id_by_pid(pid);
-        if (job_id > 0 && search_job_is_completed_or_not(job_id)) {
-            print_job_status_by_job_id(job_id);
-            remove_id_from_job(job_id);
-        }
+        metrics_reaped(pid, status);
+        reported += reap_process(pid, status);
     }
+    return reported;
 }
 
 //handler for sigint
@@ -430,7 +576,7 @@ void handler_of_sigint(int signal) {
 }
 
 //commnd -> each function
-int my_shell_execute_command(process *proc) {
+int my_shell_execute_command(job *job, process *proc, int input_fd, int output_fd) {
     int status = 1;
 
     switch (proc->process_type) {
@@ -438,7 +584,10 @@ int my_shell_execute_command(process *proc) {
             my_shell_exit();
             break;
         case CD_COMMAND:
-            my_shell_cd(proc->process_argc, proc->argument_list);
+            shell->last_status = my_shell_cd(proc->process_argc, proc->argument_list);
+            break;
+        case DIRS_COMMAND:
+            shell->last_status = my_shell_dirs(proc->process_argc, proc->argument_list, output_fd);
             break;
         case FG_COMMAND:
             my_shell_fg(proc->process_argc, proc->argument_list);
@@ -446,6 +595,85 @@ int my_shell_execute_command(process *proc) {
         case BG_COMMAND:
             my_shell_bg(proc->process_argc, proc->argument_list);
             break;
+        case CACHE_COMMAND:
+            shell->last_status = my_shell_cache(proc->process_argc, proc->argument_list, proc->input_redirection, output_fd);
+            break;
+        case JOBS_COMMAND:
+            my_shell_jobs(proc->process_argc, proc->argument_list);
+            break;
+        case JTOP_COMMAND:
+            my_shell_jtop(proc->process_argc, proc->argument_list);
+            break;
+        case SET_COMMAND:
+            shell->last_status = my_shell_set(proc->process_argc, proc->argument_list);
+            break;
+        case TIMEOUT_COMMAND:
+            shell->last_status = my_shell_timeout(proc->process_argc, proc->argument_list);
+            break;
+        case RUN_COMMAND:
+            shell->last_status = my_shell_run(proc->process_argc, proc->argument_list);
+            break;
+        case FILTER_COMMAND:
+            status = my_shell_filter(job, proc, input_fd, output_fd);
+            break;
+        case ECHO_COMMAND:
+            //background -> the forked child, nothing would reap a job done here
+            status = 0;
+            if (job->mode == FOREGROUND) {
+                fflush(stdout);
+                proc->exit_status = my_shell_echo(proc->process_argc, proc->argument_list, output_fd);
+                proc->process_status = STATUS_PROC_DONE;
+                status = 1;
+            }
+            break;
+        case STATS_COMMAND:
+            shell->last_status = my_shell_stats(proc->process_argc, proc->argument_list, output_fd);
+            break;
+        case NAMES_COMMAND:
+            shell->last_status = my_shell_names(proc->process_argc, proc->argument_list, output_fd);
+            break;
+        case PIN_COMMAND:
+            shell->last_status = my_shell_pin(proc->process_argc, proc->argument_list, output_fd);
+            break;
+        case MEMSTAT_COMMAND:
+            shell->last_status = my_shell_memstat(proc->process_argc, proc->argument_list, output_fd);
+            break;
+        case PROMPT_COMMAND:
+            shell->last_status = my_shell_prompt(proc->process_argc, proc->argument_list);
+            break;
+        case JOBSERVER_COMMAND:
+            shell->last_status = my_shell_jobserver(proc->process_argc, proc->argument_list);
+            break;
+        case EXEC_COMMAND:
+            shell->last_status = my_shell_exec(proc, input_fd, output_fd);
+            break;
+        case ENABLE_COMMAND:
+            shell->last_status = my_shell_enable(proc->process_argc, proc->argument_list, output_fd);
+            break;
+        case PLUGIN_COMMAND:
+            //a foreground command of its own runs here, in a pipeline, the background or under timeout in the forked child
+            status = 0;
+            if (job->mode == FOREGROUND && job->process_list->next == NULL && job->timeout == 0) {
+                fflush(stdout);
+                proc->exit_status = plugin_run(plugin_find(proc->argument_list[0]), proc->process_argc,
+                                               proc->argument_list, input_fd, output_fd, 1);
+                proc->process_status = STATUS_PROC_DONE;
+                status = 1;
+            }
+            break;
+        case FIND_COMMAND:
+            //the last stage of a foreground job runs here, others in the forked child
+            status = 0;
+            if (job->mode == FOREGROUND && proc->next == NULL && job->timeout == 0) {
+                fflush(stdout);
+                int find_status = my_shell_find(proc->process_argc, proc->argument_list, output_fd);
+                if (find_status >= 0) {
+                    proc->exit_status = find_status;
+                    proc->process_status = STATUS_PROC_DONE;
+                    status = 1;
+                }
+            }
+            break;
         default:
             status = 0;
             break;
@@ -455,26 +683,73 @@ int my_shell_execute_command(process *proc) {
 }
 
 
+//give the terminal to the job, wait for it and take the terminal back
+int wait_for_foreground_job(job *job) {
+    tcsetpgrp(0, job->pgid);
+    int status = wait_for_job(job->id);
+
+    signal(SIGTTOU, SIG_IGN);
+    tcsetpgrp(0, getpid());
+    signal(SIGTTOU, SIG_DFL);
+    return status;
+}
+
+//cd 2>err, dirs 2>&1 >&3 ... -> the builtin with 0-9 of the shell redirected while it runs
+static int execute_command_redirected(job *job, process *proc, int input_fd, int output_fd) {
+    fds_saved saved;
+    int status = 1;
+
+    if (fds_enter(proc, input_fd, output_fd, &saved) < 0) {
+        shell->last_status = 1;
+    }
+    else {
+        status = my_shell_execute_command(job, proc, 0, 1);
+    }
+    fds_leave(&saved);
+    return status;
+}
+
 int my_shell_execute_process(job *job,process *proc, int input_fd, int output_fd, int mode) {
     proc->process_status = STATUS_PROC_RUNNING;
 
-    if (proc->process_type != COMMAND_ETC && my_shell_execute_command(proc)) {
+    //2>file, 3>&1 ... besides <&N / >&N: a builtin of a job applies them in a forked child, others in the shell
+    int fds_more = proc->process_type != COMMAND_ETC && proc->process_type != EXEC_COMMAND && fds_other(proc);
+    int fork_only = fds_more && command_runs_as_job(proc->process_type);
+
+    //builtin stage of a foreground pipeline -> thread
+    if (!fork_only && stage_threadable(job, proc, input_fd) && stage_start(job, proc, input_fd, output_fd) == 0) {
+        return 0;
+    }
+    if (proc->process_type != COMMAND_ETC && !fork_only &&
+        (fds_more ? execute_command_redirected(job, proc, input_fd, output_fd) :
+                    my_shell_execute_command(job, proc, input_fd, output_fd))) {
+        metrics_count(METRIC_BUILTINS);
         return 0;//exist command
     }
 
     pid_t childpid;
     int status = 0;
+    //the child reports a failed exec through exec_pipe, eof -> exec succeeded
+    int exec_pipe[2] = {-1, -1};
+    double spawn_start = metrics_now();
+    pipe2(exec_pipe, O_CLOEXEC);
+    //the child must not write out what the shell has buffered
+    fflush(stdout);
 
     childpid = fork();
 
     if (childpid < 0) {
+        close(exec_pipe[0]);
+        close(exec_pipe[1]);
         return -1;
     } else if (childpid == 0) {
+        close(exec_pipe[0]);
         signal(SIGINT,SIG_DFL);
         signal(SIGTSTP, SIG_DFL);
         signal(SIGTTIN, SIG_DFL);
         signal(SIGTTOU, SIG_DFL);
         signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
 
         proc->pid = getpid();
 
@@ -484,6 +759,7 @@ int my_shell_execute_process(job *job,process *proc, int input_fd, int output_fd
             job->pgid = proc->pid;
             setpgid(0, job->pgid);
         }
+        place_apply(job, proc);
 
         if (input_fd != 0) {
             dup2(input_fd, 0);
@@ -494,93 +770,352 @@ int my_shell_execute_process(job *job,process *proc, int input_fd, int output_fd
             dup2(output_fd, 1);
             close(output_fd);
         }
+        //2>file, 2>&1 ... -> exec_pipe out of the way of the numbers they name first
+        if (proc->fd_redirects != NULL) {
+            if (exec_pipe[1] < 10) {
+                int high = fcntl(exec_pipe[1], F_DUPFD_CLOEXEC, 10);
+                close(exec_pipe[1]);
+                exec_pipe[1] = high;
+            }
+            if (fds_apply(proc) < 0) {
+                _exit(1);
+            }
+        }
+        //find as a pipeline stage or in the background
+        if (proc->process_type == FIND_COMMAND) {
+            close(exec_pipe[1]);
+            int find_status = my_shell_find(proc->process_argc, proc->argument_list, 1);
+            if (find_status >= 0) {
+                _exit(find_status);
+            }
+        }
+        if (proc->process_type == ECHO_COMMAND) {
+            close(exec_pipe[1]);
+            _exit(my_shell_echo(proc->process_argc, proc->argument_list, 1));
+        }
+        if (proc->process_type == PLUGIN_COMMAND) {
+            close(exec_pipe[1]);
+            _exit(plugin_run(plugin_find(proc->argument_list[0]), proc->process_argc, proc->argument_list, 0, 1, 0));
+        }
         //exe
         if (execvp(proc->argument_list[0], proc->argument_list) < 0) {
+            int err = errno;
+            write(exec_pipe[1], &err, sizeof(err));
             printf("command not found\n");
-            exit(0);
+            //_exit: exit() would seek the shared stdin back to what stdio has not read yet
+            fflush(stdout);
+            _exit(127);
         }
-        exit(0);
+        _exit(0);
     } 
     else {
         proc->pid = childpid;
 
+        int err;
+        ssize_t n;
+        close(exec_pipe[1]);
+        while ((n = read(exec_pipe[0], &err, sizeof(err))) < 0 && errno == EINTR);
+        close(exec_pipe[0]);
+        metrics_count(METRIC_FORKS);
+        if (n > 0) {
+            metrics_count(METRIC_EXEC_FAILURES);
+        }
+        else {
+            metrics_observe(METRIC_HIST_SPAWN, metrics_now() - spawn_start);
+        }
+
         if (job->pgid > 0) {
             setpgid(childpid, job->pgid);
         } else {
             job->pgid = proc->pid;
             setpgid(childpid, job->pgid);
         }
+        //timeout DURATION cmd -> the deadline starts with the first process
+        if (job->timeout > 0 && proc == job->process_list) {
+            deadline_add(job->pgid, job->timeout, job->timeout_signal, job->timeout_grace);
+        }
 
         if (mode == FOREGROUND) {
-            tcsetpgrp(0, job->pgid);
-            status = wait_for_job(job->id);
-
-            signal(SIGTTOU, SIG_IGN);
-            tcsetpgrp(0, getpid());
-            signal(SIGTTOU, SIG_DFL);
+            status = wait_for_foreground_job(job);
         }
     }
 
     return status;
 }
 
+//open output target
+int open_output_target(char *path, write_option option) {
+    int flags = O_CREAT|O_WRONLY|O_CLOEXEC|(option == APPEND ? O_APPEND : O_TRUNC);
+    return open(path, flags, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+}
+
+//> a > b ... -> fd which writes to every target (through a tee relay when more than one)
+int open_output_targets(process *proc, pid_t *relay_pid) {
+    int fd = open_output_target(proc->output_redirection, proc->output_option);
+    if (fd < 0 || proc->more_outputs == NULL) {
+        return fd;
+    }
+
+    int n = 1;
+    output_target *out;
+    for (out = proc->more_outputs; out != NULL; out = out->next) {
+        n++;
+    }
+    int *fds = (int*) malloc(n * sizeof(int));
+    fds[0] = fd;
+    n = 1;
+    for (out = proc->more_outputs; out != NULL; out = out->next) {
+        if ((fds[n] = open_output_target(out->path, out->option)) < 0) {
+            printf("%s: cannot open\n", out->path);
+            continue;
+        }
+        n++;
+    }
+
+    fd = n > 1 ? relay_tee_start(fds, n, relay_pid) : fds[0];
+    if (n > 1) {
+        for (int i = 0; i < n; i++) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+    return fd;
+}
+
+//>&N, <&N of a closed N -> the stage fails without running, as fds_apply fails a child
+static int stage_fail(process *proc) {
+    proc->process_status = STATUS_PROC_DONE;
+    proc->exit_status = 1;
+    if (!command_runs_as_job(proc->process_type)) {
+        shell->last_status = 1;
+    }
+    return 0;
+}
+
+//a stage could not be set up -> the input it would have read closed, the job dropped, -1
+static int launch_fail(job *job, int job_id, int input_fd, pid_t *meter_pids) {
+    if (input_fd > 0) {
+        close(input_fd);
+    }
+    free(meter_pids);
+    if (job_id < 0) {
+        destroy_job(job);
+    }
+    remove_id_from_job(job_id);
+    return -1;
+}
+
+//2>&12, 2> with nothing after it ... -> printed, 1
+static int launch_syntax_error(job *job) {
+    for (process *proc = job->process_list; proc != NULL; proc = proc->next) {
+        for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+            if (r->action == REDIR_SYNTAX) {
+                printf("syntax error near `%s'\n", r->path);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
 //execute job
 int my_shell_launch_job(job *job) {
     process *proc;
-    int status = 0, input_fd = 0, fd[2], job_id = -1;
+    int status = 0, input_fd = 0, fd[2], job_id = -1, bad_fd = 0;
+    pid_t *meter_pids = NULL;
+    int meter_cnt = 0;
 
     check_zombi_process();
+    metrics_count(METRIC_JOBS_LAUNCHED);
+    job->started = metrics_now();
 
-    if (job->process_list->process_type == COMMAND_ETC) {
+    //aliases and functions -> their bodies, timeout DURATION cmd args -> cmd args with a deadline,
+    //pin ... cmd args -> cmd args on some cpus
+    while (1) {
+        int call = names_expand(job);
+        if (call < 0) {
+            destroy_job(job);
+            return -1;
+        }
+        if (call > 0) {
+            return names_call(job);
+        }
+        process *first = job->process_list;
+        if (first->process_type == TIMEOUT_COMMAND && first->process_argc > 1) {
+            int prefix = timeout_prepare(job);
+            if (prefix < 0) {
+                destroy_job(job);
+                return -1;
+            }
+            //--deadline %job -> the builtin
+            if (prefix > 0) {
+                break;
+            }
+        }
+        else if (first->process_type == PIN_COMMAND && first->process_argc > 1) {
+            if (place_prepare(job) < 0) {
+                destroy_job(job);
+                return -1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    //a redirection which did not parse, the body of an alias or function too -> nothing of the job runs
+    if (launch_syntax_error(job)) {
+        destroy_job(job);
+        shell->last_status = 2;
+        return -1;
+    }
+    //cat f | cmd -> cmd < f ..., set -o explain -> the plan instead of the job
+    if (rewrite_job(job)) {
+        destroy_job(job);
+        shell->last_status = 0;
+        return 0;
+    }
+    //background -> one token of the jobserver for as long as it runs
+    if (job->mode == BACKGROUND && job->token == JOBSERVER_NONE &&
+        command_runs_as_job(job->process_list->process_type) && jobserver_get(&job->token) < 0) {
+        printf("\n");
+        destroy_job(job);
+        return -1;
+    }
+    place_begin(job);
+
+    if (command_runs_as_job(job->process_list->process_type)) {
         job_id = give_job_id_to_new_job(job);
     }
 
     for (proc = job->process_list; proc != NULL; proc = proc->next) {
         if (proc == job->process_list && proc->input_redirection != NULL) {
-            input_fd = open(proc->input_redirection, O_RDONLY);
+            input_fd = open(proc->input_redirection, O_RDONLY|O_CLOEXEC);
             if (input_fd < 0) {
                 printf("no such file or directory\n");
-                remove_id_from_job(job_id);
-                return -1;
+                return launch_fail(job, job_id, input_fd, meter_pids);
+            }
+        }
+        //<<EOF, <<<word -> the body from a pipe or a memfd, in place of the pipe of a later stage too
+        if (proc->heredoc != NULL) {
+            int body_fd = heredoc_fd(proc->heredoc);
+            if (body_fd < 0) {
+                printf("here-document: %s\n", strerror(errno));
+                return launch_fail(job, job_id, input_fd, meter_pids);
+            }
+            if (input_fd != 0) {
+                close(input_fd);
+            }
+            input_fd = body_fd;
+        }
+        if (proc == job->process_list) {
+            //<&3 -> builtins running in the shell read there too
+            int dup_fd = proc->process_type != COMMAND_ETC ? fds_stage_fd(proc, 0) : -1;
+            bad_fd = dup_fd == FDS_BAD;
+            if (dup_fd >= 0) {
+                if (input_fd != 0) {
+                    close(input_fd);
+                }
+                input_fd = dup_fd;
             }
         }
         if (proc->next != NULL) {
-            if(pipe(fd) == -1){
+            //close-on-exec, a stage must not keep the read end of its own output open
+            if(pipe2(fd, O_CLOEXEC) == -1){
                 printf("pipe error\n");
-                return -1;
+                return launch_fail(job, job_id, input_fd, meter_pids);
             }
-            status = my_shell_execute_process(job, proc, input_fd, fd[1], PIPELINE);
+            status = bad_fd ? stage_fail(proc) : my_shell_execute_process(job, proc, input_fd, fd[1], PIPELINE);
+            bad_fd = 0;
             close(fd[1]);
+            if (input_fd != 0) {
+                close(input_fd);
+            }
             input_fd = fd[0];
+            //set -o pipemeter -> count the bytes of this pipe in a relay
+            if (shell->options & OPTION_PIPEMETER) {
+                meter_pids = (pid_t*) realloc(meter_pids, (meter_cnt + 1) * sizeof(pid_t));
+                int meter_fd = relay_meter_start(input_fd, proc->argument_list[0], proc->next->argument_list[0], &meter_pids[meter_cnt]);
+                if (meter_fd < 0) {
+                    printf("pipe error\n");
+                    return launch_fail(job, job_id, input_fd, meter_pids);
+                }
+                input_fd = meter_fd;
+                meter_cnt++;
+            }
         } 
         else {
             int output_fd = 1;
+            pid_t relay_pid = -1;
             if (proc->output_redirection != NULL) {
-                output_fd = open(proc->output_redirection, O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+                output_fd = open_output_targets(proc, &relay_pid);
                 if (output_fd < 0) {
                     output_fd = 1;
                 }
             }
-            status = my_shell_execute_process(job, proc, input_fd, output_fd, job->mode);
+            //>&3 -> builtins running in the shell write there too
+            int dup_fd = proc->process_type != COMMAND_ETC ? fds_stage_fd(proc, 1) : -1;
+            bad_fd |= dup_fd == FDS_BAD;
+            if (dup_fd >= 0) {
+                if (output_fd != 1) {
+                    close(output_fd);
+                }
+                output_fd = dup_fd;
+            }
+            status = bad_fd ? stage_fail(proc) : my_shell_execute_process(job, proc, input_fd, output_fd, job->mode);
+            if (input_fd != 0) {
+                close(input_fd);
+            }
+            if (output_fd != 1) {
+                close(output_fd);
+            }
+            //a stage thread or a failed stage at the end -> the processes before it still need a wait
+            if ((proc->threaded || bad_fd) && job->mode == FOREGROUND && job->pgid > 0) {
+                status = wait_for_foreground_job(job);
+            }
+            //foreground -> the relay has flushed everything once the job is done
+            if (relay_pid > 0 && status >= 0 && job->mode == FOREGROUND) {
+                waitpid(relay_pid, NULL, 0);
+            }
         }
     }
+    //foreground -> meters report before the prompt
+    for (int i = 0; i < meter_cnt; i++) {
+        if (status >= 0 && job->mode == FOREGROUND) {
+            waitpid(meter_pids[i], NULL, 0);
+        }
+    }
+    free(meter_pids);
 
-    if (job->process_list->process_type == COMMAND_ETC) {
+    if (command_runs_as_job(job->process_list->process_type)) {
         //foreground
         if (status >= 0 && job->mode == FOREGROUND) {
+            stage_wait(job);
+            for (proc = job->process_list; proc->next != NULL; proc = proc->next);
+            shell->last_status = job->timed_out ? 124 : proc->exit_status;
             remove_id_from_job(job_id);
         } 
+        //background, nothing forked -> nothing to reap, the job is over
+        else if (job->mode == BACKGROUND && job->pgid <= 0 && search_job_is_completed_or_not(job_id)) {
+            for (proc = job->process_list; proc->next != NULL; proc = proc->next);
+            shell->last_status = proc->exit_status;
+            remove_id_from_job(job_id);
+        }
         //background
-        else if (job->mode == BACKGROUND) {
+        else if (job->mode == BACKGROUND && job->notify) {
             print_process_of_job_by_job_id(job_id);
         }
     }
+    //builtin -> nothing refers to the job any more
+    else {
+        destroy_job(job);
+    }
+    metrics_tick();
 
     return status;
 }
 
 void my_shell_print_promt() {
-    printf("ish$ ");
+    prompt_print();
 }
 
 
@@ -592,47 +1127,87 @@ void my_shell_exe() {
 
     while (1) {
         my_shell_print_promt();
+        //deadlines and finished background jobs are handled while the prompt waits
+        if (isatty(0)) {
+            fflush(stdout);
+            shell_wait_input(0);
+        }
         line = my_get_line();
         //get_line(line,LINELEN);
 
+        //eof
+        if (line == NULL) {
+            exit(shell->last_status);
+        }
         if (strlen(line) == 0) {
+            mem_free(MEM_LINE, line);
             check_zombi_process();
             continue;
         }
 
+        heredoc_input input = {NULL, session_recording() ? mem_strdup(MEM_LINE, line) : NULL};
+        double parse_start = metrics_now();
         job_tmp = my_shell_parse_command(line);
+        metrics_observe(METRIC_HIST_PARSE, metrics_now() - parse_start);
+        mem_free(MEM_LINE, line);
+        //cmd <<EOF -> the lines up to EOF are its body
+        heredoc_collect(job_tmp, heredoc_input_line, &input);
+        mem_free(MEM_LINE, input.line);
+        if (input.record != NULL) {
+            session_record_input(input.record);
+            mem_free(MEM_LINE, input.record);
+        }
+
+        //--record -> mode, size and outcome of the job
+        int mode = job_tmp->mode, nproc = 0;
+        for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+            nproc++;
+        }
+        //a here-document typed at the prompt is not part of how long the job took
+        double launch_start = metrics_now();
         my_shell_launch_job(job_tmp);
+        shell->last_duration = metrics_now() - launch_start;
+        session_record_result(shell->last_duration, shell->last_status, mode, nproc);
     }
 }
 
-void my_shell_init() {
-    
-    signal(SIGINT,SIG_IGN);
-    signal(SIGQUIT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-
-    pid_t pid = getpid();
-    setpgid(pid, pid);
-    tcsetpgrp(0, pid);
-
-    shell = (struct shell_information*) malloc(sizeof(struct shell_information));
-    getlogin_r(shell->cur_user, sizeof(shell->cur_user));
-
-    struct passwd *pw = getpwuid(getuid());
-    strcpy(shell->pw_dir, pw->pw_dir);
-
-    int i;
-    for (i = 0; i < MAX_JOBS_ID; i++) {
-        shell->jobs[i] = NULL;
+int main(int argc, char **argv) {
+    //ish --startup-bench [N] -> the phases of my_shell_init one by one
+    if (argc > 1 && strcmp(argv[1], "--startup-bench") == 0) {
+        return startup_bench(argc - 1, argv + 1);
+    }
+    //job control only with a terminal
+    my_shell_init(isatty(0));
+
+    //ish -c COMMANDS
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            printf("usage: ish -c COMMANDS\n");
+            return 2;
+        }
+        return my_shell_script_text(argv[2]);
     }
 
-    my_shell_prepare_for_my_cd();
-}
-
-
-int main(int argc, char **argv) {
-    my_shell_init();
+    //ish run FILE [-jN] [-L]
+    if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        return my_shell_run(argc - 1, argv + 1);
+    }
+    //ish --replay FILE [--speed N | --max]
+    if (argc > 1 && strcmp(argv[1], "--replay") == 0) {
+        return session_replay(argc - 1, argv + 1);
+    }
+    //ish --record FILE
+    if (argc > 1 && strcmp(argv[1], "--record") == 0) {
+        if (argc < 3 || session_record_open(argv[2]) < 0) {
+            printf("usage: ish --record FILE\n");
+            return 2;
+        }
+        my_shell_exe();
+    }
+    //ish FILE
+    if (argc > 1) {
+        return my_shell_script(argv[1]);
+    }
     my_shell_exe();
 
     return 0;
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "shell.h"
+
+/* memory accounting of the long-lived parts of the shell.
+   memstat
+
+   allocations which outlive a command go through mem_alloc / mem_free
+   with a pool, live bytes (malloc_usable_size) and blocks are counted
+   per pool. the rest of the heap shows up as untracked next to the
+   totals of malloc and the resident set size, a shell at rest should
+   show no live bytes in line and parser and only running jobs in jobs.
+   make memtest checks that over a million commands. */
+
+typedef struct mem_pool_ {
+    int64_t bytes;//live
+    int64_t blocks;//live
+    uint64_t total;//allocations since start
+} mem_pool;
+
+static const char *MEM_POOL_NAME[MEM_POOLS] = {
+    "line",
+    "parser",
+    "jobs",
+    "stages",
+    "cache",
+    "names",
+    "dirs",
+};
+
+static mem_pool pools[MEM_POOLS];
+
+static void* mem_account(int pool, void *p) {
+    if (p == NULL) {
+        printf("allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    pools[pool].bytes += malloc_usable_size(p);
+    pools[pool].blocks++;
+    pools[pool].total++;
+    return p;
+}
+
+void* mem_alloc(int pool, size_t size) {
+    return mem_account(pool, malloc(size));
+}
+
+void* mem_realloc(int pool, void *p, size_t size) {
+    if (p != NULL) {
+        pools[pool].bytes -= malloc_usable_size(p);
+        pools[pool].blocks--;
+    }
+    return mem_account(pool, realloc(p, size));
+}
+
+char* mem_strdup(int pool, const char *s) {
+    return mem_account(pool, strdup(s));
+}
+
+char* mem_strndup(int pool, const char *s, size_t n) {
+    return mem_account(pool, strndup(s, n));
+}
+
+//p is held by another pool from now on
+void mem_move(int from, int to, void *p) {
+    if (p == NULL) {
+        return;
+    }
+    size_t size = malloc_usable_size(p);
+    pools[from].bytes -= size;
+    pools[from].blocks--;
+    pools[to].bytes += size;
+    pools[to].blocks++;
+}
+
+void mem_free(int pool, void *p) {
+    if (p == NULL) {
+        return;
+    }
+    pools[pool].bytes -= malloc_usable_size(p);
+    pools[pool].blocks--;
+    free(p);
+}
+
+//resident set size in bytes, 0 when unknown
+static uint64_t mem_rss() {
+    unsigned long size, resident;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    int n = fscanf(fp, "%lu %lu", &size, &resident);
+    fclose(fp);
+    return n == 2 ? (uint64_t) resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+static int64_t mem_tracked() {
+    int64_t bytes = 0;
+    for (int i = 0; i < MEM_POOLS; i++) {
+        bytes += pools[i].bytes;
+    }
+    return bytes;
+}
+
+//gauges for the stats --prometheus text
+void mem_format_prometheus(FILE *fp) {
+    struct mallinfo2 mi = mallinfo2();
+
+    fprintf(fp, "# HELP ish_memory_live_bytes Heap bytes held by each pool of the shell.\n"
+            "# TYPE ish_memory_live_bytes gauge\n");
+    for (int i = 0; i < MEM_POOLS; i++) {
+        fprintf(fp, "ish_memory_live_bytes{pool=\"%s\"} %lld\n", MEM_POOL_NAME[i], (long long) pools[i].bytes);
+    }
+    fprintf(fp, "# HELP ish_heap_in_use_bytes Heap bytes in use according to malloc.\n"
+            "# TYPE ish_heap_in_use_bytes gauge\nish_heap_in_use_bytes %llu\n",
+            (unsigned long long) (mi.uordblks + mi.hblkhd));
+    fprintf(fp, "# HELP ish_resident_bytes Resident set size of the shell.\n"
+            "# TYPE ish_resident_bytes gauge\nish_resident_bytes %llu\n", (unsigned long long) mem_rss());
+}
+
+//memstat
+int my_shell_memstat(int argc, char **argv, int output_fd) {
+    if (argc > 1) {
+        printf("usage: memstat\n");
+        return 2;
+    }
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    struct mallinfo2 mi = mallinfo2();
+    size_t heap = mi.uordblks + mi.hblkhd;
+    int64_t tracked = mem_tracked();
+
+    fprintf(fp, "%-10s %12s %10s %14s\n", "pool", "live bytes", "blocks", "allocations");
+    for (int i = 0; i < MEM_POOLS; i++) {
+        fprintf(fp, "%-10s %12lld %10lld %14llu\n", MEM_POOL_NAME[i], (long long) pools[i].bytes,
+                (long long) pools[i].blocks, (unsigned long long) pools[i].total);
+    }
+    fprintf(fp, "%-10s %12lld\n", "untracked", (long long) heap - tracked);
+    fprintf(fp, "\n%-10s %12zu\n%-10s %12zu\n%-10s %12llu\n", "heap", heap, "arena", mi.arena,
+            "rss", (unsigned long long) mem_rss());
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* counters and latency histograms of the shell itself.
+   stats [--prometheus | --reset]
+
+   histograms are HDR style: 8 linear sub-buckets per power of two of
+   nanoseconds, so any value is kept within 12.5%. with ISH_METRICS_FILE
+   set the Prometheus text is also written there (tmp + rename) every
+   ISH_METRICS_INTERVAL seconds (default 15) and at exit, for the
+   node exporter textfile collector. */
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB + (64 - HIST_SUB_BITS) * HIST_SUB)
+#define METRICS_DEFAULT_INTERVAL 15.0
+#define REAP_SLOTS 64//exits announced by SIGCHLD and not reaped yet, by pid
+
+typedef struct histogram_ {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;//ns
+    uint64_t max;//ns
+} histogram;
+
+static const struct { const char *name; const char *help; } COUNTER_INFO[METRIC_COUNTERS] = {
+    {"ish_jobs_launched_total", "Jobs handed to the launcher."},
+    {"ish_jobs_completed_total", "Jobs which finished and left the job table."},
+    {"ish_processes_forked_total", "Processes forked for commands."},
+    {"ish_builtins_in_process_total", "Commands run inside the shell without forking."},
+    {"ish_exec_failures_total", "Forked commands whose exec failed."},
+    {"ish_pipeline_rewrites_total", "Rewrite rules applied to pipelines before launch."},
+    {"ish_rewrite_forks_saved_total", "Stages removed by rewrites, each one a fork and a pipe less."},
+};
+
+static const struct { const char *name; const char *help; } HISTOGRAM_INFO[METRIC_HISTOGRAMS] = {
+    {"ish_parse_seconds", "Time to parse a command line."},
+    {"ish_spawn_seconds", "Time from fork to a successful exec in the child."},
+    {"ish_job_duration_seconds", "Time from launch until the job left the job table."},
+    {"ish_reap_delay_seconds", "Time from the SIGCHLD of a child's exit until the shell reaped it."},
+};
+
+static uint64_t counters[METRIC_COUNTERS];
+static histogram histograms[METRIC_HISTOGRAMS];
+static double started_at;//unix time
+static double last_write = 0;
+//pid and monotonic time of the SIGCHLD which announced its exit, pid 0 -> free.
+//exits whose signals merged into one are not seen and not observed
+static volatile struct { pid_t pid; double at; } sigchld_seen[REAP_SLOTS];
+static pid_t metrics_pid = -1;
+
+double metrics_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//from the SIGCHLD handler when pid exited, clock_gettime is async-signal-safe
+void metrics_mark_sigchld(pid_t pid) {
+    int i = pid % REAP_SLOTS;
+    sigchld_seen[i].pid = 0;
+    sigchld_seen[i].at = metrics_now();
+    sigchld_seen[i].pid = pid;
+}
+
+//waitpid returned pid -> its exit observed against its own SIGCHLD, stops and continues are not reaps
+void metrics_reaped(pid_t pid, int status) {
+    int i = pid % REAP_SLOTS;
+    if (WIFSTOPPED(status) || WIFCONTINUED(status) || sigchld_seen[i].pid != pid) {
+        return;
+    }
+    metrics_observe(METRIC_HIST_REAP, metrics_now() - sigchld_seen[i].at);
+    sigchld_seen[i].pid = 0;
+}
+
+static int hist_index(uint64_t v) {
+    if (v < HIST_SUB) {
+        return v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    return HIST_SUB + (e - HIST_SUB_BITS) * HIST_SUB + ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+//largest value of bucket i
+static uint64_t hist_upper(int i) {
+    if (i < HIST_SUB) {
+        return i;
+    }
+    int e = (i - HIST_SUB) / HIST_SUB + HIST_SUB_BITS;
+    uint64_t sub = (i - HIST_SUB) % HIST_SUB;
+    uint64_t width = 1ULL << (e - HIST_SUB_BITS);
+    return ((HIST_SUB + sub) << (e - HIST_SUB_BITS)) + width - 1;
+}
+
+void metrics_count(int counter) {
+    counters[counter]++;
+}
+
+void metrics_observe(int hist, double seconds) {
+    histogram *h = &histograms[hist];
+    uint64_t ns = seconds > 0 ? (uint64_t) (seconds * 1e9) : 0;
+    h->counts[hist_index(ns)]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) {
+        h->max = ns;
+    }
+}
+
+static double hist_percentile(histogram *h, double p) {
+    uint64_t rank = (uint64_t) (p * h->count + 0.5), seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t up = hist_upper(i);
+            return (up < h->max ? up : h->max) / 1e9;
+        }
+    }
+    return h->max / 1e9;
+}
+
+//cumulative count of values below 2^bit ns
+static uint64_t hist_below(histogram *h, int bit) {
+    uint64_t n = 0;
+    for (int i = 0; i < hist_index(1ULL << bit); i++) {
+        n += h->counts[i];
+    }
+    return n;
+}
+
+static void metrics_format_prometheus(FILE *fp) {
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", COUNTER_INFO[i].name, COUNTER_INFO[i].help,
+                COUNTER_INFO[i].name, COUNTER_INFO[i].name, (unsigned long long) counters[i]);
+    }
+    fprintf(fp, "# HELP ish_jobs_running Jobs in the job table.\n# TYPE ish_jobs_running gauge\nish_jobs_running %d\n",
+            count_jobs());
+    fprintf(fp, "# HELP ish_start_time_seconds Unix time the shell started.\n# TYPE ish_start_time_seconds gauge\n"
+            "ish_start_time_seconds %.3f\n", started_at);
+    mem_format_prometheus(fp);
+    rewrite_format_prometheus(fp);
+
+    //le at the powers of 4 ns from ~1us to ~69s
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+        histogram *h = &histograms[i];
+        const char *name = HISTOGRAM_INFO[i].name;
+        fprintf(fp, "# HELP %s %s\n# TYPE %s histogram\n", name, HISTOGRAM_INFO[i].help, name);
+        for (int bit = 10; bit <= 36; bit += 2) {
+            fprintf(fp, "%s_bucket{le=\"%.9g\"} %llu\n", name, (1ULL << bit) / 1e9, (unsigned long long) hist_below(h, bit));
+        }
+        fprintf(fp, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) h->count);
+        fprintf(fp, "%s_sum %.9f\n%s_count %llu\n", name, h->sum / 1e9, name, (unsigned long long) h->count);
+    }
+}
+
+static void metrics_format_summary(FILE *fp) {
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        fprintf(fp, "%-32s %llu\n", COUNTER_INFO[i].name, (unsigned long long) counters[i]);
+    }
+    fprintf(fp, "\n%-26s %8s %10s %10s %10s %10s\n", "histogram (ms)", "count", "p50", "p90", "p99", "max");
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+        histogram *h = &histograms[i];
+        fprintf(fp, "%-26s %8llu %10.3f %10.3f %10.3f %10.3f\n", HISTOGRAM_INFO[i].name, (unsigned long long) h->count,
+                hist_percentile(h, 0.5) * 1e3, hist_percentile(h, 0.9) * 1e3, hist_percentile(h, 0.99) * 1e3,
+                h->max / 1e6);
+    }
+}
+
+//ISH_METRICS_FILE <- prometheus text, written to a tmp file and renamed over it
+static void metrics_write_file() {
+    char *path = getenv("ISH_METRICS_FILE");
+    if (path == NULL || *path == '\0' || getpid() != metrics_pid) {
+        return;
+    }
+    char tmp[PATH_DIR_BUFSIZE + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int) getpid());
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        return;
+    }
+    metrics_format_prometheus(fp);
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+    last_write = metrics_now();
+}
+
+//write the textfile when the interval has passed
+void metrics_tick() {
+    if (getenv("ISH_METRICS_FILE") == NULL) {
+        return;
+    }
+    char *s = getenv("ISH_METRICS_INTERVAL");
+    double interval = s != NULL ? atof(s) : METRICS_DEFAULT_INTERVAL;
+    if (metrics_now() - last_write >= interval) {
+        metrics_write_file();
+    }
+}
+
+void metrics_init() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    started_at = ts.tv_sec + ts.tv_nsec / 1e9;
+    metrics_pid = getpid();
+    atexit(metrics_write_file);
+}
+
+//stats [--prometheus | --reset]
+int my_shell_stats(int argc, char **argv, int output_fd) {
+    int prometheus = argc > 1 && strcmp(argv[1], "--prometheus") == 0;
+
+    if (argc > 1 && strcmp(argv[1], "--reset") == 0) {
+        memset(counters, 0, sizeof(counters));
+        memset(histograms, 0, sizeof(histograms));
+        return 0;
+    }
+    if (argc > 1 && !prometheus) {
+        printf("usage: stats [--prometheus | --reset]\n");
+        return 2;
+    }
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    if (prometheus) {
+        metrics_format_prometheus(fp);
+    }
+    else {
+        metrics_format_summary(fp);
+    }
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,343 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "shell.h"
+
+/* jtop [-d SEC] [-n COUNT] (jobs -l --watch)
+   live cpu, rss, i/o and state of every process in the job table.
+   /proc/<pid>/stat, statm and io stay open while the process lives and
+   are re-read with pread(2); only the cells which changed are redrawn. */
+
+#define MONITOR_COLUMNS 8
+#define MONITOR_CELLLEN 64
+
+typedef char monitor_row[MONITOR_COLUMNS][MONITOR_CELLLEN];
+
+typedef struct proc_sample_ {
+    pid_t pid;
+    int job_id;
+    int stat_fd;
+    int statm_fd;
+    int io_fd;
+    unsigned long long ticks;//utime + stime
+    int seen;
+} proc_sample;
+
+static const char *MONITOR_HEADER[MONITOR_COLUMNS] = {"JOB", "PID", "S", "CPU%", "RSS", "READ", "WRITE", "COMMAND"};
+static const int MONITOR_WIDTH[MONITOR_COLUMNS] = {5, 8, 3, 7, 10, 10, 10, 32};
+
+//one row per live process of the job table, grown to the largest count seen while jtop runs
+static proc_sample *samples = NULL;
+static int sample_count = 0;
+static int sample_cap = 0;
+static monitor_row *rows = NULL;
+static monitor_row *screen = NULL;//what the terminal shows
+static int row_cap = 0;
+static int screen_rows = 0;
+
+static double monitor_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int monitor_open(pid_t pid, const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+    return open(path, O_RDONLY|O_CLOEXEC);
+}
+
+static int monitor_pread(int fd, char *buf, size_t size) {
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return 0;
+}
+
+static void monitor_close(proc_sample *s) {
+    if (s->stat_fd >= 0) close(s->stat_fd);
+    if (s->statm_fd >= 0) close(s->statm_fd);
+    if (s->io_fd >= 0) close(s->io_fd);
+}
+
+static void monitor_close_all() {
+    for (int i = 0; i < sample_count; i++) {
+        monitor_close(&samples[i]);
+    }
+    sample_count = 0;
+    free(samples);
+    free(rows);
+    free(screen);
+    samples = NULL;
+    rows = screen = NULL;
+    sample_cap = row_cap = 0;
+}
+
+static proc_sample* monitor_get_sample(pid_t pid, int job_id) {
+    for (int i = 0; i < sample_count; i++) {
+        if (samples[i].pid == pid) {
+            return &samples[i];
+        }
+    }
+    if (sample_count == sample_cap) {
+        sample_cap = sample_cap ? sample_cap * 2 : 16;
+        samples = realloc(samples, sample_cap * sizeof(proc_sample));
+    }
+    proc_sample *s = &samples[sample_count++];
+    s->pid = pid;
+    s->job_id = job_id;
+    s->stat_fd = monitor_open(pid, "stat");
+    s->statm_fd = monitor_open(pid, "statm");
+    s->io_fd = monitor_open(pid, "io");
+    s->ticks = 0;
+    return s;
+}
+
+//closes the files of processes which left the job table
+static void monitor_drop_unseen() {
+    int j = 0;
+    for (int i = 0; i < sample_count; i++) {
+        if (samples[i].seen) {
+            samples[j++] = samples[i];
+        }
+        else {
+            monitor_close(&samples[i]);
+        }
+    }
+    sample_count = j;
+}
+
+static void monitor_format_bytes(char *cell, unsigned long long bytes) {
+    const char *unit = "BKMGT";
+    double v = bytes;
+    while (v >= 1024 && unit[1] != '\0') {
+        v /= 1024;
+        unit++;
+    }
+    snprintf(cell, MONITOR_CELLLEN, *unit == 'B' ? "%.0f%c" : "%.1f%c", v, *unit);
+}
+
+//sample one process -> cells of its row
+static void monitor_sample(proc_sample *s, process *proc, double elapsed, monitor_row row) {
+    static long clk_tck = 0;
+    static long page_kb = 0;
+    char buf[1024];
+    char state = '?';
+    unsigned long long ticks = s->ticks, rss = 0, rchar = 0, wchar = 0;
+
+    if (clk_tck == 0) {
+        clk_tck = sysconf(_SC_CLK_TCK);
+        page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    }
+
+    //pid (comm) state ppid ... utime(14) stime(15)
+    if (monitor_pread(s->stat_fd, buf, sizeof(buf)) == 0) {
+        char *p = strrchr(buf, ')');
+        unsigned long long utime, stime;
+        if (p != NULL && sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &state, &utime, &stime) == 3) {
+            ticks = utime + stime;
+        }
+    }
+    if (monitor_pread(s->statm_fd, buf, sizeof(buf)) == 0) {
+        sscanf(buf, "%*u %llu", &rss);
+    }
+    if (monitor_pread(s->io_fd, buf, sizeof(buf)) == 0) {
+        char *p;
+        if ((p = strstr(buf, "rchar:")) != NULL) rchar = strtoull(p + 6, NULL, 10);
+        if ((p = strstr(buf, "wchar:")) != NULL) wchar = strtoull(p + 6, NULL, 10);
+    }
+
+    double cpu = (s->ticks == 0 || elapsed <= 0) ? 0 : (ticks - s->ticks) * 100.0 / clk_tck / elapsed;
+    s->ticks = ticks;
+
+    snprintf(row[0], MONITOR_CELLLEN, "[%d]", s->job_id);
+    snprintf(row[1], MONITOR_CELLLEN, "%d", s->pid);
+    snprintf(row[2], MONITOR_CELLLEN, "%c", state);
+    snprintf(row[3], MONITOR_CELLLEN, "%.1f", cpu);
+    monitor_format_bytes(row[4], rss * page_kb * 1024);
+    monitor_format_bytes(row[5], rchar);
+    monitor_format_bytes(row[6], wchar);
+    snprintf(row[7], MONITOR_CELLLEN, "%.*s", MONITOR_WIDTH[7], proc->program_name);
+}
+
+static int monitor_live(process *proc) {
+    return proc->pid > 0 && proc->process_status != STATUS_PROC_DONE && proc->process_status != STATUS_PROC_TERMINATED;
+}
+
+//job table -> rows
+static int monitor_collect(double elapsed) {
+    int n = 0;
+
+    //a pipeline can have any number of stages
+    for (int id = 1; id <= MAX_JOBS_ID; id++) {
+        job *job_tmp = get_job_by_job_id(id);
+        for (process *proc = job_tmp != NULL ? job_tmp->process_list : NULL; proc != NULL; proc = proc->next) {
+            n += monitor_live(proc);
+        }
+    }
+    if (n > row_cap) {
+        row_cap = n * 2;
+        rows = realloc(rows, row_cap * sizeof(monitor_row));
+        screen = realloc(screen, row_cap * sizeof(monitor_row));
+    }
+
+    n = 0;
+    for (int i = 0; i < sample_count; i++) {
+        samples[i].seen = 0;
+    }
+    for (int id = 1; id <= MAX_JOBS_ID; id++) {
+        job *job_tmp = get_job_by_job_id(id);
+        if (job_tmp == NULL) {
+            continue;
+        }
+        for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+            if (!monitor_live(proc)) {
+                continue;
+            }
+            proc_sample *s = monitor_get_sample(proc->pid, id);
+            s->seen = 1;
+            monitor_sample(s, proc, elapsed, rows[n++]);
+        }
+    }
+    monitor_drop_unseen();
+    return n;
+}
+
+//rows -> terminal, only the cells which differ from the previous frame
+static void monitor_draw(int n, int full) {
+    static char out[64 * 1024];
+    int len = 0;
+
+    for (int r = 0; r < n; r++) {
+        int col = 1;
+        for (int c = 0; c < MONITOR_COLUMNS; c++) {
+            if (full || r >= screen_rows || strcmp(screen[r][c], rows[r][c]) != 0) {
+                len += snprintf(out + len, sizeof(out) - len, "\033[%d;%dH%-*s", r + 3, col, MONITOR_WIDTH[c], rows[r][c]);
+                strcpy(screen[r][c], rows[r][c]);
+            }
+            col += MONITOR_WIDTH[c] + 1;
+        }
+        if (len > (int) sizeof(out) - 1024) {
+            write(1, out, len);
+            len = 0;
+        }
+    }
+    //rows which disappeared
+    for (int r = n; r < screen_rows; r++) {
+        len += snprintf(out + len, sizeof(out) - len, "\033[%d;1H\033[K", r + 3);
+        if (len > (int) sizeof(out) - 1024) {
+            write(1, out, len);
+            len = 0;
+        }
+    }
+    screen_rows = n;
+    write(1, out, len);
+}
+
+static void monitor_print_plain(int n) {
+    for (int c = 0; c < MONITOR_COLUMNS; c++) {
+        printf("%-*s ", MONITOR_WIDTH[c], MONITOR_HEADER[c]);
+    }
+    printf("\n");
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < MONITOR_COLUMNS; c++) {
+            printf("%-*s ", MONITOR_WIDTH[c], rows[r][c]);
+        }
+        printf("\n");
+    }
+}
+
+//jtop
+int my_shell_jtop(int argc, char **argv) {
+    double interval = 1.0;
+    int count = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            interval = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        }
+    }
+    if (interval <= 0) {
+        interval = 1.0;
+    }
+
+    //not a terminal -> one plain snapshot over a short interval
+    if (!isatty(0) || !isatty(1)) {
+        double wait = interval < 0.2 ? interval : 0.2;
+        check_zombi_process();
+        monitor_collect(0);
+        double t0 = monitor_now();
+        usleep(wait * 1e6);
+        check_zombi_process();
+        monitor_print_plain(monitor_collect(monitor_now() - t0));
+        monitor_close_all();
+        return 0;
+    }
+
+    struct termios old_tio, tio;
+    tcgetattr(0, &old_tio);
+    tio = old_tio;
+    tio.c_lflag &= ~(ICANON|ECHO|ISIG);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSANOW, &tio);
+
+    //alternate screen, hide cursor, header
+    printf("\033[?1049h\033[?25l\033[H\033[2Jish jtop - q to quit");
+    fflush(stdout);
+    char header[256];
+    int len = 0;
+    len += snprintf(header + len, sizeof(header) - len, "\033[2;1H\033[7m");
+    for (int c = 0; c < MONITOR_COLUMNS; c++) {
+        len += snprintf(header + len, sizeof(header) - len, "%-*s ", MONITOR_WIDTH[c], MONITOR_HEADER[c]);
+    }
+    len += snprintf(header + len, sizeof(header) - len, "\033[0m");
+    write(1, header, len);
+
+    screen_rows = 0;
+    double last = monitor_now();
+    int full = 1;
+    while (count != 0) {
+        check_zombi_process();
+        double now = monitor_now();
+        int n = monitor_collect(now - last);
+        last = now;
+        monitor_draw(n, full);
+        full = 0;
+        if (count > 0) {
+            count--;
+        }
+
+        struct pollfd pfd = {0, POLLIN, 0};
+        if (poll(&pfd, 1, (int) (interval * 1000)) > 0) {
+            char c;
+            if (read(0, &c, 1) == 1 && (c == 'q' || c == 3 || c == 4)) {
+                break;
+            }
+            if (c == 'r' || c == 12) {
+                full = 1;
+            }
+        }
+    }
+
+    printf("\033[?25h\033[?1049l");
+    fflush(stdout);
+    tcsetattr(0, TCSANOW, &old_tio);
+    monitor_close_all();
+    return 0;
+}
@@ -0,0 +1,690 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* command names: builtins, aliases and functions.
+   alias [name[=value] ...]
+   unalias [-a] name...
+   name() { cmd; cmd | cmd; }      function name { ...; }
+   unset -f name...
+   type name...
+
+   every command word is looked up in one hash table (fnv-1a, open
+   addressing). builtins are entered at start, loadable ones by enable
+   -f, an alias or a function defined under a name overrides what the
+   name meant before. alias and function bodies are parsed once when
+   they are defined and kept as job templates, a call only copies the
+   template with $1..$9, $#, $@ bound and splices it into the job: an
+   alias (its arguments go to the end) or a function of one pipeline can
+   be a stage of a pipeline, a function of several commands runs them
+   one after another in the shell. */
+
+#define NAMES_INIT_CAP 64
+#define NAMES_MAX_DEPTH 64//nested expansions of one job / nested calls
+
+#define NAME_NONE 0
+#define NAME_ALIAS 1
+#define NAME_FUNCTION 2
+
+typedef struct name_entry_ {
+    char *name;//NULL -> empty slot
+    int builtin;//command type, COMMAND_ETC -> not a builtin
+    int kind;//NAME_*, set by alias / function
+    char *text;//body as defined
+    job **bodies;//pre-parsed templates
+    int nbodies;
+    void *loadable;//PLUGIN_COMMAND: its builtin in plugin.c
+} name_entry;
+
+static const struct { const char *name; int type; } BUILTIN_NAME[] = {
+    {"exit", EXIT_COMMAND}, {"cd", CD_COMMAND}, {"fg", FG_COMMAND}, {"bg", BG_COMMAND},
+    {"cache", CACHE_COMMAND}, {"run", RUN_COMMAND}, {"jobs", JOBS_COMMAND}, {"jtop", JTOP_COMMAND},
+    {"set", SET_COMMAND}, {"timeout", TIMEOUT_COMMAND}, {"wc", FILTER_COMMAND}, {"grep", FILTER_COMMAND},
+    {"head", FILTER_COMMAND}, {"find", FIND_COMMAND}, {"stats", STATS_COMMAND}, {"echo", ECHO_COMMAND},
+    {"memstat", MEMSTAT_COMMAND}, {"pin", PIN_COMMAND}, {"exec", EXEC_COMMAND}, {"jobserver", JOBSERVER_COMMAND}, {"prompt", PROMPT_COMMAND}, {"enable", ENABLE_COMMAND}, {"pushd", DIRS_COMMAND}, {"popd", DIRS_COMMAND},
+    {"dirs", DIRS_COMMAND}, {"z", DIRS_COMMAND}, {"alias", NAMES_COMMAND}, {"unalias", NAMES_COMMAND},
+    {"function", NAMES_COMMAND}, {"unset", NAMES_COMMAND}, {"type", NAMES_COMMAND},
+};
+
+static name_entry *table = NULL;
+static uint32_t table_cap = 0;
+static uint32_t table_len = 0;
+static int call_depth = 0;
+
+static uint32_t names_hash(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s != '\0') {
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    }
+    return h;
+}
+
+static name_entry* names_slot(const char *name) {
+    uint32_t i = names_hash(name) & (table_cap - 1);
+    while (table[i].name != NULL && strcmp(table[i].name, name) != 0) {
+        i = (i + 1) & (table_cap - 1);
+    }
+    return &table[i];
+}
+
+static name_entry* names_insert(const char *name);
+
+static void names_init() {
+    table_cap = NAMES_INIT_CAP;
+    table = (name_entry*) mem_alloc(MEM_NAMES, table_cap * sizeof(name_entry));
+    memset(table, 0, table_cap * sizeof(name_entry));
+    for (size_t i = 0; i < sizeof(BUILTIN_NAME) / sizeof(BUILTIN_NAME[0]); i++) {
+        names_insert(BUILTIN_NAME[i].name)->builtin = BUILTIN_NAME[i].type;
+    }
+}
+
+//name -> its entry, NULL when the name means nothing to the shell
+static name_entry* names_find(const char *name) {
+    if (table == NULL) {
+        names_init();
+    }
+    name_entry *e = names_slot(name);
+    return e->name != NULL ? e : NULL;
+}
+
+static name_entry* names_insert(const char *name) {
+    name_entry *e = names_slot(name);
+    if (e->name != NULL) {
+        return e;
+    }
+    //keep the load under 1/2
+    if ((table_len + 1) * 2 > table_cap) {
+        name_entry *old = table;
+        uint32_t old_cap = table_cap;
+        table_cap *= 2;
+        table = (name_entry*) mem_alloc(MEM_NAMES, table_cap * sizeof(name_entry));
+        memset(table, 0, table_cap * sizeof(name_entry));
+        for (uint32_t i = 0; i < old_cap; i++) {
+            if (old[i].name != NULL) {
+                *names_slot(old[i].name) = old[i];
+            }
+        }
+        mem_free(MEM_NAMES, old);
+        e = names_slot(name);
+    }
+    e->name = mem_strdup(MEM_NAMES, name);
+    e->builtin = COMMAND_ETC;
+    e->kind = NAME_NONE;
+    e->loadable = NULL;
+    table_len++;
+    return e;
+}
+
+//command word -> command type
+int names_type(const char *name) {
+    name_entry *e = names_find(name);
+    if (e == NULL) {
+        return COMMAND_ETC;
+    }
+    return e->kind != NAME_NONE ? CALL_COMMAND : e->builtin;
+}
+
+//name -> loadable builtin (data NULL -> none again), -1 when the name is a builtin of the shell
+int names_set_loadable(const char *name, void *data) {
+    name_entry *e = names_find(name);
+    if (e != NULL && e->builtin != COMMAND_ETC && e->builtin != PLUGIN_COMMAND) {
+        return -1;
+    }
+    if (e == NULL) {
+        e = names_insert(name);
+    }
+    e->builtin = data != NULL ? PLUGIN_COMMAND : COMMAND_ETC;
+    e->loadable = data;
+    return 0;
+}
+
+//name -> its loadable builtin, NULL when it is none
+void* names_loadable(const char *name) {
+    name_entry *e = names_find(name);
+    return e != NULL ? e->loadable : NULL;
+}
+
+//command word -> command type, aliases and functions left out
+static int names_builtin_type(const char *name) {
+    name_entry *e = names_find(name);
+    return e != NULL ? e->builtin : COMMAND_ETC;
+}
+
+//templates are accounted to MEM_NAMES while they are kept
+static void names_move_job(job *job_tmp, int from, int to) {
+    mem_move(from, to, job_tmp);
+    mem_move(from, to, job_tmp->job_command);
+    for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        mem_move(from, to, proc);
+        mem_move(from, to, proc->program_name);
+        for (int i = 0; proc->argument_list[i] != NULL; i++) {
+            mem_move(from, to, proc->argument_list[i]);
+        }
+        mem_move(from, to, proc->argument_list);
+        mem_move(from, to, proc->input_redirection);
+        mem_move(from, to, proc->heredoc);
+        mem_move(from, to, proc->heredoc_end);
+        mem_move(from, to, proc->output_redirection);
+        for (output_target *out = proc->more_outputs; out != NULL; out = out->next) {
+            mem_move(from, to, out);
+            mem_move(from, to, out->path);
+        }
+        for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+            mem_move(from, to, r);
+            mem_move(from, to, r->path);
+        }
+    }
+}
+
+static void names_clear(name_entry *e) {
+    for (int i = 0; i < e->nbodies; i++) {
+        names_move_job(e->bodies[i], MEM_NAMES, MEM_JOBS);
+        destroy_job(e->bodies[i]);
+    }
+    mem_free(MEM_NAMES, e->bodies);
+    mem_free(MEM_NAMES, e->text);
+    e->bodies = NULL;
+    e->nbodies = 0;
+    e->text = NULL;
+    e->kind = NAME_NONE;
+}
+
+//position after the quoted word or command starting at p, sep ends it
+static const char* names_skip(const char *p, char sep) {
+    char quote = 0;
+    for (; *p != '\0'; p++) {
+        if (quote) {
+            if (*p == quote) {
+                quote = 0;
+            }
+        }
+        else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        }
+        else if (*p == '\\' && p[1] != '\0') {
+            p++;
+        }
+        else if (*p == sep) {
+            break;
+        }
+    }
+    return p;
+}
+
+//name = body text -> pre-parsed templates, 0 on success
+static int names_define(const char *name, int kind, const char *text) {
+    job **bodies = NULL;
+    int nbodies = 0;
+    const char *p = text;
+
+    //a function body is cmd; cmd; ..., an alias body one pipeline
+    while (*p != '\0') {
+        const char *end = kind == NAME_FUNCTION ? names_skip(p, ';') : p + strlen(p);
+        char *part = mem_strndup(MEM_PARSER, p, end - p);
+        char *hd = part + strspn(part, TOKEN_SEPARATION);
+        if (*hd != '\0') {
+            job *body = my_shell_parse_command(hd);
+            names_move_job(body, MEM_JOBS, MEM_NAMES);
+            bodies = (job**) mem_realloc(MEM_NAMES, bodies, (nbodies + 1) * sizeof(job*));
+            bodies[nbodies++] = body;
+        }
+        mem_free(MEM_PARSER, part);
+        p = *end != '\0' ? end + 1 : end;
+    }
+    if (nbodies == 0) {
+        printf("%s: empty %s\n", name, kind == NAME_ALIAS ? "alias" : "function");
+        return -1;
+    }
+
+    name_entry *e = names_insert(name);
+    names_clear(e);
+    e->kind = kind;
+    e->text = mem_strdup(MEM_NAMES, text);
+    e->bodies = bodies;
+    e->nbodies = nbodies;
+    return 0;
+}
+
+//"name() { body }", "function name { body }" -> job running "function name body", NULL if line is no definition
+job* names_parse_definition(char *line) {
+    char *p = line, *name, *name_end;
+
+    if (strncmp(p, "function", 8) == 0 && (p[8] == ' ' || p[8] == '\t')) {
+        p += 8 + strspn(p + 8, " \t");
+    }
+    else if (strstr(p, "()") == NULL) {
+        return NULL;
+    }
+    name = p;
+    p += strcspn(p, " \t(){}|<>&;'\"");
+    name_end = p;
+    if (name_end == name) {
+        return NULL;
+    }
+    p += strspn(p, " \t");
+    if (strncmp(p, "()", 2) == 0) {
+        p += 2 + strspn(p + 2, " \t");
+    }
+    else if (name == line) {
+        return NULL;//name without () needs the function keyword
+    }
+    size_t len = strlen(p);
+    while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t')) {
+        len--;
+    }
+    if (*p != '{' || len < 2 || p[len - 1] != '}') {
+        return NULL;
+    }
+
+    char *argv[3];
+    argv[0] = "function";
+    argv[1] = strndup(name, name_end - name);
+    argv[2] = strndup(p + 1, len - 2);
+    job *job_tmp = my_shell_make_job(3, argv);
+    free(argv[1]);
+    free(argv[2]);
+    return job_tmp;
+}
+
+//argument of the call for $N, $#, $@ inside word -> bound word
+static char* names_bind_word(const char *word, int argc, char **argv) {
+    size_t args = 16, len = 0;
+    int dollars = 0;
+
+    for (const char *p = strchr(word, '$'); p != NULL; p = strchr(p + 1, '$')) {
+        dollars++;
+    }
+    if (dollars == 0) {
+        return mem_strdup(MEM_JOBS, word);
+    }
+    for (int i = 0; i < argc; i++) {
+        args += strlen(argv[i]) + 1;
+    }
+    char *out = mem_alloc(MEM_JOBS, strlen(word) + dollars * args + 1);
+    for (const char *p = word; *p != '\0'; p++) {
+        if (*p == '$' && p[1] >= '0' && p[1] <= '9') {
+            int n = p[1] - '0';
+            len += sprintf(out + len, "%s", n < argc ? argv[n] : "");
+            p++;
+        }
+        else if (*p == '$' && p[1] == '#') {
+            len += sprintf(out + len, "%d", argc - 1);
+            p++;
+        }
+        else if (*p == '$' && (p[1] == '@' || p[1] == '*')) {
+            for (int i = 1; i < argc; i++) {
+                len += sprintf(out + len, "%s%s", argv[i], i + 1 < argc ? " " : "");
+            }
+            p++;
+        }
+        else {
+            out[len++] = *p;
+        }
+    }
+    out[len] = '\0';
+    return out;
+}
+
+//template process, call arguments -> new process ("$@" alone becomes one word for each argument)
+static process* names_bind_process(process *tmpl, int argc, char **argv, int append, const char *self) {
+    process *proc = (process*) mem_alloc(MEM_JOBS, sizeof(process));
+    int n = 0, cap = tmpl->process_argc + argc + 1;
+
+    *proc = *tmpl;
+    proc->argument_list = (char**) mem_alloc(MEM_JOBS, cap * sizeof(char*));
+    for (int i = 0; i < tmpl->process_argc; i++) {
+        if (strcmp(tmpl->argument_list[i], "$@") == 0) {
+            for (int j = 1; j < argc; j++) {
+                proc->argument_list[n++] = mem_strdup(MEM_JOBS, argv[j]);
+            }
+        }
+        else {
+            proc->argument_list[n++] = names_bind_word(tmpl->argument_list[i], argc, argv);
+        }
+    }
+    //alias -> the arguments go after the body
+    for (int j = 1; append && j < argc; j++) {
+        proc->argument_list[n++] = mem_strdup(MEM_JOBS, argv[j]);
+    }
+    proc->argument_list[n] = NULL;
+    proc->process_argc = n;
+
+    size_t len = 1;
+    for (int i = 0; i < n; i++) {
+        len += strlen(proc->argument_list[i]) + 1;
+    }
+    proc->program_name = mem_alloc(MEM_JOBS, len);
+    proc->program_name[0] = '\0';
+    for (int i = 0; i < n; i++) {
+        strcat(strcat(proc->program_name, proc->argument_list[i]), i + 1 < n ? " " : "");
+    }
+    proc->input_redirection = tmpl->input_redirection ? names_bind_word(tmpl->input_redirection, argc, argv) : NULL;
+    //f() { grep -c x <<<"$1"; } -> bound like a word, a <<EOF of a one-line body has no body to wait for
+    proc->heredoc = tmpl->heredoc ? names_bind_word(tmpl->heredoc, argc, argv) : NULL;
+    proc->heredoc_end = NULL;
+    proc->output_redirection = tmpl->output_redirection ? names_bind_word(tmpl->output_redirection, argc, argv) : NULL;
+    output_target **tail = &proc->more_outputs;
+    for (output_target *out = tmpl->more_outputs; out != NULL; out = out->next) {
+        *tail = (output_target*) mem_alloc(MEM_JOBS, sizeof(output_target));
+        (*tail)->path = names_bind_word(out->path, argc, argv);
+        (*tail)->option = out->option;
+        tail = &(*tail)->next;
+    }
+    *tail = NULL;
+    fd_redirect **fd_tail = &proc->fd_redirects;
+    for (fd_redirect *r = tmpl->fd_redirects; r != NULL; r = r->next) {
+        *fd_tail = (fd_redirect*) mem_alloc(MEM_JOBS, sizeof(fd_redirect));
+        **fd_tail = *r;
+        (*fd_tail)->path = r->path ? names_bind_word(r->path, argc, argv) : NULL;
+        fd_tail = &(*fd_tail)->next;
+    }
+    *fd_tail = NULL;
+
+    //alias ls='ls -F' -> the inner ls is the command, not the alias again
+    if (n == 0) {
+        proc->process_type = COMMAND_ETC;
+    }
+    else if (self != NULL && strcmp(proc->argument_list[0], self) == 0) {
+        proc->process_type = names_builtin_type(self);
+    }
+    else {
+        proc->process_type = get_command_type(proc->argument_list[0]);
+    }
+    proc->next = NULL;
+    return proc;
+}
+
+//template -> process list bound to the call
+static process* names_bind(job *tmpl, int argc, char **argv, int alias, const char *name) {
+    process *head = NULL, **tail = &head;
+    for (process *p = tmpl->process_list; p != NULL; p = p->next) {
+        *tail = names_bind_process(p, argc, argv, alias && p->next == NULL, alias ? name : NULL);
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+//aliases and one-pipeline functions in job -> their bodies spliced in
+//0 -> done, 1 -> the job is a call of a function of several commands (names_call), -1 -> error
+int names_expand(job *job_tmp) {
+    int depth = 0;
+
+    while (1) {
+        process **link = &job_tmp->process_list;
+        while (*link != NULL && (*link)->process_type != CALL_COMMAND) {
+            link = &(*link)->next;
+        }
+        if (*link == NULL) {
+            return 0;
+        }
+        process *call = *link;
+        name_entry *e = names_find(call->argument_list[0]);
+        if (e == NULL || e->kind == NAME_NONE) {
+            call->process_type = COMMAND_ETC;
+            continue;
+        }
+        if (e->nbodies > 1) {
+            if (call == job_tmp->process_list && call->next == NULL && job_tmp->mode == FOREGROUND) {
+                return 1;
+            }
+            printf("%s: a function of several commands runs only on its own in the foreground\n", e->name);
+            return -1;
+        }
+        if (++depth > NAMES_MAX_DEPTH) {
+            printf("%s: expansion too deep\n", e->name);
+            return -1;
+        }
+
+        process *body = names_bind(e->bodies[0], call->process_argc, call->argument_list, e->kind == NAME_ALIAS, e->name);
+        process *last = body;
+        while (last->next != NULL) {
+            last = last->next;
+        }
+        //redirections of the call go to the ends of the body
+        if (call->input_redirection != NULL || call->heredoc != NULL) {
+            mem_free(MEM_JOBS, body->input_redirection);
+            mem_free(MEM_JOBS, body->heredoc);
+            body->input_redirection = call->input_redirection;
+            body->heredoc = call->heredoc;
+            call->input_redirection = NULL;
+            call->heredoc = NULL;
+        }
+        if (call->output_redirection != NULL) {
+            mem_free(MEM_JOBS, last->output_redirection);
+            while (last->more_outputs != NULL) {
+                output_target *out = last->more_outputs;
+                last->more_outputs = out->next;
+                mem_free(MEM_JOBS, out->path);
+                mem_free(MEM_JOBS, out);
+            }
+            last->output_redirection = call->output_redirection;
+            last->output_option = call->output_option;
+            last->more_outputs = call->more_outputs;
+            call->output_redirection = NULL;
+            call->more_outputs = NULL;
+        }
+        fd_redirect **fd_tail = &last->fd_redirects;
+        while (*fd_tail != NULL) {
+            fd_tail = &(*fd_tail)->next;
+        }
+        *fd_tail = call->fd_redirects;
+        call->fd_redirects = NULL;
+        last->next = call->next;
+        *link = body;
+        call->next = NULL;
+        destroy_process(call);
+    }
+}
+
+//function of several commands: each one bound and launched in turn
+int names_call(job *job_tmp) {
+    process *call = job_tmp->process_list;
+    char *name = call->argument_list[0];
+    int status = 0, saved_in = -1, saved_out = -1;
+    pid_t relay_pid = -1;
+
+    if (call_depth >= NAMES_MAX_DEPTH) {
+        printf("%s: calls nested too deep\n", name);
+        destroy_job(job_tmp);
+        return -1;
+    }
+    //f < in > out, f <<EOF -> the shell's own stdin / stdout while the body runs
+    fflush(stdout);
+    if (call->input_redirection != NULL || call->heredoc != NULL) {
+        int fd = call->heredoc != NULL ? heredoc_fd(call->heredoc) : open(call->input_redirection, O_RDONLY|O_CLOEXEC);
+        if (fd < 0) {
+            printf("no such file or directory\n");
+            destroy_job(job_tmp);
+            return -1;
+        }
+        saved_in = fcntl(0, F_DUPFD_CLOEXEC, 3);
+        dup2(fd, 0);
+        close(fd);
+    }
+    if (call->output_redirection != NULL) {
+        int fd = open_output_targets(call, &relay_pid);
+        if (fd >= 0) {
+            saved_out = fcntl(1, F_DUPFD_CLOEXEC, 3);
+            dup2(fd, 1);
+            close(fd);
+        }
+    }
+
+    call_depth++;
+    for (int i = 0; ; i++) {
+        //looked up again each time, the body may define or remove names
+        name_entry *e = names_find(name);
+        if (e == NULL || e->kind != NAME_FUNCTION || i >= e->nbodies) {
+            break;
+        }
+        job *body = (job*) mem_alloc(MEM_JOBS, sizeof(job));
+        *body = *e->bodies[i];
+        body->process_list = names_bind(e->bodies[i], call->process_argc, call->argument_list, 0, NULL);
+        body->job_command = mem_strdup(MEM_JOBS, e->bodies[i]->job_command);
+        body->mode = FOREGROUND;
+        body->timeout = job_tmp->timeout;
+        body->timeout_signal = job_tmp->timeout_signal;
+        body->timeout_grace = job_tmp->timeout_grace;
+        body->cpu_list = job_tmp->cpu_list != NULL ? mem_strdup(MEM_JOBS, job_tmp->cpu_list) : NULL;
+        body->niceness = job_tmp->niceness;
+        body->niceness_set = job_tmp->niceness_set;
+        body->token = JOBSERVER_NONE;
+        status = my_shell_launch_job(body);
+        if (status < 0) {
+            break;//suspended or failed, the rest would run behind its back
+        }
+    }
+    call_depth--;
+
+    fflush(stdout);
+    if (saved_in >= 0) {
+        dup2(saved_in, 0);
+        close(saved_in);
+    }
+    if (saved_out >= 0) {
+        dup2(saved_out, 1);
+        close(saved_out);
+    }
+    if (relay_pid > 0) {
+        waitpid(relay_pid, NULL, 0);
+    }
+    destroy_job(job_tmp);
+    return status;
+}
+
+//command -> its file in PATH (malloc'd), NULL when there is none
+char* names_search_path(const char *command) {
+    if (strchr(command, '/') != NULL) {
+        return access(command, X_OK) == 0 ? strdup(command) : NULL;
+    }
+    char *path = getenv("PATH");
+    if (path == NULL) {
+        return NULL;
+    }
+    while (*path != '\0') {
+        size_t len = strcspn(path, ":");
+        char *file = malloc(len + strlen(command) + 2);
+        struct stat st;
+        sprintf(file, "%.*s/%s", (int) len, path, command);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0) {
+            return file;
+        }
+        free(file);
+        path += len + (path[len] == ':');
+    }
+    return NULL;
+}
+
+static void names_print_alias(FILE *fp, name_entry *e) {
+    fprintf(fp, "alias %s='%s'\n", e->name, e->text);
+}
+
+//alias, unalias, unset -f, type, function NAME BODY
+int my_shell_names(int argc, char **argv, int output_fd) {
+    int status = 0;
+
+    if (table == NULL) {
+        names_init();
+    }
+    if (strcmp(argv[0], "function") == 0) {
+        if (argc != 3) {
+            printf("usage: name() { command; ... }\n");
+            return 2;
+        }
+        return names_define(argv[1], NAME_FUNCTION, argv[2]) < 0 ? 1 : 0;
+    }
+    if (strcmp(argv[0], "unalias") == 0 || strcmp(argv[0], "unset") == 0) {
+        int kind = strcmp(argv[0], "unalias") == 0 ? NAME_ALIAS : NAME_FUNCTION;
+        int i = 1;
+        if (kind == NAME_FUNCTION && (argc < 2 || strcmp(argv[1], "-f") != 0)) {
+            printf("usage: unset -f name...\n");
+            return 2;
+        }
+        i += kind == NAME_FUNCTION;
+        if (kind == NAME_ALIAS && argc == 2 && strcmp(argv[1], "-a") == 0) {
+            for (uint32_t j = 0; j < table_cap; j++) {
+                if (table[j].name != NULL && table[j].kind == NAME_ALIAS) {
+                    names_clear(&table[j]);
+                }
+            }
+            return 0;
+        }
+        for (; i < argc; i++) {
+            name_entry *e = names_find(argv[i]);
+            if (e == NULL || e->kind != kind) {
+                printf("%s: %s: not found\n", argv[0], argv[i]);
+                status = 1;
+                continue;
+            }
+            names_clear(e);
+        }
+        return status;
+    }
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    if (strcmp(argv[0], "alias") == 0) {
+        for (uint32_t j = 0; argc == 1 && j < table_cap; j++) {
+            if (table[j].name != NULL && table[j].kind == NAME_ALIAS) {
+                names_print_alias(fp, &table[j]);
+            }
+        }
+        for (int i = 1; i < argc; i++) {
+            char *eq = strchr(argv[i], '=');
+            if (eq == NULL) {
+                name_entry *e = names_find(argv[i]);
+                if (e == NULL || e->kind != NAME_ALIAS) {
+                    fprintf(fp, "alias: %s: not found\n", argv[i]);
+                    status = 1;
+                }
+                else {
+                    names_print_alias(fp, e);
+                }
+                continue;
+            }
+            *eq = '\0';
+            if (eq == argv[i] || names_define(argv[i], NAME_ALIAS, eq + 1) < 0) {
+                status = 1;
+            }
+            *eq = '=';
+        }
+    }
+    //type
+    else {
+        for (int i = 1; i < argc; i++) {
+            name_entry *e = names_find(argv[i]);
+            char *path = NULL;
+            if (e != NULL && e->kind == NAME_ALIAS) {
+                fprintf(fp, "%s is aliased to '%s'\n", argv[i], e->text);
+            }
+            else if (e != NULL && e->kind == NAME_FUNCTION) {
+                fprintf(fp, "%s is a function: %s() {%s}\n", argv[i], argv[i], e->text);
+            }
+            else if (e != NULL && e->builtin == PLUGIN_COMMAND) {
+                fprintf(fp, "%s is a loadable builtin from %s\n", argv[i], plugin_path(e->loadable));
+            }
+            else if (e != NULL && e->builtin != COMMAND_ETC) {
+                fprintf(fp, "%s is a shell builtin\n", argv[i]);
+            }
+            else if ((path = names_search_path(argv[i])) != NULL) {
+                fprintf(fp, "%s is %s\n", argv[i], path);
+                free(path);
+            }
+            else {
+                fprintf(fp, "type: %s: not found\n", argv[i]);
+                status = 1;
+            }
+        }
+    }
+    fclose(fp);
+    return status;
+}
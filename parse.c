@@ -6,7 +6,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
-#include "parse.h"
+#include "shell.h"
 
 
 
@@ -89,8 +89,12 @@ static process* initialize_process() {
     initialize_argument_list(p);
     initialize_argument_list_element(p, 0);
     p->input_redirection = NULL;
+    p->heredoc = NULL;
+    p->heredoc_end = NULL;
+    p->heredoc_tabs = 0;
     p->output_option = TRUNC;
     p->output_redirection = NULL;
+    p->more_outputs = NULL;
     p->next = NULL;
 
     return p;
@@ -232,21 +236,74 @@ job* parse_line(char *buf) {
     return curr_job;
 }
 
+//command word -> type, through the name table of builtins, aliases and functions (names.c)
 int get_command_type(char *command) {
-    if (strcmp(command, "exit") == 0) {
-        return EXIT_COMMAND;
-    } 
-    else if (strcmp(command, "cd") == 0) {
-        return CD_COMMAND;
-    } 
-    else if (strcmp(command, "fg") == 0) {
-        return FG_COMMAND;
-    } 
-    else if (strcmp(command, "bg") == 0) {
-        return BG_COMMAND;
+    return names_type(command);
+}
+
+//builtins which fall back to the real command get a job id like it
+int command_runs_as_job(int type) {
+    return type == COMMAND_ETC || type == FILTER_COMMAND || type == FIND_COMMAND || type == ECHO_COMMAND ||
+           type == PLUGIN_COMMAND;
+}
+
+//next word of *s, quotes and backslashes removed in place, NULL at the end
+//quoted -> the first character was quoted (no redirection)
+static char* next_word(char **s, int *quoted) {
+    char *r = *s + strspn(*s, TOKEN_SEPARATION), *w = r, *word = r;
+    char quote = 0;
+
+    if (*r == '\0') {
+        *s = r;
+        return NULL;
     }
-    else 
-        return COMMAND_ETC;
+    *quoted = *r == '\'' || *r == '"' || *r == '\\';
+    for (; *r != '\0'; r++) {
+        if (quote) {
+            if (*r == quote) {
+                quote = 0;
+            }
+            else if (quote == '"' && *r == '\\' && (r[1] == '"' || r[1] == '\\')) {
+                *w++ = *++r;
+            }
+            else {
+                *w++ = *r;
+            }
+        }
+        else if (*r == '\'' || *r == '"') {
+            quote = *r;
+        }
+        else if (*r == '\\' && r[1] != '\0') {
+            *w++ = *++r;
+        }
+        else if (strchr(TOKEN_SEPARATION, *r) != NULL) {
+            r++;
+            break;
+        }
+        else {
+            *w++ = *r;
+        }
+    }
+    *w = '\0';
+    *s = r;
+    return word;
+}
+
+//"2>", "3<&" ... -> 1 (a single digit before < or >), else 0
+static int fd_prefix(const char *token) {
+    return token[0] >= '0' && token[0] <= '9' && (token[1] == '<' || token[1] == '>');
+}
+
+//redirection which does not parse -> REDIR_SYNTAX naming it, the launch fails the job
+static void syntax_redirect(fd_redirect ***fd_tail, const char *near) {
+    fd_redirect *r = (fd_redirect*) mem_alloc(MEM_JOBS, sizeof(fd_redirect));
+    r->fd = 0;
+    r->action = REDIR_SYNTAX;
+    r->source = 0;
+    r->path = mem_strdup(MEM_JOBS, near);
+    r->next = NULL;
+    **fd_tail = r;
+    *fd_tail = &r->next;
 }
 
 process* my_shell_parse_command_pre_pre(char *str) {
@@ -254,37 +311,33 @@ process* my_shell_parse_command_pre_pre(char *str) {
 
     int position = 0;
 
-    char *command = strdup(str);
+    char *command = mem_strdup(MEM_JOBS, str);
     char *token;
-    char **tokens = (char**) malloc(bufsize * sizeof(char*));
-
-    if (!tokens) {
-        printf("my_shell_parse_command_pre_pre error\n");
-        exit(EXIT_FAILURE);
-    }
+    char **tokens = (char**) mem_alloc(MEM_PARSER, bufsize * sizeof(char*));
+    char *quoted = (char*) mem_alloc(MEM_PARSER, bufsize);
+    int q;
 
-    token = strtok(str, TOKEN_SEPARATION);
-    while (token != NULL) {
+    while ((token = next_word(&str, &q)) != NULL) {
 
-        if (position >= bufsize) {
+        //one more for the NULL at the end
+        if (position + 1 >= bufsize) {
             bufsize += TOKEN_BUFSIZE;
-            tokens = (char**) realloc(tokens, bufsize * sizeof(char*));
-            if (!tokens) {
-                printf("allocation error\n");
-                exit(EXIT_FAILURE);
-            }
+            tokens = (char**) mem_realloc(MEM_PARSER, tokens, bufsize * sizeof(char*));
+            quoted = (char*) mem_realloc(MEM_PARSER, quoted, bufsize);
         }
             tokens[position] = token;
+            quoted[position] = q;
             position++;
-
-        token = strtok(NULL, TOKEN_SEPARATION);
     }
 
-    int i = 0, argc = 0;
-    char *input_redirec = NULL, *output_redirec = NULL;
+    int i = 0, argc = 0, heredoc_tabs = 0;
+    char *input_redirec = NULL, *output_redirec = NULL, *heredoc = NULL, *heredoc_end = NULL;
+    write_option output_option = TRUNC;
+    output_target *more_outputs = NULL, **more_tail = &more_outputs;
+    fd_redirect *fd_redirects = NULL, **fd_tail = &fd_redirects;
 
     while (i < position) {
-        if (tokens[i][0] == '<' || tokens[i][0] == '>') {
+        if (!quoted[i] && (tokens[i][0] == '<' || tokens[i][0] == '>' || fd_prefix(tokens[i]))) {
             break;
         }
         i++;
@@ -292,77 +345,188 @@ process* my_shell_parse_command_pre_pre(char *str) {
     argc = i;
 
     for (; i < position; i++) {
+        if (quoted[i]) {
+            break;
+        }
+        //N< N> N>> N<& N>& -> fd N, else 0 / 1
+        int fd = fd_prefix(tokens[i]) ? tokens[i][0] - '0' : -1;
+        char *op = tokens[i] + (fd >= 0);
+
+        // N<&M, N>&M, N>&-
+        if ((op[0] == '<' || op[0] == '>') && op[1] == '&') {
+            char *target = op + 2;
+            if (*target == '\0') {
+                if (i + 1 >= position) {
+                    syntax_redirect(&fd_tail, "newline");
+                    break;
+                }
+                target = tokens[++i];
+            }
+            if (!(strcmp(target, "-") == 0 || (target[0] >= '0' && target[0] <= '9' && target[1] == '\0'))) {
+                syntax_redirect(&fd_tail, target);
+                break;
+            }
+            fd_redirect *r = (fd_redirect*) mem_alloc(MEM_JOBS, sizeof(fd_redirect));
+            r->fd = fd >= 0 ? fd : (op[0] == '<' ? 0 : 1);
+            r->action = target[0] == '-' ? REDIR_CLOSE : REDIR_DUP;
+            r->source = r->action == REDIR_DUP ? target[0] - '0' : 0;
+            r->path = NULL;
+            r->next = NULL;
+            *fd_tail = r;
+            fd_tail = &r->next;
+        }
+        // N<file, N>file, N>>file (other than 0< and 1>)
+        else if ((op[0] == '<' && fd > 0) || (op[0] == '>' && fd >= 0 && fd != 1)) {
+            int action = op[0] == '<' ? REDIR_READ : (op[1] == '>' ? REDIR_APPEND : REDIR_WRITE);
+            char *target = op + 1 + (action == REDIR_APPEND);
+            if (*target == '\0') {
+                if (i + 1 >= position) {
+                    syntax_redirect(&fd_tail, "newline");
+                    break;
+                }
+                target = tokens[++i];
+            }
+            fd_redirect *r = (fd_redirect*) mem_alloc(MEM_JOBS, sizeof(fd_redirect));
+            r->fd = fd;
+            r->action = action;
+            r->source = 0;
+            r->path = mem_strdup(MEM_JOBS, target);
+            r->next = NULL;
+            *fd_tail = r;
+            fd_tail = &r->next;
+        }
+        // <<EOF, <<-EOF, <<<word (the last of < and << counts)
+        else if (op[0] == '<' && op[1] == '<') {
+            int here_string = op[2] == '<';
+            int tabs = !here_string && op[2] == '-';
+            char *target = op + 2 + here_string + tabs;
+            if (*target == '\0') {
+                if (i + 1 >= position) {
+                    syntax_redirect(&fd_tail, "newline");
+                    break;
+                }
+                target = tokens[++i];
+            }
+            mem_free(MEM_JOBS, input_redirec);
+            mem_free(MEM_JOBS, heredoc);
+            mem_free(MEM_JOBS, heredoc_end);
+            input_redirec = heredoc_end = NULL;
+            if (here_string) {
+                heredoc = mem_alloc(MEM_JOBS, strlen(target) + 2);
+                strcat(strcpy(heredoc, target), "\n");
+            }
+            else {
+                heredoc = mem_strdup(MEM_JOBS, "");
+                heredoc_end = mem_strdup(MEM_JOBS, target);
+                heredoc_tabs = tabs;
+            }
+        }
         // < 
-        if (tokens[i][0] == '<') {
+        else if (op[0] == '<') {
             //after < -> 隙間あり
-            if (strlen(tokens[i]) == 1) {
-                input_redirec = (char *) malloc((strlen(tokens[i + 1]) + 1) * sizeof(char));
-                strcpy(input_redirec, tokens[i + 1]);
+            if (strlen(op) == 1) {
+                if (i + 1 >= position) {
+                    syntax_redirect(&fd_tail, "newline");
+                    break;
+                }
+                mem_free(MEM_JOBS, input_redirec);
+                input_redirec = mem_strdup(MEM_JOBS, tokens[i + 1]);
                 i++;
             }
             //after < -> 隙間なし
             else {
-                input_redirec = (char *) malloc(strlen(tokens[i]) * sizeof(char));
-                strcpy(input_redirec, tokens[i] + 1);
+                mem_free(MEM_JOBS, input_redirec);
+                input_redirec = mem_strdup(MEM_JOBS, op + 1);
             }
+            mem_free(MEM_JOBS, heredoc);
+            mem_free(MEM_JOBS, heredoc_end);
+            heredoc = heredoc_end = NULL;
         }
-        // > 
-        else if (tokens[i][0] == '>') {
+        // > or >>
+        else if (op[0] == '>') {
+            write_option option = TRUNC;
+            char *target = op + 1;
+            if (*target == '>') {
+                option = APPEND;
+                target++;
+            }
             //after > -> 隙間あり
-            if (strlen(tokens[i]) == 1) {
-                output_redirec = (char *) malloc((strlen(tokens[i + 1]) + 1) * sizeof(char));
-                strcpy(output_redirec, tokens[i + 1]);
-                i++;
+            if (*target == '\0') {
+                if (i + 1 >= position) {
+                    syntax_redirect(&fd_tail, "newline");
+                    break;
+                }
+                target = tokens[++i];
+            }
+            //first target -> output_redirection, the rest -> more_outputs
+            if (output_redirec == NULL) {
+                output_redirec = mem_strdup(MEM_JOBS, target);
+                output_option = option;
             }
-            //after > -> 隙間なし 
             else {
-                output_redirec = (char *) malloc(strlen(tokens[i]) * sizeof(char));
-                strcpy(output_redirec, tokens[i] + 1);
+                output_target *out = (output_target*) mem_alloc(MEM_JOBS, sizeof(output_target));
+                out->path = mem_strdup(MEM_JOBS, target);
+                out->option = option;
+                out->next = NULL;
+                *more_tail = out;
+                more_tail = &out->next;
             }
         } else {
             break;
         }
     }
 
-    for (i = argc; i <= position; i++) {
-        tokens[i] = NULL;
+    //argv owns its strings, str is the caller's scratch
+    char **argv = (char**) mem_alloc(MEM_JOBS, (argc + 1) * sizeof(char*));
+    for (i = 0; i < argc; i++) {
+        argv[i] = mem_strdup(MEM_JOBS, tokens[i]);
     }
+    argv[argc] = NULL;
+    mem_free(MEM_PARSER, tokens);
+    mem_free(MEM_PARSER, quoted);
 
     //input
-    process *new_proc = (process*) malloc(sizeof(process));
+    process *new_proc = (process*) mem_alloc(MEM_JOBS, sizeof(process));
     new_proc->program_name = command;
-    new_proc->argument_list = tokens;
+    new_proc->argument_list = argv;
     new_proc->process_argc = argc;
     new_proc->input_redirection = input_redirec;
+    new_proc->heredoc = heredoc;
+    new_proc->heredoc_end = heredoc_end;
+    new_proc->heredoc_tabs = heredoc_tabs;
+    new_proc->output_option = output_option;
     new_proc->output_redirection = output_redirec;
+    new_proc->more_outputs = more_outputs;
+    new_proc->fd_redirects = fd_redirects;
     new_proc->pid = -1;
-    new_proc->process_type = get_command_type(tokens[0]);
+    new_proc->threaded = 0;
+    new_proc->exit_status = 0;
+    new_proc->process_type = get_command_type(argc > 0 ? argv[0] : "");
     new_proc->next = NULL;
     return new_proc;
 }
 
-//remove ' '
+//skip leading ' ', trailing blanks are left to the tokenizer (echo a\<space>)
 char* my_shell_parse_command_pre(char* line) {
     char *hd = line;
-    char *tl = line + strlen(line);
 
     while (*hd == ' ') {
         hd++;
     }
 
-    while (*tl == ' ') {
-        tl--;
-    }
-
-    *(tl + 1) = '\0';
-
     return hd;
 }
 
-//parse
+//parse (line is modified, the job does not point into it)
 job* my_shell_parse_command(char *line) {
     line = my_shell_parse_command_pre(line);
-    char *command = strdup(line);
+
+    //name() { ... } -> job which defines the function
+    job *definition = names_parse_definition(line);
+    if (definition != NULL) {
+        return definition;
+    }
+    char *command = mem_strdup(MEM_JOBS, line);
 
     //init status
     process *root_proc = NULL;
@@ -372,6 +536,7 @@ job* my_shell_parse_command(char *line) {
     char *seg;
     int seg_len = 0;
     int mode = FOREGROUND;
+    char quote = 0;
 
     //background
     if (line[strlen(line) - 1] == '&') {
@@ -380,15 +545,14 @@ job* my_shell_parse_command(char *line) {
     }
 
     while (1) {
-        //go until last or pipe
-        if (*com == '\0' || *com == '|') {
+        //go until last or pipe (outside quotes)
+        if (*com == '\0' || (*com == '|' && !quote)) {
 
-            seg = (char*) malloc((seg_len + 1) * sizeof(char));
             //そこまでの内容 -> seg
-            strncpy(seg, line_using, seg_len);
-            seg[seg_len] = '\0';
+            seg = mem_strndup(MEM_PARSER, line_using, seg_len);
 
             process* new_proc = my_shell_parse_command_pre_pre(seg);
+            mem_free(MEM_PARSER, seg);
             if (!root_proc) {
                 root_proc = new_proc;
                 proc = root_proc;
@@ -411,34 +575,102 @@ job* my_shell_parse_command(char *line) {
             }
         } 
         else {
+            if (quote) {
+                quote = *com == quote ? 0 : quote;
+            }
+            else if (*com == '\'' || *com == '"') {
+                quote = *com;
+            }
+            else if (*com == '\\' && com[1] != '\0') {
+                seg_len++;
+                com++;
+            }
             seg_len++;
             com++;
         }
     }
     //input
-    job *new_job = (job*) malloc(sizeof(job));
+    job *new_job = (job*) mem_alloc(MEM_JOBS, sizeof(job));
     new_job->process_list = root_proc;
     new_job->job_command = command;
     new_job->pgid = -1;
+    new_job->notify = 1;
+    new_job->timeout = 0;
+    new_job->timed_out = 0;
+    new_job->cpu_list = NULL;
+    new_job->niceness_set = 0;
+    new_job->token = JOBSERVER_NONE;
     new_job->mode = mode;
     return new_job;
 }
 
-//get line
+//argv -> job (one foreground process, argv is copied)
+job* my_shell_make_job(int argc, char **argv) {
+    int len = 0;
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        len += strlen(argv[i]) + 1;
+    }
+    char *command = (char*) mem_alloc(MEM_JOBS, len + 1);
+    char **tokens = (char**) mem_alloc(MEM_JOBS, (argc + 1) * sizeof(char*));
+    command[0] = '\0';
+    for (i = 0; i < argc; i++) {
+        tokens[i] = mem_strdup(MEM_JOBS, argv[i]);
+        strcat(command, argv[i]);
+        if (i + 1 < argc) {
+            strcat(command, " ");
+        }
+    }
+    tokens[argc] = NULL;
+
+    process *new_proc = (process*) mem_alloc(MEM_JOBS, sizeof(process));
+    new_proc->program_name = mem_strdup(MEM_JOBS, command);
+    new_proc->argument_list = tokens;
+    new_proc->process_argc = argc;
+    new_proc->input_redirection = NULL;
+    new_proc->heredoc = NULL;
+    new_proc->heredoc_end = NULL;
+    new_proc->heredoc_tabs = 0;
+    new_proc->output_option = TRUNC;
+    new_proc->output_redirection = NULL;
+    new_proc->more_outputs = NULL;
+    new_proc->fd_redirects = NULL;
+    new_proc->pid = -1;
+    new_proc->threaded = 0;
+    new_proc->exit_status = 0;
+    new_proc->process_type = get_command_type(tokens[0]);
+    new_proc->next = NULL;
+
+    job *new_job = (job*) mem_alloc(MEM_JOBS, sizeof(job));
+    new_job->process_list = new_proc;
+    new_job->job_command = command;
+    new_job->pgid = -1;
+    new_job->notify = 1;
+    new_job->timeout = 0;
+    new_job->timed_out = 0;
+    new_job->cpu_list = NULL;
+    new_job->niceness_set = 0;
+    new_job->token = JOBSERVER_NONE;
+    new_job->mode = FOREGROUND;
+    return new_job;
+}
+
+//get line (free it with mem_free(MEM_LINE, ...))
 char* my_get_line() {
     int bufsize = COMMAND_BUFSIZE;
     int position = 0;
-    char *buffer = malloc(sizeof(char) * bufsize);
+    char *buffer = mem_alloc(MEM_LINE, sizeof(char) * bufsize);
     int com;
 
-    if (!buffer) {
-        printf("get line error\n");
-        exit(EXIT_FAILURE);
-    }
-
     while (1) {
         //input
         com = getchar();
+        //eof on an empty line -> NULL
+        if (com == EOF && position == 0) {
+            mem_free(MEM_LINE, buffer);
+            return NULL;
+        }
         if (com == EOF || com == '\n') {
             buffer[position] = '\0';
             return buffer;
@@ -450,12 +682,7 @@ char* my_get_line() {
 
         if (position >= bufsize) {
             bufsize += COMMAND_BUFSIZE;
-            buffer = realloc(buffer, bufsize);
-
-            if (!buffer) {
-                printf("get line error\n");
-                exit(EXIT_FAILURE);
-            }
+            buffer = mem_realloc(MEM_LINE, buffer, bufsize);
         }
     }
 }
\ No newline at end of file
@@ -18,12 +18,53 @@
 #define FG_COMMAND 2
 #define CD_COMMAND 3
 #define COMMAND_ETC 4
+#define CACHE_COMMAND 5
+#define RUN_COMMAND 6
+#define JOBS_COMMAND 7
+#define JTOP_COMMAND 8
+#define SET_COMMAND 9
+#define TIMEOUT_COMMAND 10
+#define FILTER_COMMAND 11//wc, grep, head: in-process when possible
+#define FIND_COMMAND 12
+#define STATS_COMMAND 13
+#define ECHO_COMMAND 14
+#define MEMSTAT_COMMAND 15
+#define PIN_COMMAND 16
+#define NAMES_COMMAND 17//alias, unalias, function, unset, type
+#define CALL_COMMAND 18//alias or function
+#define EXEC_COMMAND 19
+#define JOBSERVER_COMMAND 20
+#define PROMPT_COMMAND 21
+#define ENABLE_COMMAND 22
+#define PLUGIN_COMMAND 23//loaded by enable -f
+#define DIRS_COMMAND 24//pushd, popd, dirs, z
 
 typedef enum write_option_ {
     TRUNC,
     APPEND,
 } write_option;
 
+typedef struct output_target_ {
+    char*        path;
+    write_option option;
+    struct output_target_* next;
+} output_target;
+
+//numbered fd redirections (fds.c)
+#define REDIR_READ 0//N<file
+#define REDIR_WRITE 1//N>file
+#define REDIR_APPEND 2//N>>file
+#define REDIR_DUP 3//N<&M, N>&M
+#define REDIR_CLOSE 4//N<&-, N>&-
+#define REDIR_SYNTAX 5//N>&12, 2> with no target ... -> path is what did not parse, the job fails
+
+typedef struct fd_redirect_ {
+    int fd;//N
+    int action;//REDIR_*
+    char *path;//file, NULL for dup and close
+    int source;//M of a dup
+    struct fd_redirect_* next;
+} fd_redirect;
 
 typedef struct process_ {
     pid_t pid;
@@ -31,10 +72,17 @@ typedef struct process_ {
     char**       argument_list;//argv
     int process_argc;//argc
     char*        input_redirection;//input_path
+    char*        heredoc;//<<EOF, <<<word -> body, NULL -> none
+    char*        heredoc_end;//EOF of <<EOF until the body is read
+    int heredoc_tabs;//<<-EOF
     int process_type;//type
     int process_status;//status
+    int exit_status;//exit code (128 + signal when killed)
     write_option output_option;
     char*        output_redirection;//output_puth
+    output_target* more_outputs;//> a > b ... -> targets after output_redirection
+    fd_redirect* fd_redirects;//2>err, 2>&1, >&3 ... in the order written
+    int threaded;//runs on a shell thread (stage.c)
 
     struct process_* next;//next_process
 } process;
@@ -49,6 +97,16 @@ typedef struct job_ {
     job_mode     mode;//mode
     int id;//id
     pid_t pgid;//pgid
+    int notify;//report and remove the job when it finishes
+    double timeout;//seconds, 0 -> no deadline
+    int timeout_signal;
+    double timeout_grace;//seconds until SIGKILL
+    int timed_out;
+    char *cpu_list;//pin -c, NULL -> any cpu
+    int niceness;//pin -n
+    int niceness_set;
+    int token;//jobserver token held while it runs, JOBSERVER_NONE -> none
+    double started;//metrics_now() at launch
     char *job_command;
     process*     process_list;//root
     struct job_* next;
@@ -65,6 +123,8 @@ char* get_line(char *, int);
 job* parse_line(char *);
 void free_job(job *);
 job* my_shell_parse_command(char *line);
+job* my_shell_make_job(int argc, char **argv);
 char* my_get_line();
 int get_command_type(char *command);
+int command_runs_as_job(int type);
 #endif
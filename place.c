@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "shell.h"
+
+/* cpu placement of jobs.
+   pin [-c CPULIST] [-n NICE] cmd args
+   pin
+   set -o pinpipes
+
+   pin confines every process of the job to CPULIST (taskset -c syntax,
+   0-3,8) and runs it at niceness NICE. with pinpipes every forked stage
+   of a pipeline gets a cpu of its own, consecutive stages on cpus which
+   are next to each other in topology order (package, L3, L2, core), so
+   the pipe buffers between them stay in a shared cache. a pipeline which
+   fits into one L3 is not split across two, and jobs take turns over the
+   cpus. the topology is read from sysfs once by the shell, children only
+   look it up before exec. pin alone prints the topology. */
+
+typedef struct cpu_node_ {
+    int cpu;
+    int package;
+    int l3;//first cpu sharing the L3, -1 -> none
+    int l2;//first cpu sharing the L2, -1 -> none
+    int core;
+} cpu_node;
+
+static cpu_node *topology = NULL;
+static int topology_len = -1;//-1 -> not read yet
+static int place_next = 0;//slot of the next pipeline
+//cpus of the stages of the job being launched, set up before it forks
+static int *place_cpus = NULL;
+static int place_len = 0;
+
+static int read_int(const char *path, int fallback) {
+    FILE *fp = fopen(path, "r");
+    int v;
+    if (fp == NULL) {
+        return fallback;
+    }
+    if (fscanf(fp, "%d", &v) != 1) {
+        v = fallback;
+    }
+    fclose(fp);
+    return v;
+}
+
+static int cpu_node_cmp(const void *a, const void *b) {
+    const cpu_node *x = a, *y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->l3 != y->l3) return x->l3 - y->l3;
+    if (x->l2 != y->l2) return x->l2 - y->l2;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+//sysfs -> topology, sorted so that neighbours share as much cache as possible
+static void topology_read() {
+    char path[128];
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (topology_len >= 0) {
+        return;
+    }
+    topology = (cpu_node*) malloc((n > 0 ? n : 1) * sizeof(cpu_node));
+    topology_len = 0;
+    for (int cpu = 0; cpu < n && cpu < CPU_SETSIZE; cpu++) {
+        cpu_node *node = &topology[topology_len];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        node->cpu = cpu;
+        node->package = read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        node->core = read_int(path, cpu);
+        node->l2 = node->l3 = -1;
+        for (int index = 0; ; index++) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+            int level = read_int(path, -1);
+            if (level < 0) {
+                break;
+            }
+            //shared_cpu_list starts with the lowest cpu sharing it -> id of the cache
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+            if (level == 2) {
+                node->l2 = read_int(path, -1);
+            }
+            else if (level == 3) {
+                node->l3 = read_int(path, -1);
+            }
+        }
+        topology_len++;
+    }
+    qsort(topology, topology_len, sizeof(cpu_node), cpu_node_cmp);
+}
+
+//"0-3,8" -> set, -1 when malformed
+static int parse_cpu_list(const char *s, cpu_set_t *set) {
+    CPU_ZERO(set);
+    while (*s != '\0') {
+        char *end;
+        long from = strtol(s, &end, 10), to = from;
+        if (end == s || from < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            to = strtol(s, &end, 10);
+            if (end == s || to < from) {
+                return -1;
+            }
+        }
+        if (to >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (long cpu = from; cpu <= to; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        if (*end == ',') {
+            end++;
+        }
+        else if (*end != '\0') {
+            return -1;
+        }
+        s = end;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+//cpus the job may use -> order (topology order), their number
+static int place_order(job *job_tmp, cpu_node **order) {
+    cpu_set_t allowed, job_set;
+
+    topology_read();
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (job_tmp->cpu_list != NULL && parse_cpu_list(job_tmp->cpu_list, &job_set) == 0) {
+        CPU_AND(&allowed, &allowed, &job_set);
+    }
+    int n = 0;
+    *order = (cpu_node*) malloc((topology_len > 0 ? topology_len : 1) * sizeof(cpu_node));
+    for (int i = 0; i < topology_len; i++) {
+        if (CPU_ISSET(topology[i].cpu, &allowed)) {
+            (*order)[n++] = topology[i];
+        }
+    }
+    return n;
+}
+
+//pin ... cmd args -> job running cmd args with the cpu set and niceness
+int place_prepare(job *job_tmp) {
+    process *proc = job_tmp->process_list;
+    char *cpu_list = NULL;
+    int i = 1;
+
+    while (i + 1 < proc->process_argc) {
+        if (strcmp(proc->argument_list[i], "-c") == 0) {
+            cpu_set_t set, allowed;
+            cpu_list = proc->argument_list[i + 1];
+            sched_getaffinity(0, sizeof(allowed), &allowed);
+            if (parse_cpu_list(cpu_list, &set) < 0 || (CPU_AND(&set, &set, &allowed), CPU_COUNT(&set) == 0)) {
+                printf("pin: %s: no usable cpu\n", cpu_list);
+                return -1;
+            }
+        }
+        else if (strcmp(proc->argument_list[i], "-n") == 0) {
+            char *end;
+            long v = strtol(proc->argument_list[i + 1], &end, 10);
+            if (*end != '\0' || v < -20 || v > 19) {
+                printf("pin: %s: invalid niceness\n", proc->argument_list[i + 1]);
+                return -1;
+            }
+            job_tmp->niceness = v;
+            job_tmp->niceness_set = 1;
+        }
+        else {
+            break;
+        }
+        i += 2;
+    }
+    if (i >= proc->process_argc) {
+        printf("usage: pin [-c CPULIST] [-n NICE] command [args...]\n");
+        return -1;
+    }
+    if (cpu_list != NULL) {
+        mem_free(MEM_JOBS, job_tmp->cpu_list);
+        job_tmp->cpu_list = mem_strdup(MEM_JOBS, cpu_list);
+    }
+
+    //drop "pin [options]"
+    for (int j = 0; j < i; j++) {
+        mem_free(MEM_JOBS, proc->argument_list[j]);
+    }
+    memmove(proc->argument_list, proc->argument_list + i, (proc->process_argc - i + 1) * sizeof(char*));
+    proc->process_argc -= i;
+    proc->process_type = get_command_type(proc->argument_list[0]);
+    return 0;
+}
+
+//before the job forks: one cpu for each stage, in pipeline order
+void place_begin(job *job_tmp) {
+    place_len = 0;
+    if (!(shell->options & OPTION_PINPIPES) || job_tmp->process_list->next == NULL) {
+        return;
+    }
+    cpu_node *order;
+    int n = place_order(job_tmp, &order), stages = 0;
+    for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        stages++;
+    }
+    if (n == 0) {
+        free(order);
+        return;
+    }
+
+    int base = place_next % n;
+    //would straddle two L3 -> start at the next one when the pipeline fits in it
+    int first = base, len = 0;
+    while (first > 0 && order[first - 1].l3 == order[base].l3 && order[first - 1].package == order[base].package) {
+        first--;
+    }
+    while (first + len < n && order[first + len].l3 == order[base].l3 && order[first + len].package == order[base].package) {
+        len++;
+    }
+    if (base + stages > first + len && first + len < n) {
+        int next = first + len, next_len = 0;
+        while (next + next_len < n && order[next + next_len].l3 == order[next].l3 &&
+               order[next + next_len].package == order[next].package) {
+            next_len++;
+        }
+        if (stages <= next_len) {
+            base = next;
+        }
+    }
+    place_next = base + stages;
+
+    place_cpus = (int*) realloc(place_cpus, stages * sizeof(int));
+    for (int i = 0; i < stages; i++) {
+        place_cpus[i] = order[(base + i) % n].cpu;
+    }
+    place_len = stages;
+    free(order);
+}
+
+//in the child before exec (no allocation, other threads may hold malloc locks): niceness and cpus of proc
+void place_apply(job *job_tmp, process *proc) {
+    cpu_set_t set;
+
+    if (job_tmp->niceness_set && setpriority(PRIO_PROCESS, 0, job_tmp->niceness) < 0) {
+        fprintf(stderr, "pin: niceness %d: %s\n", job_tmp->niceness, strerror(errno));
+    }
+    if (place_len > 0) {
+        int slot = 0;
+        for (process *p = job_tmp->process_list; p != proc && slot + 1 < place_len; p = p->next) {
+            slot++;
+        }
+        CPU_ZERO(&set);
+        CPU_SET(place_cpus[slot], &set);
+    }
+    else if (job_tmp->cpu_list == NULL || parse_cpu_list(job_tmp->cpu_list, &set) < 0) {
+        return;
+    }
+    //the kernel keeps only the cpus the shell may use itself
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+//pin -> topology as placement sees it
+int my_shell_pin(int argc, char **argv, int output_fd) {
+    if (argc > 1) {
+        printf("usage: pin [-c CPULIST] [-n NICE] command [args...]\n");
+        return 2;
+    }
+    topology_read();
+
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    fprintf(fp, "%-6s %8s %6s %6s %6s\n", "cpu", "package", "l3", "l2", "core");
+    for (int i = 0; i < topology_len; i++) {
+        cpu_node *node = &topology[i];
+        fprintf(fp, "%-6d %8d %6d %6d %6d\n", node->cpu, node->package, node->l3, node->l2, node->core);
+    }
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include "shell.h"
+#include "ish_plugin.h"
+
+/* loadable builtins.
+   enable -f lib.so name...
+   enable -d name...
+   enable
+
+   enable -f opens the library once (RTLD_NOW, a missing symbol fails
+   here and not in the middle of a script), checks its ish_plugin against
+   the ABI of the shell (ish_plugin.h) and enters each name in the name
+   table with its ish_builtin_NAME. a call then costs a hash lookup and a
+   function call: alone it runs in the shell, as a stage of a foreground
+   pipeline on a thread like echo, in the background or under timeout in
+   a forked child. enable -d takes names out again, the library is closed
+   with its last one. enable alone lists them with their calls. */
+
+typedef struct plugin_lib_ {
+    char *path;
+    void *handle;
+    int refs;//names enabled from it
+    struct plugin_lib_ *next;
+} plugin_lib;
+
+typedef struct plugin_builtin_ {
+    char *name;
+    ish_builtin_fn fn;
+    plugin_lib *lib;
+    uint64_t calls;
+    struct plugin_builtin_ *next;
+} plugin_builtin;
+
+static plugin_lib *libs = NULL;
+static plugin_builtin *builtins = NULL;
+
+static const char* plugin_getenv(const char *name) {
+    return getenv(name);
+}
+
+static int plugin_setenv(const char *name, const char *value) {
+    return value != NULL ? setenv(name, value, 1) : unsetenv(name);
+}
+
+//off the shell's own thread the environment is read-only
+static int plugin_setenv_refused(const char *name, const char *value) {
+    return -1;
+}
+
+//name -> its loadable builtin, NULL when it is none
+void* plugin_find(const char *name) {
+    return names_loadable(name);
+}
+
+//library a loadable builtin came from
+const char* plugin_path(void *builtin) {
+    return ((plugin_builtin*) builtin)->lib->path;
+}
+
+//loadable builtin with argv on in_fd / out_fd -> its exit status, in_shell -> it may set the environment
+int plugin_run(void *builtin, int argc, char **argv, int in_fd, int out_fd, int in_shell) {
+    plugin_builtin *b = builtin;
+    ish_call call;
+
+    if (b == NULL) {
+        fprintf(stderr, "%s: not enabled\n", argv[0]);
+        return 127;
+    }
+    __atomic_add_fetch(&b->calls, 1, __ATOMIC_RELAXED);
+    call.size = sizeof(ish_call);
+    call.abi_minor = ISH_PLUGIN_ABI_MINOR;
+    call.argc = argc;
+    call.argv = argv;
+    call.in_fd = in_fd;
+    call.out_fd = out_fd;
+    call.err_fd = 2;
+    call.getenv = plugin_getenv;
+    call.setenv = in_shell ? plugin_setenv : plugin_setenv_refused;
+    return b->fn(&call);
+}
+
+//path -> open library (taken once more), NULL after printing why not
+static plugin_lib* plugin_open(const char *path) {
+    void *handle = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+    if (handle == NULL) {
+        printf("enable: %s\n", dlerror());
+        return NULL;
+    }
+    for (plugin_lib *lib = libs; lib != NULL; lib = lib->next) {
+        if (lib->handle == handle) {
+            dlclose(handle);
+            return lib;
+        }
+    }
+
+    const ish_plugin_info *info = dlsym(handle, "ish_plugin");
+    if (info == NULL) {
+        printf("enable: %s: no ish_plugin, not built against ish_plugin.h\n", path);
+        dlclose(handle);
+        return NULL;
+    }
+    if (info->abi_major != ISH_PLUGIN_ABI_MAJOR) {
+        printf("enable: %s: built for ABI %u.%u, the shell has %d.%d\n", path, info->abi_major, info->abi_minor,
+               ISH_PLUGIN_ABI_MAJOR, ISH_PLUGIN_ABI_MINOR);
+        dlclose(handle);
+        return NULL;
+    }
+    plugin_lib *lib = (plugin_lib*) mem_alloc(MEM_NAMES, sizeof(plugin_lib));
+    lib->path = mem_strdup(MEM_NAMES, path);
+    lib->handle = handle;
+    lib->refs = 0;
+    lib->next = libs;
+    libs = lib;
+    return lib;
+}
+
+//a library nothing is enabled from any more is closed
+static void plugin_release(plugin_lib *lib) {
+    if (lib->refs > 0) {
+        return;
+    }
+    plugin_lib **link = &libs;
+    while (*link != lib) {
+        link = &(*link)->next;
+    }
+    *link = lib->next;
+    dlclose(lib->handle);
+    mem_free(MEM_NAMES, lib->path);
+    mem_free(MEM_NAMES, lib);
+}
+
+//enable -d name
+static int plugin_disable(const char *name) {
+    plugin_builtin **link = &builtins;
+    while (*link != NULL && strcmp((*link)->name, name) != 0) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        printf("enable: %s: not a loadable builtin\n", name);
+        return -1;
+    }
+    plugin_builtin *b = *link;
+    *link = b->next;
+    names_set_loadable(name, NULL);
+    b->lib->refs--;
+    plugin_release(b->lib);
+    mem_free(MEM_NAMES, b->name);
+    mem_free(MEM_NAMES, b);
+    return 0;
+}
+
+//name from lib -> entered in the name table, 0 on success
+static int plugin_enable(plugin_lib *lib, const char *name) {
+    char symbol[NAMELEN + 16];
+
+    if (strlen(name) >= NAMELEN || name[strcspn(name, "/ \t=$")] != '\0') {
+        printf("enable: %s: invalid builtin name\n", name);
+        return -1;
+    }
+    snprintf(symbol, sizeof(symbol), "ish_builtin_%s", name);
+    for (char *p = symbol; *p != '\0'; p++) {
+        *p = *p == '-' ? '_' : *p;
+    }
+    ish_builtin_fn fn = (ish_builtin_fn) dlsym(lib->handle, symbol);
+    if (fn == NULL) {
+        printf("enable: %s: no %s in %s\n", name, symbol, lib->path);
+        return -1;
+    }
+    //taken first, the name may be the last one enabled from lib
+    lib->refs++;
+    if (names_loadable(name) != NULL) {
+        plugin_disable(name);
+    }
+
+    plugin_builtin *b = (plugin_builtin*) mem_alloc(MEM_NAMES, sizeof(plugin_builtin));
+    b->name = mem_strdup(MEM_NAMES, name);
+    b->fn = fn;
+    b->lib = lib;
+    b->calls = 0;
+    if (names_set_loadable(name, b) < 0) {
+        printf("enable: %s: is a shell builtin\n", name);
+        lib->refs--;
+        mem_free(MEM_NAMES, b->name);
+        mem_free(MEM_NAMES, b);
+        return -1;
+    }
+    b->next = builtins;
+    builtins = b;
+    return 0;
+}
+
+//enable alone
+static int plugin_list(int output_fd) {
+    FILE *fp = builtin_output(output_fd);
+    if (fp == NULL) {
+        return 1;
+    }
+    for (plugin_builtin *b = builtins; b != NULL; b = b->next) {
+        fprintf(fp, "enable -f %s %s    # %llu call(s)\n", b->lib->path, b->name, (unsigned long long) b->calls);
+    }
+    fclose(fp);
+    return 0;
+}
+
+//enable -f lib.so name..., enable -d name..., enable
+int my_shell_enable(int argc, char **argv, int output_fd) {
+    int status = 0;
+
+    if (argc == 1) {
+        return plugin_list(output_fd);
+    }
+    if (strcmp(argv[1], "-d") == 0 && argc > 2) {
+        for (int i = 2; i < argc; i++) {
+            status |= plugin_disable(argv[i]) < 0;
+        }
+        return status;
+    }
+    if (strcmp(argv[1], "-f") != 0 || argc < 4) {
+        printf("usage: enable -f lib.so name...\n       enable -d name...\n       enable\n");
+        return 2;
+    }
+
+    plugin_lib *lib = plugin_open(argv[2]);
+    if (lib == NULL) {
+        return 1;
+    }
+    for (int i = 3; i < argc; i++) {
+        status |= plugin_enable(lib, argv[i]) < 0;
+    }
+    plugin_release(lib);
+    return status;
+}
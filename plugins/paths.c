@@ -0,0 +1,69 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "ish_plugin.h"
+
+/* basename and dirname as loadable builtins.
+   make plugins
+   enable -f plugins/paths.so basename dirname
+
+   an example of the ABI in ish_plugin.h, and the kind of command a
+   script calls once per file. */
+
+ISH_PLUGIN("basename, dirname");
+
+//end of path without trailing slashes
+static size_t path_trim(const char *path) {
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
+
+//basename PATH [SUFFIX]
+int ish_builtin_basename(const ish_call *call) {
+    if (call->argc < 2 || call->argc > 3) {
+        dprintf(call->err_fd, "usage: basename PATH [SUFFIX]\n");
+        return 2;
+    }
+    const char *path = call->argv[1];
+    size_t end = path_trim(path), start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    if (start == end && end > 0) {
+        //"/" alone
+        start = end - 1;
+    }
+    if (call->argc == 3) {
+        size_t n = strlen(call->argv[2]);
+        if (n < end - start && strncmp(path + end - n, call->argv[2], n) == 0) {
+            end -= n;
+        }
+    }
+    dprintf(call->out_fd, "%.*s\n", (int) (end - start), path + start);
+    return 0;
+}
+
+//dirname PATH
+int ish_builtin_dirname(const ish_call *call) {
+    if (call->argc != 2) {
+        dprintf(call->err_fd, "usage: dirname PATH\n");
+        return 2;
+    }
+    const char *path = call->argv[1];
+    size_t end = path_trim(path);
+    while (end > 0 && path[end - 1] != '/') {
+        end--;
+    }
+    if (end == 0) {
+        dprintf(call->out_fd, ".\n");
+        return 0;
+    }
+    while (end > 1 && path[end - 1] == '/') {
+        end--;
+    }
+    dprintf(call->out_fd, "%.*s\n", (int) end, path);
+    return 0;
+}
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* prompt.
+   prompt FORMAT
+   prompt
+
+   FORMAT (ISH_PROMPT in the environment, "ish$ " when unset) takes
+   \u user  \h host  \w cwd, ~ for home  \W last part of cwd
+   \? exit status of the last command  \j jobs  \T time the last command took
+   \b branch of the git repository around cwd
+   \* '*' dirty, '.' clean, '?' not known (yet)
+   \$ '#' for root, else '$'  \\ backslash
+
+   everything but \* is at hand or one small file away. \* needs git
+   status, which a worker thread runs with a time budget: the prompt
+   shows the last result for the repository at once and is redrawn in
+   place when a different one arrives. the marker has a fixed width, so
+   a redraw leaves a half typed line where it is. prompt alone prints
+   FORMAT. */
+
+#define PROMPT_DEFAULT "ish$ "
+#define PROMPT_BUFSIZE 1024
+#define PROMPT_VCS_BUDGET_MS 1000
+#define PROMPT_VCS_CACHE 8
+
+typedef struct vcs_entry_ {
+    char root[PATH_DIR_BUFSIZE];
+    char dirty;
+    double when;
+} vcs_entry;
+
+static pthread_mutex_t vcs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vcs_wake = PTHREAD_COND_INITIALIZER;
+static int vcs_started = 0;
+static int vcs_pipe[2] = {-1, -1};//worker -> shell: a result arrived
+static char vcs_request[PATH_DIR_BUFSIZE];//root to look at, "" -> none
+static vcs_entry vcs_cache[PROMPT_VCS_CACHE];
+
+static char shown[PROMPT_BUFSIZE];//prompt on the screen, "" -> the default one
+static char host[64];
+
+static double prompt_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//dirty marker of root from the cache, '?' -> not there (under vcs_lock)
+static char vcs_cached(const char *root) {
+    for (int i = 0; i < PROMPT_VCS_CACHE; i++) {
+        if (vcs_cache[i].root[0] != '\0' && strcmp(vcs_cache[i].root, root) == 0) {
+            return vcs_cache[i].dirty;
+        }
+    }
+    return '?';
+}
+
+//(under vcs_lock) the entry of root or else the oldest one
+static void vcs_store(const char *root, char dirty) {
+    vcs_entry *e = &vcs_cache[0];
+    for (int i = 0; i < PROMPT_VCS_CACHE; i++) {
+        if (strcmp(vcs_cache[i].root, root) == 0) {
+            e = &vcs_cache[i];
+            break;
+        }
+        if (vcs_cache[i].when < e->when) {
+            e = &vcs_cache[i];
+        }
+    }
+    snprintf(e->root, sizeof(e->root), "%s", root);
+    e->dirty = dirty;
+    e->when = prompt_now();
+}
+
+//git status of root within the budget -> '*', '.' or '?'
+static char vcs_status(const char *root) {
+    static const int DEFAULT_SIGNALS[] = {SIGINT, SIGQUIT, SIGPIPE, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+    char *argv[] = {"git", "-C", (char*) root, "--no-optional-locks", "status", "--porcelain", "-uno", NULL};
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t set;
+    int out[2];
+    pid_t pid;
+
+    if (pipe2(out, O_CLOEXEC) < 0) {
+        return '?';
+    }
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_init(&attr);
+    //a group of its own, keys typed at the prompt are not for it
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&set);
+    posix_spawnattr_setsigmask(&attr, &set);
+    for (size_t i = 0; i < sizeof(DEFAULT_SIGNALS) / sizeof(DEFAULT_SIGNALS[0]); i++) {
+        sigaddset(&set, DEFAULT_SIGNALS[i]);
+    }
+    posix_spawnattr_setsigdefault(&attr, &set);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP|POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF);
+    int err = posix_spawnp(&pid, "git", &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(out[1]);
+    if (err != 0) {
+        close(out[0]);
+        return '?';
+    }
+
+    //one line of output is enough to know
+    char dirty = '?', buf[256];
+    double end = prompt_now() + PROMPT_VCS_BUDGET_MS / 1000.0;
+    while (1) {
+        int left = (end - prompt_now()) * 1000;
+        struct pollfd pfd = {out[0], POLLIN, 0};
+        if (left <= 0 || (poll(&pfd, 1, left) < 0 && errno != EINTR)) {
+            break;
+        }
+        ssize_t n = read(out[0], buf, sizeof(buf));
+        if (n > 0) {
+            dirty = '*';
+            break;
+        }
+        if (n == 0) {
+            dirty = '.';
+            break;
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            break;
+        }
+    }
+    close(out[0]);
+    if (dirty != '.') {
+        kill(pid, SIGKILL);
+    }
+    //the shell may have reaped it already (ECHILD), the output said enough then
+    int status;
+    if (waitpid(pid, &status, 0) == pid && dirty == '.' && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+        dirty = '?';
+    }
+    return dirty;
+}
+
+static void* vcs_main(void *arg) {
+    char root[PATH_DIR_BUFSIZE];
+
+    pthread_mutex_lock(&vcs_lock);
+    while (1) {
+        while (vcs_request[0] == '\0') {
+            pthread_cond_wait(&vcs_wake, &vcs_lock);
+        }
+        snprintf(root, sizeof(root), "%s", vcs_request);
+        vcs_request[0] = '\0';
+        pthread_mutex_unlock(&vcs_lock);
+
+        char dirty = vcs_status(root);
+
+        pthread_mutex_lock(&vcs_lock);
+        //a timeout keeps what was known
+        if (dirty != '?' || vcs_cached(root) == '?') {
+            vcs_store(root, dirty);
+        }
+        while (write(vcs_pipe[1], "", 1) < 0 && errno == EINTR);
+    }
+    return NULL;
+}
+
+//root of the git work tree around cwd -> root, 0 when found
+static int vcs_find(char *root, size_t size) {
+    struct stat st;
+    char path[PATH_DIR_BUFSIZE + 8];
+
+    snprintf(root, size, "%s", dirs_cwd());
+    while (1) {
+        snprintf(path, sizeof(path), "%s/.git", root);
+        if (stat(path, &st) == 0) {
+            return 0;
+        }
+        char *slash = strrchr(root, '/');
+        if (slash == NULL || slash == root) {
+            return -1;
+        }
+        *slash = '\0';
+    }
+}
+
+//.git/HEAD (or the gitdir a .git file names) -> branch, short hash when detached
+static void vcs_branch(const char *root, char *branch, size_t size) {
+    char path[2 * PATH_DIR_BUFSIZE + 16], line[PATH_DIR_BUFSIZE];
+    FILE *fp;
+
+    branch[0] = '\0';
+    snprintf(path, sizeof(path), "%s/.git", root);
+    //worktree / submodule: .git is a file "gitdir: DIR"
+    if ((fp = fopen(path, "re")) != NULL && fgets(line, sizeof(line), fp) != NULL && strncmp(line, "gitdir: ", 8) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[8] == '/') {
+            snprintf(path, sizeof(path), "%s", line + 8);
+        }
+        else {
+            snprintf(path, sizeof(path), "%s/%s", root, line + 8);
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    strncat(path, "/HEAD", sizeof(path) - strlen(path) - 1);
+    if ((fp = fopen(path, "re")) == NULL) {
+        return;
+    }
+    if (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "ref: refs/heads/", 16) == 0) {
+            snprintf(branch, size, "%s", line + 16);
+        }
+        else {
+            snprintf(branch, size, "%.7s", line);
+        }
+    }
+    fclose(fp);
+}
+
+//root wants a fresh \* from the worker
+static void vcs_ask(const char *root) {
+    pthread_mutex_lock(&vcs_lock);
+    if (!vcs_started) {
+        pthread_t thread;
+        if (pipe2(vcs_pipe, O_CLOEXEC|O_NONBLOCK) < 0 || pthread_create(&thread, NULL, vcs_main, NULL) != 0) {
+            pthread_mutex_unlock(&vcs_lock);
+            return;
+        }
+        pthread_detach(thread);
+        vcs_started = 1;
+    }
+    snprintf(vcs_request, sizeof(vcs_request), "%s", root);
+    pthread_cond_signal(&vcs_wake);
+    pthread_mutex_unlock(&vcs_lock);
+}
+
+static void append(char *out, size_t size, size_t *len, const char *s) {
+    while (*s != '\0' && *len + 1 < size) {
+        out[(*len)++] = *s++;
+    }
+    out[*len] = '\0';
+}
+
+//FORMAT -> prompt text, root of the repository when \* is in it ("" else)
+static void prompt_render(const char *format, char *out, size_t size, char *root) {
+    char buf[PATH_DIR_BUFSIZE], repo[PATH_DIR_BUFSIZE];
+    int have_repo = -1;//-1 -> not looked for yet
+    size_t len = 0;
+
+    out[0] = root[0] = '\0';
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '\\' || p[1] == '\0') {
+            buf[0] = *p;
+            buf[1] = '\0';
+            append(out, size, &len, buf);
+            continue;
+        }
+        p++;
+        buf[0] = '\0';
+        switch (*p) {
+            case 'u':
+                shell_load_user();
+                snprintf(buf, sizeof(buf), "%s", shell->cur_user[0] != '\0' ? shell->cur_user : "?");
+                break;
+            case 'h':
+                if (host[0] == '\0') {
+                    gethostname(host, sizeof(host) - 1);
+                    host[strcspn(host, ".")] = '\0';
+                }
+                snprintf(buf, sizeof(buf), "%s", host);
+                break;
+            case 'w': {
+                const char *cwd = dirs_cwd(), *home_dir = shell_home();
+                size_t home = strlen(home_dir);
+                if (home > 1 && strncmp(cwd, home_dir, home) == 0 && (cwd[home] == '/' || cwd[home] == '\0')) {
+                    snprintf(buf, sizeof(buf), "~%s", cwd + home);
+                }
+                else {
+                    snprintf(buf, sizeof(buf), "%s", cwd);
+                }
+                break;
+            }
+            case 'W': {
+                const char *cwd = dirs_cwd(), *slash = strrchr(cwd, '/');
+                snprintf(buf, sizeof(buf), "%s", slash != NULL && slash[1] != '\0' ? slash + 1 : cwd);
+                break;
+            }
+            case '?':
+                snprintf(buf, sizeof(buf), "%d", shell->last_status);
+                break;
+            case 'j':
+                snprintf(buf, sizeof(buf), "%d", count_jobs());
+                break;
+            case 'T': {
+                double t = shell->last_duration;
+                if (t < 1) {
+                    snprintf(buf, sizeof(buf), "%dms", (int) (t * 1000));
+                }
+                else if (t < 60) {
+                    snprintf(buf, sizeof(buf), "%.1fs", t);
+                }
+                else {
+                    snprintf(buf, sizeof(buf), "%dm%02ds", (int) t / 60, (int) t % 60);
+                }
+                break;
+            }
+            case 'b':
+            case '*':
+                if (have_repo < 0) {
+                    have_repo = vcs_find(repo, sizeof(repo)) == 0;
+                }
+                if (!have_repo) {
+                    break;
+                }
+                if (*p == 'b') {
+                    vcs_branch(repo, buf, sizeof(buf));
+                }
+                else {
+                    pthread_mutex_lock(&vcs_lock);
+                    buf[0] = vcs_cached(repo);
+                    buf[1] = '\0';
+                    pthread_mutex_unlock(&vcs_lock);
+                    snprintf(root, PATH_DIR_BUFSIZE, "%s", repo);
+                }
+                break;
+            case '$':
+                snprintf(buf, sizeof(buf), "%c", geteuid() == 0 ? '#' : '$');
+                break;
+            case '\\':
+                snprintf(buf, sizeof(buf), "\\");
+                break;
+            default:
+                snprintf(buf, sizeof(buf), "\\%c", *p);
+                break;
+        }
+        append(out, size, &len, buf);
+    }
+}
+
+void prompt_print() {
+    char *format = getenv("ISH_PROMPT");
+    char root[PATH_DIR_BUFSIZE];
+
+    if (format == NULL) {
+        shown[0] = '\0';
+        fputs(PROMPT_DEFAULT, stdout);
+        return;
+    }
+    prompt_render(format, shown, sizeof(shown), root);
+    fputs(shown, stdout);
+    //nothing to redraw on when input is not a terminal
+    if (root[0] != '\0' && isatty(0)) {
+        vcs_ask(root);
+    }
+}
+
+//worker results land here, -1 -> none can come
+int prompt_fd() {
+    return vcs_pipe[0];
+}
+
+//a result arrived -> the prompt redrawn in place when it changed
+void prompt_redraw() {
+    char buf[64], text[PROMPT_BUFSIZE], root[PATH_DIR_BUFSIZE];
+    char *format = getenv("ISH_PROMPT");
+
+    while (read(vcs_pipe[0], buf, sizeof(buf)) > 0);
+    if (format == NULL || shown[0] == '\0') {
+        return;
+    }
+    prompt_render(format, text, sizeof(text), root);
+    //same width -> typed characters stay where they are
+    if (strcmp(text, shown) == 0 || strlen(text) != strlen(shown)) {
+        return;
+    }
+    char *line = strrchr(text, '\n');
+    printf("\0337\r%s\0338", line != NULL ? line + 1 : text);
+    fflush(stdout);
+    snprintf(shown, sizeof(shown), "%s", text);
+}
+
+//prompt [FORMAT]
+int my_shell_prompt(int argc, char **argv) {
+    if (argc > 2) {
+        printf("usage: prompt [FORMAT]\n");
+        return 2;
+    }
+    if (argc == 1) {
+        char *format = getenv("ISH_PROMPT");
+        printf("%s\n", format != NULL ? format : PROMPT_DEFAULT);
+        return 0;
+    }
+    if (argv[1][0] == '\0') {
+        unsetenv("ISH_PROMPT");
+    }
+    else {
+        setenv("ISH_PROMPT", argv[1], 1);
+    }
+    return 0;
+}
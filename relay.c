@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "shell.h"
+
+/* relay processes owned by the shell.
+   the stream is moved between pipes and targets with tee(2)/splice(2),
+   so the data never goes through user space. */
+
+//close every fd >= 3 except keep[] (sorted)
+static void relay_close_other_fds(int *keep, int n) {
+    int low = 3;
+
+    for (int i = 0; i < n; i++) {
+        if (keep[i] >= low) {
+            if (keep[i] > low) {
+                close_range(low, keep[i] - 1, 0);
+            }
+            low = keep[i] + 1;
+        }
+    }
+    close_range(low, ~0U, 0);
+}
+
+static int compare_fd(const void *a, const void *b) {
+    return *(const int*) a - *(const int*) b;
+}
+
+//move len bytes from the pipe in -> out
+static int relay_splice_all(int in, int out, ssize_t len) {
+    while (len > 0) {
+        ssize_t n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+//in -> out[0..n-1], every round tee(2)s the buffered bytes of in into one pipe per
+//extra target, splices those to the targets and finally splices in itself to out[n-1]
+static int relay_tee_loop(int in, int *out, int n) {
+    int (*tp)[2] = malloc((n - 1) * sizeof(*tp));
+    ssize_t *got = malloc((n - 1) * sizeof(ssize_t));
+    int pipe_size = fcntl(in, F_GETPIPE_SZ);
+    int null_fd = open("/dev/null", O_WRONLY);
+
+    for (int i = 0; i < n - 1; i++) {
+        if (pipe(tp[i]) < 0) {
+            return -1;
+        }
+        fcntl(tp[i][1], F_SETPIPE_SZ, pipe_size);
+    }
+
+    while (1) {
+        ssize_t len = tee(in, tp[0][1], INT_MAX, 0);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return len;//0 -> eof
+        }
+        got[0] = len;
+        for (int i = 1; i < n - 1; i++) {
+            while ((got[i] = tee(in, tp[i][1], len, 0)) < 0 && errno == EINTR);
+            if (got[i] < 0) {
+                return -1;
+            }
+            if (got[i] < len) {
+                len = got[i];
+            }
+        }
+        for (int i = 0; i < n - 1; i++) {
+            //a short tee elsewhere -> drop the extra copy, it comes again next round
+            if (relay_splice_all(tp[i][0], out[i], len) < 0 ||
+                relay_splice_all(tp[i][0], null_fd, got[i] - len) < 0) {
+                return -1;
+            }
+        }
+        if (relay_splice_all(in, out[n - 1], len) < 0) {
+            return -1;
+        }
+    }
+}
+
+//out_fds[0..n-1] -> write end of a pipe whose stream the relay copies to every target
+int relay_tee_start(int *out_fds, int n, pid_t *relay_pid) {
+    int fd[2];
+
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int *keep = malloc((n + 1) * sizeof(int));
+        memcpy(keep, out_fds, n * sizeof(int));
+        keep[n] = fd[0];
+        qsort(keep, n + 1, sizeof(int), compare_fd);
+        relay_close_other_fds(keep, n + 1);
+
+        //splice(2) refuses O_APPEND files, the relay is the only writer anyway
+        for (int i = 0; i < n; i++) {
+            int flags = fcntl(out_fds[i], F_GETFL);
+            if (flags & O_APPEND) {
+                fcntl(out_fds[i], F_SETFL, flags & ~O_APPEND);
+                lseek(out_fds[i], 0, SEEK_END);
+            }
+        }
+        _exit(relay_tee_loop(fd[0], out_fds, n) < 0 ? 1 : 0);
+    }
+
+    close(fd[0]);
+    *relay_pid = pid;
+    return fd[1];
+}
+
+static double relay_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//block until fd is ready for events, returns the seconds spent
+static double relay_wait(int fd, short events) {
+    struct pollfd pfd = {fd, events, 0};
+    double t = relay_now();
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    return relay_now() - t;
+}
+
+//in -> out with splice(2), counting bytes and the time spent waiting on either side
+static void relay_meter_loop(int in, int out, char *from, char *to) {
+    long long bytes = 0;
+    double wait_in = 0, wait_out = 0;
+    double start = relay_now();
+
+    while (1) {
+        ssize_t n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            bytes += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            break;//eof or the consumer is gone
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        //nothing buffered -> waiting on the producer, else the consumer is full
+        struct pollfd pfd = {in, POLLIN, 0};
+        if (poll(&pfd, 1, 0) == 0) {
+            wait_in += relay_wait(in, POLLIN);
+        }
+        else {
+            struct pollfd ofd = {out, POLLOUT, 0};
+            if (poll(&ofd, 1, 0) > 0 && (ofd.revents & (POLLERR|POLLHUP))) {
+                break;
+            }
+            wait_out += relay_wait(out, POLLOUT);
+        }
+    }
+
+    double elapsed = relay_now() - start;
+    double mb = bytes / 1e6;
+    char report[512];
+    int len = snprintf(report, sizeof(report),
+        "pipemeter: %s -> %s: %.1f MB in %.2fs (%.1f MB/s), waited %.2fs on producer, %.2fs on consumer (%s-bound)\n",
+        from, to, mb, elapsed, elapsed > 0 ? mb / elapsed : 0, wait_in, wait_out,
+        wait_in >= wait_out ? "producer" : "consumer");
+    write(2, report, len);
+}
+
+//read end of a pipe -> read end of a new pipe, a relay in between meters the stream
+int relay_meter_start(int in_fd, char *from, char *to, pid_t *relay_pid) {
+    int fd[2];
+
+    if (pipe2(fd, O_CLOEXEC) < 0) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        int keep[2] = {in_fd < fd[1] ? in_fd : fd[1], in_fd < fd[1] ? fd[1] : in_fd};
+        relay_close_other_fds(keep, 2);
+        relay_meter_loop(in_fd, fd[1], from, to);
+        _exit(0);
+    }
+
+    close(in_fd);
+    close(fd[1]);
+    *relay_pid = pid;
+    return fd[0];
+}
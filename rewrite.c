@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* pipeline rewrites before launch.
+   set -o explain
+
+   generated pipelines are full of stages which only copy bytes. the
+   rules below drop them from the process list before anything forks:
+
+   cat-input        cat FILE | cmd  ->  cmd < FILE   (also cat < FILE | cmd, cat <<EOF | cmd)
+   cat-passthrough  a | cat | b     ->  a | b        (also cat | b, a | cat > out)
+
+   a trailing cat is kept when stdout is a terminal, commands like ls
+   format differently for one. a leading cat is kept when stdin is one,
+   cat | cmd is how cmd is kept off the terminal. only a regular file
+   becomes < FILE. a builtin left alone by the rules runs in the shell
+   without a fork (cat f | grep x  ->  grep x < f on a mapped file).
+   with explain on, jobs are not run: the rewritten plan is printed with
+   where each stage would run. stats counts the rules applied and the
+   forks they saved. */
+
+typedef struct rewrite_rule_ {
+    const char *name;
+    const char *pattern;//as explain prints it
+    int (*apply)(job *job_tmp, process **link);//1 -> the stage at *link was rewritten
+    uint64_t hits;
+} rewrite_rule;
+
+static int is_cat(process *proc) {
+    return proc->process_argc > 0 && strcmp(proc->argument_list[0], "cat") == 0 &&
+           proc->process_type == COMMAND_ETC && proc->fd_redirects == NULL;
+}
+
+//*link -> the stage after it
+static void drop_stage(process **link) {
+    process *proc = *link;
+    *link = proc->next;
+    proc->next = NULL;
+    destroy_process(proc);
+}
+
+//cat FILE | cmd, cat < FILE | cmd -> cmd < FILE
+static int rule_cat_input(job *job_tmp, process **link) {
+    process *proc = *link, *next = proc->next;
+    char *file;
+
+    if (link != &job_tmp->process_list || next == NULL || !is_cat(proc) ||
+        proc->output_redirection != NULL || next->input_redirection != NULL || next->heredoc != NULL) {
+        return 0;
+    }
+    //cat <<EOF | cmd -> cmd <<EOF
+    if (proc->process_argc == 1 && proc->heredoc != NULL) {
+        for (fd_redirect *r = next->fd_redirects; r != NULL; r = r->next) {
+            if (r->fd == 0) {
+                return 0;
+            }
+        }
+        next->heredoc = proc->heredoc;
+        proc->heredoc = NULL;
+        drop_stage(link);
+        return 1;
+    }
+    if (proc->process_argc == 2 && proc->input_redirection == NULL && proc->argument_list[1][0] != '-') {
+        file = proc->argument_list[1];
+    }
+    else if (proc->process_argc == 1 && proc->input_redirection != NULL) {
+        file = proc->input_redirection;
+    }
+    else {
+        return 0;
+    }
+    //a missing file or a directory keeps cat, its message and cmd running on empty input
+    struct stat st;
+    if (stat(file, &st) < 0 || !S_ISREG(st.st_mode) || access(file, R_OK) < 0) {
+        return 0;
+    }
+    //<&N on cmd would win over the file
+    for (fd_redirect *r = next->fd_redirects; r != NULL; r = r->next) {
+        if (r->fd == 0) {
+            return 0;
+        }
+    }
+    next->input_redirection = mem_strdup(MEM_JOBS, file);
+    drop_stage(link);
+    return 1;
+}
+
+//a | cat | b -> a | b, cat | b -> b, a | cat > out -> a > out
+static int rule_cat_passthrough(job *job_tmp, process **link) {
+    process *proc = *link;
+
+    if (job_tmp->process_list->next == NULL || !is_cat(proc) || proc->process_argc != 1 ||
+        proc->input_redirection != NULL || proc->heredoc != NULL) {
+        return 0;
+    }
+    //cat | b on a terminal -> b must not see the terminal (python3, less ...)
+    if (link == &job_tmp->process_list && isatty(0)) {
+        return 0;
+    }
+    if (proc->next == NULL) {
+        process *prev = job_tmp->process_list;
+        while (prev->next != proc) {
+            prev = prev->next;
+        }
+        if ((proc->output_redirection == NULL && isatty(1)) || prev->output_redirection != NULL) {
+            return 0;
+        }
+        prev->output_redirection = proc->output_redirection;
+        prev->output_option = proc->output_option;
+        prev->more_outputs = proc->more_outputs;
+        proc->output_redirection = NULL;
+        proc->more_outputs = NULL;
+    }
+    else if (proc->output_redirection != NULL) {
+        return 0;
+    }
+    drop_stage(link);
+    return 1;
+}
+
+static rewrite_rule RULES[] = {
+    {"cat-input", "cat FILE | cmd -> cmd < FILE", rule_cat_input, 0},
+    {"cat-passthrough", "a | cat | b -> a | b", rule_cat_passthrough, 0},
+};
+#define NRULES (sizeof(RULES) / sizeof(RULES[0]))
+
+//where the stage would run: in the shell, on a shell thread or in a child
+static const char* rewrite_stage_kind(job *job_tmp, process *proc) {
+    int single = job_tmp->process_list->next == NULL;
+    int here = job_tmp->mode == FOREGROUND && job_tmp->timeout == 0;
+
+    //2>file, 3>&1 ... -> only a child applies them
+    if (command_runs_as_job(proc->process_type) && fds_other(proc)) {
+        return "fork";
+    }
+    switch (proc->process_type) {
+        case ECHO_COMMAND:
+            if (single) {
+                return job_tmp->mode == FOREGROUND ? "shell" : "fork";
+            }
+            return here ? "thread" : "fork";
+        case FILTER_COMMAND:
+            if (single) {
+                return here && (proc->input_redirection != NULL || proc->heredoc != NULL) ? "shell" : "fork";
+            }
+            //the first stage would read the terminal
+            if (here && (proc != job_tmp->process_list || proc->input_redirection != NULL || proc->heredoc != NULL) &&
+                filter_supported(proc->process_argc, proc->argument_list)) {
+                return "thread";
+            }
+            return "fork";
+        case FIND_COMMAND:
+            return here && proc->next == NULL ? "shell" : "fork";
+        case PLUGIN_COMMAND:
+            if (single) {
+                return here ? "shell" : "fork";
+            }
+            return here && (proc != job_tmp->process_list || proc->input_redirection != NULL || proc->heredoc != NULL) ? "thread" : "fork";
+        case COMMAND_ETC:
+            return "fork";
+        default:
+            return "shell";
+    }
+}
+
+static void explain_stage(job *job_tmp, process *proc, int n) {
+    printf("  %d: ", n);
+    for (int i = 0; i < proc->process_argc; i++) {
+        printf("%s%s", i > 0 ? " " : "", proc->argument_list[i]);
+    }
+    if (proc->input_redirection != NULL) {
+        printf(" < %s", proc->input_redirection);
+    }
+    if (proc->heredoc != NULL) {
+        printf(" <<(%zu bytes)", strlen(proc->heredoc));
+    }
+    if (proc->output_redirection != NULL) {
+        printf(" %s %s", proc->output_option == APPEND ? ">>" : ">", proc->output_redirection);
+    }
+    for (output_target *out = proc->more_outputs; out != NULL; out = out->next) {
+        printf(" %s %s", out->option == APPEND ? ">>" : ">", out->path);
+    }
+    for (fd_redirect *r = proc->fd_redirects; r != NULL; r = r->next) {
+        if (r->action == REDIR_CLOSE) {
+            printf(" %d>&-", r->fd);
+        }
+        else if (r->action == REDIR_DUP) {
+            printf(" %d>&%d", r->fd, r->source);
+        }
+        else {
+            printf(" %d%s %s", r->fd, r->action == REDIR_READ ? "<" : (r->action == REDIR_APPEND ? ">>" : ">"), r->path);
+        }
+    }
+    printf("    [%s]\n", rewrite_stage_kind(job_tmp, proc));
+}
+
+//rules over job until none applies -> 1 when explain took the job instead of running it
+int rewrite_job(job *job_tmp) {
+    int explain = (shell->options & OPTION_EXPLAIN) && command_runs_as_job(job_tmp->process_list->process_type);
+    int applied[NRULES] = {0}, removed = 0;
+
+    //a rule may drop the stage at *link (the last one too) -> scan again from the start
+    for (int changed = 1; changed; ) {
+        changed = 0;
+        process **link = &job_tmp->process_list;
+        while (*link != NULL && !changed) {
+            for (size_t i = 0; i < NRULES && !changed; i++) {
+                if (RULES[i].apply(job_tmp, link)) {
+                    applied[i]++;
+                    removed++;
+                    changed = 1;
+                }
+            }
+            if (!changed) {
+                link = &(*link)->next;
+            }
+        }
+    }
+
+    if (!explain) {
+        for (size_t i = 0; i < NRULES; i++) {
+            RULES[i].hits += applied[i];
+            for (int n = 0; n < applied[i]; n++) {
+                metrics_count(METRIC_REWRITES);
+            }
+        }
+        for (int n = 0; n < removed; n++) {
+            metrics_count(METRIC_FORKS_SAVED);
+        }
+        return 0;
+    }
+
+    printf("explain: %s\n", job_tmp->job_command);
+    for (size_t i = 0; i < NRULES; i++) {
+        if (applied[i] > 0) {
+            printf("  rule %-16s %-32s x%d\n", RULES[i].name, RULES[i].pattern, applied[i]);
+        }
+    }
+    int n = 1;
+    for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        explain_stage(job_tmp, proc, n++);
+    }
+    if (removed > 0) {
+        printf("  saved %d fork(s) and %d pipe(s)\n", removed, removed);
+    }
+    return 1;
+}
+
+//hits of each rule for the stats --prometheus text
+void rewrite_format_prometheus(FILE *fp) {
+    fprintf(fp, "# HELP ish_rewrite_rule_hits_total Times each pipeline rewrite rule was applied.\n"
+            "# TYPE ish_rewrite_rule_hits_total counter\n");
+    for (size_t i = 0; i < NRULES; i++) {
+        fprintf(fp, "ish_rewrite_rule_hits_total{rule=\"%s\"} %llu\n", RULES[i].name, (unsigned long long) RULES[i].hits);
+    }
+}
@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* ish FILE
+   ish -c COMMANDS
+   the script is compiled once into bytecode and cached next to it in
+   FILE.ishc, keyed on the hash of the script and the shell binary
+   (inode and mtime of /proc/self/exe, so a rebuilt parser never reads
+   code compiled by an older one).
+   later runs mmap the cache and execute it without parsing any line,
+   here-document bodies are kept in the code. a cache is used only when
+   it is owned by the user running it and nobody else can write it, and
+   its code is checked against its size before the first job runs: the
+   hash says which script it belongs to, not who wrote it. ish -c
+   COMMANDS compiles its lines the same way and runs them without a
+   cache. */
+
+#define SCRIPT_MAGIC "ISHC"
+#define SCRIPT_FORMAT 4
+
+#define OP_END 0
+#define OP_JOB 1//u8 mode, str command, u16 nproc, proc...
+
+typedef struct script_header_ {
+    char magic[4];
+    uint32_t format;
+    uint64_t hash;//fnv-1a of the script
+    uint64_t code_size;
+    uint64_t build_ino;//of the shell binary that compiled it
+    uint64_t build_mtime;//ns
+} script_header;
+
+typedef struct code_buffer_ {
+    char *data;
+    size_t len;
+    size_t cap;
+} code_buffer;
+
+static uint64_t script_hash(const char *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void emit(code_buffer *code, const void *data, size_t len) {
+    if (code->len + len > code->cap) {
+        code->cap = (code->len + len) * 2 + 256;
+        code->data = realloc(code->data, code->cap);
+    }
+    memcpy(code->data + code->len, data, len);
+    code->len += len;
+}
+
+static void emit_u8(code_buffer *code, uint8_t v) {
+    emit(code, &v, sizeof(v));
+}
+
+static void emit_u16(code_buffer *code, uint16_t v) {
+    emit(code, &v, sizeof(v));
+}
+
+//u32 length (0xffffffff -> NULL), bytes, '\0'
+static void emit_str(code_buffer *code, const char *s) {
+    uint32_t len = s != NULL ? strlen(s) : 0xffffffff;
+    emit(code, &len, sizeof(len));
+    if (s != NULL) {
+        emit(code, s, len + 1);
+    }
+}
+
+//bytes after pc, no fetch goes past end
+typedef struct code_reader_ {
+    const char *pc;
+    const char *end;
+    int bad;//ran past the end or read a field out of range
+} code_reader;
+
+static void fetch(code_reader *r, void *v, size_t len) {
+    if (r->bad || (size_t) (r->end - r->pc) < len) {
+        r->bad = 1;
+        memset(v, 0, len);
+        return;
+    }
+    memcpy(v, r->pc, len);
+    r->pc += len;
+}
+
+static uint8_t fetch_u8(code_reader *r) {
+    uint8_t v;
+    fetch(r, &v, sizeof(v));
+    return v;
+}
+
+static uint16_t fetch_u16(code_reader *r) {
+    uint16_t v;
+    fetch(r, &v, sizeof(v));
+    return v;
+}
+
+//len bytes and their '\0' -> copy, NULL when they are not all there
+static char* fetch_bytes(code_reader *r, size_t len) {
+    if (r->bad || (size_t) (r->end - r->pc) <= len) {
+        r->bad = 1;
+        return NULL;
+    }
+    char *s = mem_strndup(MEM_JOBS, r->pc, len);
+    r->pc += len + 1;
+    return s;
+}
+
+static char* fetch_str(code_reader *r) {
+    uint32_t len;
+    fetch(r, &len, sizeof(len));
+    return len == 0xffffffff || r->bad ? NULL : fetch_bytes(r, len);
+}
+
+//job -> OP_JOB
+static void compile_job(code_buffer *code, job *job_tmp) {
+    process *proc;
+    int nproc = 0;
+
+    for (proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        nproc++;
+    }
+    emit_u8(code, OP_JOB);
+    emit_u8(code, job_tmp->mode);
+    emit_str(code, job_tmp->job_command);
+    emit_u16(code, nproc);
+
+    for (proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        emit_str(code, proc->program_name);
+        emit_u16(code, proc->process_argc);
+        for (int i = 0; i < proc->process_argc; i++) {
+            emit_str(code, proc->argument_list[i]);
+        }
+        emit_str(code, proc->input_redirection);
+        emit_str(code, proc->heredoc);
+        emit_u8(code, proc->output_option);
+        emit_str(code, proc->output_redirection);
+
+        int nout = 0;
+        output_target *out;
+        for (out = proc->more_outputs; out != NULL; out = out->next) {
+            nout++;
+        }
+        emit_u16(code, nout);
+        for (out = proc->more_outputs; out != NULL; out = out->next) {
+            emit_u8(code, out->option);
+            emit_str(code, out->path);
+        }
+
+        int nfd = 0;
+        fd_redirect *r;
+        for (r = proc->fd_redirects; r != NULL; r = r->next) {
+            nfd++;
+        }
+        emit_u16(code, nfd);
+        for (r = proc->fd_redirects; r != NULL; r = r->next) {
+            emit_u8(code, r->fd);
+            emit_u8(code, r->action);
+            emit_u8(code, r->source);
+            emit_str(code, r->path);
+        }
+    }
+}
+
+//OP_JOB operands -> job, r->bad -> a job which is only fit for destroy_job
+static job* load_job(code_reader *r) {
+    job *job_tmp = (job*) mem_alloc(MEM_JOBS, sizeof(job));
+    job_tmp->mode = fetch_u8(r);
+    job_tmp->job_command = fetch_str(r);
+    job_tmp->pgid = -1;
+    job_tmp->notify = 1;
+    job_tmp->timeout = 0;
+    job_tmp->timed_out = 0;
+    job_tmp->cpu_list = NULL;
+    job_tmp->niceness_set = 0;
+    job_tmp->token = JOBSERVER_NONE;
+    r->bad |= job_tmp->mode != FOREGROUND && job_tmp->mode != BACKGROUND;
+
+    int nproc = fetch_u16(r);
+    r->bad |= nproc == 0;
+    process **tail = &job_tmp->process_list;
+    for (int n = 0; n < nproc && !r->bad; n++) {
+        process *proc = (process*) mem_alloc(MEM_JOBS, sizeof(process));
+        proc->program_name = fetch_str(r);
+        int argc = fetch_u16(r);
+        proc->argument_list = (char**) mem_alloc(MEM_JOBS, (argc + 1) * sizeof(char*));
+        //argv ends at the first NULL, destroy_process frees up to there
+        proc->process_argc = 0;
+        while (proc->process_argc < argc && (proc->argument_list[proc->process_argc] = fetch_str(r)) != NULL) {
+            proc->process_argc++;
+        }
+        proc->argument_list[proc->process_argc] = NULL;
+        r->bad |= proc->process_argc == 0 || proc->process_argc < argc;
+        proc->input_redirection = fetch_str(r);
+        proc->heredoc = fetch_str(r);
+        proc->heredoc_end = NULL;
+        proc->heredoc_tabs = 0;
+        proc->output_option = fetch_u8(r);
+        proc->output_redirection = fetch_str(r);
+        r->bad |= proc->output_option != TRUNC && proc->output_option != APPEND;
+
+        int nout = fetch_u16(r);
+        output_target **out_tail = &proc->more_outputs;
+        for (int i = 0; i < nout && !r->bad; i++) {
+            output_target *out = (output_target*) mem_alloc(MEM_JOBS, sizeof(output_target));
+            out->option = fetch_u8(r);
+            out->path = fetch_str(r);
+            r->bad |= out->path == NULL || (out->option != TRUNC && out->option != APPEND);
+            *out_tail = out;
+            out_tail = &out->next;
+        }
+        *out_tail = NULL;
+
+        int nfd = fetch_u16(r);
+        fd_redirect **fd_tail = &proc->fd_redirects;
+        for (int i = 0; i < nfd && !r->bad; i++) {
+            fd_redirect *fr = (fd_redirect*) mem_alloc(MEM_JOBS, sizeof(fd_redirect));
+            fr->fd = fetch_u8(r);
+            fr->action = fetch_u8(r);
+            fr->source = fetch_u8(r);
+            fr->path = fetch_str(r);
+            //0-9, and a path exactly for the actions which open one
+            r->bad |= fr->fd > 9 || fr->source > 9 || fr->action > REDIR_SYNTAX ||
+                      (fr->path != NULL) != (fr->action <= REDIR_APPEND || fr->action == REDIR_SYNTAX);
+            *fd_tail = fr;
+            fd_tail = &fr->next;
+        }
+        *fd_tail = NULL;
+
+        proc->pid = -1;
+        proc->threaded = 0;
+        proc->exit_status = 0;
+        proc->process_type = r->bad ? COMMAND_ETC : get_command_type(proc->argument_list[0]);
+        *tail = proc;
+        tail = &proc->next;
+    }
+    *tail = NULL;
+    return job_tmp;
+}
+
+//script text -> bytecode
+static void compile_script(code_buffer *code, const char *text, size_t size) {
+    const char *p = text;
+    const char *end = text + size;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t len = (nl != NULL ? nl : end) - p;
+        char *line = strndup(p, len);
+        p += len + 1;
+
+        char *hd = line + strspn(line, TOKEN_SEPARATION);
+        if (*hd != '\0' && *hd != '#') {
+            job *job_tmp = my_shell_parse_command(hd);
+            //cmd <<EOF -> the lines up to EOF go into the code as its body
+            heredoc_text rest = {p, end};
+            heredoc_collect(job_tmp, heredoc_text_line, &rest);
+            p = rest.p;
+            compile_job(code, job_tmp);
+            destroy_job(job_tmp);
+        }
+        free(line);
+    }
+    emit_u8(code, OP_END);
+}
+
+//bytecode of size bytes -> 0 when every job in it loads within bounds and it ends in OP_END
+static int script_verify(const char *code, size_t size) {
+    code_reader r = {code, code + size, 0};
+
+    while (1) {
+        uint8_t op = fetch_u8(&r);
+        if (r.bad || op != OP_JOB) {
+            return !r.bad && op == OP_END ? 0 : -1;
+        }
+        destroy_job(load_job(&r));
+        if (r.bad) {
+            return -1;
+        }
+    }
+}
+
+//verified bytecode -> run every job, stop with status 1 at code which does not load
+static int script_execute(const char *code, size_t size) {
+    code_reader r = {code, code + size, 0};
+    uint8_t op;
+
+    while ((op = fetch_u8(&r)) == OP_JOB) {
+        job *job_tmp = load_job(&r);
+        if (r.bad) {
+            destroy_job(job_tmp);
+            break;
+        }
+        my_shell_launch_job(job_tmp);
+    }
+    if (r.bad || op != OP_END) {
+        printf("ish: bad script code at byte %zu\n", (size_t) (r.pc - code));
+        return shell->last_status = 1;
+    }
+    return shell->last_status;
+}
+
+//inode and mtime of the running shell binary -> hdr, -1 when it cannot be told
+static int script_build(script_header *hdr) {
+    struct stat st;
+    if (stat("/proc/self/exe", &st) < 0) {
+        return -1;
+    }
+    hdr->build_ino = st.st_ino;
+    hdr->build_mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+//FILE.ishc -> mapped header + code if it belongs to this script and build
+static char* script_map_cache(char *cache_path, uint64_t hash, size_t *map_size) {
+    script_header build;
+    if (script_build(&build) < 0) {
+        return NULL;
+    }
+    int fd = open(cache_path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    //a cache somebody else could have written is compiled again
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP|S_IWOTH)) ||
+        st.st_size < (off_t) sizeof(script_header)) {
+        close(fd);
+        return NULL;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    script_header hdr;
+    memcpy(&hdr, map, sizeof(hdr));
+    if (memcmp(hdr.magic, SCRIPT_MAGIC, sizeof(hdr.magic)) != 0 || hdr.format != SCRIPT_FORMAT ||
+        hdr.hash != hash || hdr.build_ino != build.build_ino || hdr.build_mtime != build.build_mtime ||
+        hdr.code_size != st.st_size - sizeof(hdr) || script_verify(map + sizeof(hdr), hdr.code_size) < 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *map_size = st.st_size;
+    return map;
+}
+
+//bytecode -> FILE.ishc (tmp + rename, skipped when the directory is read only)
+static void script_write_cache(char *cache_path, uint64_t hash, code_buffer *code) {
+    script_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (script_build(&hdr) < 0) {
+        return;
+    }
+
+    char tmp[PATH_DIR_BUFSIZE + 16];
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cache_path);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    memcpy(hdr.magic, SCRIPT_MAGIC, sizeof(hdr.magic));
+    hdr.format = SCRIPT_FORMAT;
+    hdr.hash = hash;
+    hdr.code_size = code->len;
+
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, code->data, code->len) != (ssize_t) code->len ||
+        close(fd) < 0 || rename(tmp, cache_path) < 0) {
+        unlink(tmp);
+    }
+}
+
+//ish -c COMMANDS: compiled the same way, nothing cached
+int my_shell_script_text(const char *text) {
+    code_buffer code = {NULL, 0, 0};
+    compile_script(&code, text, strlen(text));
+    int status = script_execute(code.data, code.len);
+    free(code.data);
+    return status;
+}
+
+//ish FILE
+int my_shell_script(char *path) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        printf("ish: %s: no such file or directory\n", path);
+        return 127;
+    }
+
+    char *text = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (text == MAP_FAILED) {
+        printf("ish: %s: cannot read\n", path);
+        return 126;
+    }
+    uint64_t hash = script_hash(text, st.st_size);
+
+    char cache_path[PATH_DIR_BUFSIZE];
+    snprintf(cache_path, sizeof(cache_path), "%s.ishc", path);
+
+    int status;
+    size_t map_size;
+    char *map = script_map_cache(cache_path, hash, &map_size);
+    if (map != NULL) {
+        if (st.st_size > 0) {
+            munmap(text, st.st_size);
+        }
+        status = script_execute(map + sizeof(script_header), map_size - sizeof(script_header));
+        munmap(map, map_size);
+        return status;
+    }
+
+    code_buffer code = {NULL, 0, 0};
+    compile_script(&code, text, st.st_size);
+    if (st.st_size > 0) {
+        munmap(text, st.st_size);
+    }
+    script_write_cache(cache_path, hash, &code);
+
+    status = script_execute(code.data, code.len);
+    free(code.data);
+    return status;
+}
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shell.h"
+
+/* session record / replay.
+   ish --record FILE
+   ish --replay FILE [--speed N | --max]
+
+   recording logs every command line with the time it was entered, then
+   the mode, process count, exit status and duration of the job it made.
+   replay feeds the lines through the normal parse/launch path, paced like
+   the session (N times faster with --speed, back to back with --max), and
+   reports the duration of every command against the recorded one on stderr. */
+
+#define SESSION_MAGIC "ISHR"
+#define SESSION_FORMAT 1
+
+#define REC_INPUT 1//u8 type, u64 at_ns, u32 len, line
+#define REC_RESULT 2//u8 type, u64 duration_ns, i32 status, u8 mode, u16 nproc
+
+typedef struct session_header_ {
+    char magic[4];
+    uint32_t format;
+    uint64_t start_ns;//unix time
+    char cwd[PATH_DIR_BUFSIZE];
+} session_header;
+
+static int record_fd = -1;
+static double record_start;
+
+static int session_write(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(record_fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+//ish --record FILE
+int session_record_open(char *path) {
+    record_fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (record_fd < 0) {
+        printf("ish: %s: cannot create\n", path);
+        return -1;
+    }
+
+    session_header hdr;
+    struct timespec ts;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SESSION_MAGIC, sizeof(hdr.magic));
+    hdr.format = SESSION_FORMAT;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    hdr.start_ns = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if (getcwd(hdr.cwd, sizeof(hdr.cwd)) == NULL) {
+        hdr.cwd[0] = '\0';
+    }
+    record_start = metrics_now();
+    return session_write((char*) &hdr, sizeof(hdr));
+}
+
+int session_recording() {
+    return record_fd >= 0;
+}
+
+void session_record_input(char *line) {
+    if (record_fd < 0) {
+        return;
+    }
+    uint32_t len = strlen(line);
+    uint64_t at = (uint64_t) ((metrics_now() - record_start) * 1e9);
+    char *buf = malloc(1 + sizeof(at) + sizeof(len) + len);
+    buf[0] = REC_INPUT;
+    memcpy(buf + 1, &at, sizeof(at));
+    memcpy(buf + 1 + sizeof(at), &len, sizeof(len));
+    memcpy(buf + 1 + sizeof(at) + sizeof(len), line, len);
+    session_write(buf, 1 + sizeof(at) + sizeof(len) + len);
+    free(buf);
+}
+
+void session_record_result(double seconds, int status, int mode, int nproc) {
+    if (record_fd < 0) {
+        return;
+    }
+    char buf[1 + 8 + 4 + 1 + 2];
+    uint64_t ns = (uint64_t) (seconds * 1e9);
+    int32_t st = status;
+    uint16_t np = nproc;
+    buf[0] = REC_RESULT;
+    memcpy(buf + 1, &ns, sizeof(ns));
+    memcpy(buf + 9, &st, sizeof(st));
+    buf[13] = mode;
+    memcpy(buf + 14, &np, sizeof(np));
+    session_write(buf, sizeof(buf));
+}
+
+static void sleep_until(double when) {
+    double left = when - metrics_now();
+    if (left <= 0) {
+        return;
+    }
+    struct timespec ts = {(time_t) left, (long) ((left - (time_t) left) * 1e9)};
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+//line -> job through the normal path, its duration in seconds
+static double replay_command(char *line) {
+    double start = metrics_now();
+    //cmd <<EOF was recorded with its body on the lines after it
+    size_t len = strcspn(line, "\n");
+    char *copy = strndup(line, len);
+    job *job_tmp = my_shell_parse_command(copy);
+    free(copy);
+    heredoc_text rest = {line + len + (line[len] != '\0'), line + strlen(line)};
+    heredoc_collect(job_tmp, heredoc_text_line, &rest);
+    metrics_observe(METRIC_HIST_PARSE, metrics_now() - start);
+    my_shell_launch_job(job_tmp);
+    return metrics_now() - start;
+}
+
+//ish --replay FILE [--speed N | --max]
+int session_replay(int argc, char **argv) {
+    double speed = 1;
+    int max = 0;
+
+    if (argc < 2) {
+        printf("usage: ish --replay FILE [--speed N | --max]\n");
+        return 2;
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--max") == 0) {
+            max = 1;
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0) {
+            speed = atof(argv[++i]);
+        }
+        else {
+            printf("usage: ish --replay FILE [--speed N | --max]\n");
+            return 2;
+        }
+    }
+
+    int fd = open(argv[1], O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(session_header)) {
+        printf("ish: %s: not a session log\n", argv[1]);
+        return 2;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    session_header hdr;
+    if (map == MAP_FAILED || (memcpy(&hdr, map, sizeof(hdr)), memcmp(hdr.magic, SESSION_MAGIC, 4) != 0) ||
+        hdr.format != SESSION_FORMAT) {
+        printf("ish: %s: not a session log\n", argv[1]);
+        return 2;
+    }
+    //the session started there, relative paths should mean the same
+    if (hdr.cwd[0] != '\0' && chdir(hdr.cwd) < 0) {
+        fprintf(stderr, "replay: %.*s: cannot cd, staying here\n", (int) sizeof(hdr.cwd), hdr.cwd);
+    }
+
+    const char *p = map + sizeof(hdr), *end = map + st.st_size;
+    double start = metrics_now();
+    double total_rec = 0, total_now = 0;
+    int commands = 0, compared = 0, mismatches = 0;
+    char *line = NULL;
+    double now_seconds = 0;
+    int now_status = 0;
+
+    while (p < end) {
+        int type = *p++;
+        if (type == REC_INPUT && end - p >= 12) {
+            uint64_t at;
+            uint32_t len;
+            memcpy(&at, p, sizeof(at));
+            memcpy(&len, p + 8, sizeof(len));
+            p += 12;
+            if (len > (size_t) (end - p)) {
+                break;
+            }
+            free(line);
+            line = strndup(p, len);
+            p += len;
+
+            char *copy = strndup(line, strcspn(line, "\n"));
+            job *probe = my_shell_parse_command(copy);
+            free(copy);
+            int is_exit = probe->process_list->process_type == EXIT_COMMAND;
+            destroy_job(probe);
+            if (is_exit) {
+                break;
+            }
+            if (!max) {
+                sleep_until(start + at / 1e9 / speed);
+            }
+            now_seconds = replay_command(line);
+            now_status = shell->last_status;
+            commands++;
+        }
+        else if (type == REC_RESULT && end - p >= 15 && line != NULL) {
+            uint64_t ns;
+            int32_t status;
+            memcpy(&ns, p, sizeof(ns));
+            memcpy(&status, p + 8, sizeof(status));
+            p += 15;
+
+            double rec = ns / 1e9;
+            total_rec += rec;
+            total_now += now_seconds;
+            compared++;
+            fprintf(stderr, "replay: #%-4d rec %10.3fms  now %10.3fms  %+7.1f%%  %.*s", commands, rec * 1e3,
+                    now_seconds * 1e3, rec > 0 ? (now_seconds - rec) / rec * 100 : 0, (int) strcspn(line, "\n"), line);
+            if (status != now_status) {
+                fprintf(stderr, "  [status %d -> %d]", status, now_status);
+                mismatches++;
+            }
+            fprintf(stderr, "\n");
+            free(line);
+            line = NULL;
+        }
+        else {
+            break;//truncated log
+        }
+    }
+    free(line);
+    munmap(map, st.st_size);
+
+    fprintf(stderr, "replay: %d commands, %d compared, rec %.3fms, now %.3fms (%+.1f%%), %d status mismatches\n",
+            commands, compared, total_rec * 1e3, total_now * 1e3,
+            total_rec > 0 ? (total_now - total_rec) / total_rec * 100 : 0, mismatches);
+    return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+#ifndef __SHELL_H__
+#define __SHELL_H__
+#include "parse.h"
+
+#define ISH_VERSION "0.2"
+#define MAX_JOBS_ID 16
+
+#define STATUS_PROC_RUNNING 0
+#define STATUS_PROC_SUSPENDED 1
+#define STATUS_PROC_CONTINUED 2
+#define STATUS_PROC_TERMINATED 3
+#define STATUS_PROC_DONE 4
+
+//set -o, bit i <-> SHELL_OPTION_NAME[i]
+#define OPTION_PIPEMETER (1 << 0)
+#define OPTION_PINPIPES (1 << 1)
+#define OPTION_EXPLAIN (1 << 2)
+
+//metrics.c counters and histograms
+#define METRIC_JOBS_LAUNCHED 0
+#define METRIC_JOBS_COMPLETED 1
+#define METRIC_FORKS 2
+#define METRIC_BUILTINS 3
+#define METRIC_EXEC_FAILURES 4
+#define METRIC_REWRITES 5
+#define METRIC_FORKS_SAVED 6
+#define METRIC_COUNTERS 7
+
+#define METRIC_HIST_PARSE 0
+#define METRIC_HIST_SPAWN 1
+#define METRIC_HIST_JOB 2
+#define METRIC_HIST_REAP 3
+#define METRIC_HISTOGRAMS 4
+
+//memstat.c pools
+#define MEM_LINE 0//command lines read by the shell
+#define MEM_PARSER 1//scratch of the parser
+#define MEM_JOBS 2//job and process trees
+#define MEM_STAGES 3//argv copies of stage threads
+#define MEM_CACHE 4
+#define MEM_NAMES 5//name table, alias and function templates
+#define MEM_DIRS 6//pushd stack
+#define MEM_POOLS 7
+
+struct shell_information{
+    char cur_user[TOKEN_BUFSIZE];//shell_load_user()
+    char cur_dir[PATH_DIR_BUFSIZE];//dirs_cwd(), "" until then
+    char pw_dir[PATH_DIR_BUFSIZE];//shell_load_user()
+    int last_status;//exit status of the last foreground job
+    double last_duration;//seconds the last command line took
+    int options;//OPTION_*
+    job *jobs[MAX_JOBS_ID + 1];
+};
+
+extern struct shell_information *shell;
+
+//startup.c
+void my_shell_init(int interactive);
+void shell_load_user();
+const char* shell_home();
+int startup_bench(int argc, char **argv);
+
+//main.c
+job* get_job_by_job_id(int id);
+int search_job_id_of_empty_job();
+int remove_id_from_job(int id);
+void destroy_process(process* proc);
+void destroy_job(job* job_temp);
+int count_jobs();
+int reap_process(int pid, int status);
+int check_zombi_process();
+void my_shell_print_promt();
+int my_shell_launch_job(job *job);
+int my_shell_echo(int argc, char **argv, int output_fd);
+FILE* builtin_output(int output_fd);
+int open_output_targets(process *proc, pid_t *relay_pid);
+
+//cache.c
+int my_shell_cache(int argc, char **argv, char *input_path, int output_fd);
+
+//filter.c
+int my_shell_filter(job *job_tmp, process *proc, int input_fd, int output_fd);
+int filter_supported(int argc, char **argv);
+int filter_stage(int argc, char **argv, int input_fd, int output_fd);
+void filter_set_interrupted(int v);
+
+//find.c
+int my_shell_find(int argc, char **argv, int output_fd);
+
+//metrics.c
+double metrics_now();
+void metrics_count(int counter);
+void metrics_observe(int hist, double seconds);
+void metrics_mark_sigchld(pid_t pid);
+void metrics_reaped(pid_t pid, int status);
+void metrics_tick();
+void metrics_init();
+int my_shell_stats(int argc, char **argv, int output_fd);
+
+//memstat.c
+void* mem_alloc(int pool, size_t size);
+void* mem_realloc(int pool, void *p, size_t size);
+char* mem_strdup(int pool, const char *s);
+char* mem_strndup(int pool, const char *s, size_t n);
+void mem_move(int from, int to, void *p);
+void mem_free(int pool, void *p);
+void mem_format_prometheus(FILE *fp);
+int my_shell_memstat(int argc, char **argv, int output_fd);
+
+//monitor.c
+int my_shell_jtop(int argc, char **argv);
+
+//dirs.c
+const char* dirs_cwd();
+int my_shell_cd(int argc, char **argv);
+int my_shell_dirs(int argc, char **argv, int output_fd);
+
+//names.c
+int names_type(const char *name);
+job* names_parse_definition(char *line);
+int names_expand(job *job_tmp);
+int names_call(job *job_tmp);
+int names_set_loadable(const char *name, void *data);
+void* names_loadable(const char *name);
+char* names_search_path(const char *command);
+int my_shell_names(int argc, char **argv, int output_fd);
+
+//place.c
+int place_prepare(job *job_tmp);
+void place_begin(job *job_tmp);
+void place_apply(job *job_tmp, process *proc);
+int my_shell_pin(int argc, char **argv, int output_fd);
+
+//jobserver.c, tokens of jobs
+#define JOBSERVER_NONE -1
+#define JOBSERVER_CALLER -2//run holds one for the job
+#define JOBSERVER_IMPLICIT 256//the token the shell was started with
+int jobserver_get(int *token);
+int jobserver_take(int *token, int wait);
+void jobserver_put(int *token);
+int my_shell_jobserver(int argc, char **argv);
+
+//rewrite.c
+int rewrite_job(job *job_tmp);
+void rewrite_format_prometheus(FILE *fp);
+
+//prompt.c
+void prompt_print();
+int prompt_fd();
+void prompt_redraw();
+int my_shell_prompt(int argc, char **argv);
+
+//plugin.c
+void* plugin_find(const char *name);
+const char* plugin_path(void *builtin);
+int plugin_run(void *builtin, int argc, char **argv, int in_fd, int out_fd, int in_shell);
+int my_shell_enable(int argc, char **argv, int output_fd);
+
+//heredoc.c
+typedef const char* (*heredoc_reader)(void *ctx, size_t *len);//next line without '\n', NULL at eof
+typedef struct heredoc_text_ {
+    const char *p;
+    const char *end;
+} heredoc_text;
+typedef struct heredoc_input_ {
+    char *line;//last one read, MEM_LINE
+    char *record;//command line and body for --record, NULL -> not kept
+} heredoc_input;
+int heredoc_fd(const char *body);
+int heredoc_collect(job *job_tmp, heredoc_reader next_line, void *ctx);
+const char* heredoc_text_line(void *ctx, size_t *len);
+const char* heredoc_input_line(void *ctx, size_t *len);
+
+//fds.c
+#define FDS_BAD -2//>&N, <&N of an N that is not open
+#define FDS_USER 10//0-9
+//0-9 of the shell a builtin redirected while it ran, -1 -> was not open
+typedef struct fds_saved_ {
+    int mask;
+    int fd[FDS_USER];
+    int flags[FDS_USER];
+} fds_saved;
+int fds_apply(process *proc);
+int fds_stage_fd(process *proc, int fd);
+int fds_other(process *proc);
+int fds_enter(process *proc, int input_fd, int output_fd, fds_saved *saved);
+void fds_leave(fds_saved *saved);
+int my_shell_exec(process *proc, int input_fd, int output_fd);
+
+//relay.c
+int relay_tee_start(int *out_fds, int n, pid_t *relay_pid);
+int relay_meter_start(int in_fd, char *from, char *to, pid_t *relay_pid);
+
+//script.c
+int my_shell_script(char *path);
+int my_shell_script_text(const char *text);
+
+//session.c
+int session_record_open(char *path);
+int session_recording();
+void session_record_input(char *line);
+void session_record_result(double seconds, int status, int mode, int nproc);
+int session_replay(int argc, char **argv);
+
+//stage.c
+int stage_threadable(job *job_tmp, process *proc, int input_fd);
+int stage_start(job *job_tmp, process *proc, int input_fd, int output_fd);
+void stage_wait(job *job_tmp);
+
+//tasks.c
+int my_shell_run(int argc, char **argv);
+
+//timer.c
+int deadline_add(pid_t pgid, double seconds, int sig, double grace);
+void deadline_cancel(pid_t pgid);
+int deadline_pending();
+void deadline_dispatch();
+pid_t deadline_waitpid(pid_t target, int *status);
+void shell_wait_input(int fd);
+int timeout_prepare(job *job_tmp);
+int my_shell_timeout(int argc, char **argv);
+#endif
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include "shell.h"
+
+/* builtin stages of a foreground pipeline run on threads of the shell.
+   echo ... | grep -F x | wc -l forks nothing, external stages in between
+   are still forked. stages talk through the same pipes as processes do,
+   so a stage ends on eof or EPIPE when its neighbours go away, and ^C
+   ends it whether it reaches the shell or only the forked stages. the
+   process of a stage counts as done for the job table, its thread is
+   joined (and its exit status filled in) by stage_wait before the job
+   goes away. */
+
+typedef struct stage_ {
+    job *owner;
+    process *proc;
+    int type;
+    int argc;
+    char **argv;//own copy, the job may be freed while the thread runs
+    void *plugin;//PLUGIN_COMMAND
+    int input_fd;
+    int output_fd;
+    int status;
+    pthread_t thread;
+    struct stage_ *next;
+} stage;
+
+static stage *stages = NULL;
+
+//pipeline stage which can run on a thread
+int stage_threadable(job *job_tmp, process *proc, int input_fd) {
+    if (job_tmp->mode != FOREGROUND || job_tmp->timeout > 0 || job_tmp->process_list->next == NULL) {
+        return 0;
+    }
+    switch (proc->process_type) {
+        case ECHO_COMMAND:
+            return 1;
+        case PLUGIN_COMMAND:
+            return input_fd != 0;
+        case FILTER_COMMAND:
+            //a thread must not read the terminal while another process group owns it
+            return input_fd != 0 && filter_supported(proc->process_argc, proc->argument_list);
+        default:
+            return 0;
+    }
+}
+
+static void* stage_main(void *arg) {
+    stage *s = arg;
+
+    if (s->type == ECHO_COMMAND) {
+        s->status = my_shell_echo(s->argc, s->argv, s->output_fd);
+    }
+    else if (s->type == PLUGIN_COMMAND) {
+        s->status = plugin_run(s->plugin, s->argc, s->argv, s->input_fd, s->output_fd, 0);
+    }
+    else {
+        s->status = filter_stage(s->argc, s->argv, s->input_fd, s->output_fd);
+    }
+    //the neighbours see eof / EPIPE now
+    close(s->input_fd);
+    close(s->output_fd);
+    return NULL;
+}
+
+//proc on a thread reading input_fd and writing output_fd (both duplicated), 0 on success
+int stage_start(job *job_tmp, process *proc, int input_fd, int output_fd) {
+    stage *s = (stage*) mem_alloc(MEM_STAGES, sizeof(stage));
+    memset(s, 0, sizeof(stage));
+    s->owner = job_tmp;
+    s->proc = proc;
+    s->type = proc->process_type;
+    s->argc = proc->process_argc;
+    s->argv = (char**) mem_alloc(MEM_STAGES, (s->argc + 1) * sizeof(char*));
+    for (int i = 0; i < s->argc; i++) {
+        s->argv[i] = mem_strdup(MEM_STAGES, proc->argument_list[i]);
+    }
+    s->argv[s->argc] = NULL;
+    //looked up here, the name table belongs to the shell's thread
+    s->plugin = s->type == PLUGIN_COMMAND ? plugin_find(s->argv[0]) : NULL;
+    //what the shell printed comes before what the stage writes
+    fflush(stdout);
+    s->input_fd = fcntl(input_fd, F_DUPFD_CLOEXEC, 3);
+    s->output_fd = fcntl(output_fd, F_DUPFD_CLOEXEC, 3);
+
+    if (s->input_fd < 0 || s->output_fd < 0 || pthread_create(&s->thread, NULL, stage_main, s) != 0) {
+        close(s->input_fd);
+        close(s->output_fd);
+        for (int i = 0; i < s->argc; i++) {
+            mem_free(MEM_STAGES, s->argv[i]);
+        }
+        mem_free(MEM_STAGES, s->argv);
+        mem_free(MEM_STAGES, s);
+        return -1;
+    }
+
+    proc->pid = 0;
+    proc->threaded = 1;
+    proc->process_status = STATUS_PROC_DONE;
+    s->next = stages;
+    stages = s;
+    metrics_count(METRIC_BUILTINS);
+    return 0;
+}
+
+static void handler_of_stage_sigint(int signal) {
+    filter_set_interrupted(1);
+}
+
+//join every stage of the job, their exit statuses go to their processes
+void stage_wait(job *job_tmp) {
+    stage **link = &stages;
+    struct sigaction sa, old_int;
+    int have = 0;
+
+    for (stage *s = stages; s != NULL; s = s->next) {
+        have |= s->owner == job_tmp;
+    }
+    if (!have) {
+        return;
+    }
+
+    //^C went to the forked stages -> the threads stop too
+    for (process *proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        if (!proc->threaded && proc->exit_status == 128 + SIGINT) {
+            filter_set_interrupted(1);
+        }
+    }
+    //nothing else gets ^C when the whole pipeline is threads
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler_of_stage_sigint;
+    sigaction(SIGINT, &sa, &old_int);
+
+    while (*link != NULL) {
+        stage *s = *link;
+        if (s->owner != job_tmp) {
+            link = &s->next;
+            continue;
+        }
+        pthread_join(s->thread, NULL);
+        s->proc->exit_status = s->status;
+        *link = s->next;
+        for (int i = 0; i < s->argc; i++) {
+            mem_free(MEM_STAGES, s->argv[i]);
+        }
+        mem_free(MEM_STAGES, s->argv);
+        mem_free(MEM_STAGES, s);
+    }
+
+    sigaction(SIGINT, &old_int, NULL);
+    filter_set_interrupted(0);
+}
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* startup.
+   ish --startup-bench [N]
+
+   before the first command the shell only sets its signals, takes the
+   terminal when there is one and allocates its state. the rest is done
+   the first time something needs it: the login name and home directory
+   (getpwuid may go through NSS to LDAP) for \u, \w and cd without HOME,
+   the working directory for cd, the prompt and the cache, the name table
+   for the first command word. ish -c and scripts with no terminal on
+   stdin start with nothing but the signals. --startup-bench times every
+   phase once, cold, then runs ish -c '' N times (50) for the whole cost
+   of a short-lived shell. */
+
+#define STARTUP_BENCH_RUNS 50
+
+extern char **environ;
+
+static void init_signals() {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);//stage threads see EPIPE instead
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+}
+
+//own process group in the foreground of the terminal, for job control
+static void init_terminal() {
+    pid_t pid = getpid();
+    setpgid(pid, pid);
+    tcsetpgrp(0, pid);
+}
+
+static void init_state() {
+    shell = (struct shell_information*) calloc(1, sizeof(struct shell_information));
+    for (int i = 0; i <= MAX_JOBS_ID; i++) {
+        shell->jobs[i] = NULL;
+    }
+}
+
+//login name and home directory from the password database, once
+void shell_load_user() {
+    static int loaded = 0;
+
+    if (loaded) {
+        return;
+    }
+    loaded = 1;
+    if (getlogin_r(shell->cur_user, sizeof(shell->cur_user)) != 0) {
+        shell->cur_user[0] = '\0';
+    }
+    struct passwd *pw = getpwuid(getuid());
+    if (pw != NULL) {
+        snprintf(shell->pw_dir, sizeof(shell->pw_dir), "%s", pw->pw_dir);
+        //no login name (no controlling terminal, su) -> the account
+        if (shell->cur_user[0] == '\0') {
+            snprintf(shell->cur_user, sizeof(shell->cur_user), "%s", pw->pw_name);
+        }
+    }
+}
+
+//$HOME, the password database only without it
+const char* shell_home() {
+    char *home = getenv("HOME");
+    if (home != NULL && home[0] != '\0') {
+        return home;
+    }
+    shell_load_user();
+    return shell->pw_dir;
+}
+
+//interactive -> the terminal too
+void my_shell_init(int interactive) {
+    init_signals();
+    if (interactive) {
+        init_terminal();
+    }
+    init_state();
+    metrics_init();
+}
+
+static void bench_cwd() {
+    dirs_cwd();
+}
+
+static void bench_names() {
+    names_type("");
+}
+
+typedef struct startup_phase_ {
+    const char *name;
+    void (*run)();
+    const char *when;
+} startup_phase;
+
+static const startup_phase PHASES[] = {
+    {"signals", init_signals, "always"},
+    {"terminal", init_terminal, "stdin is a tty"},
+    {"state", init_state, "always"},
+    {"metrics", metrics_init, "always"},
+    {"user", shell_load_user, "lazy: \\u, \\w, cd without HOME"},
+    {"cwd", bench_cwd, "lazy: cd, prompt, cache"},
+    {"names", bench_names, "lazy: first command"},
+};
+#define NPHASES (sizeof(PHASES) / sizeof(PHASES[0]))
+
+static int bench_compare(const void *a, const void *b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+//ish --startup-bench [N]
+int startup_bench(int argc, char **argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : STARTUP_BENCH_RUNS;
+    double eager = 0;
+
+    if (runs < 1) {
+        printf("usage: ish --startup-bench [N]\n");
+        return 2;
+    }
+    printf("%-10s %10s  %s\n", "phase", "usec", "runs");
+    for (size_t i = 0; i < NPHASES; i++) {
+        //the terminal is taken only when there is one
+        if (PHASES[i].run == init_terminal && !isatty(0)) {
+            printf("%-10s %10s  %s\n", PHASES[i].name, "-", PHASES[i].when);
+            continue;
+        }
+        double start = metrics_now();
+        PHASES[i].run();
+        double usec = (metrics_now() - start) * 1e6;
+        if (strcmp(PHASES[i].when, "always") == 0) {
+            eager += usec;
+        }
+        printf("%-10s %10.1f  %s\n", PHASES[i].name, usec, PHASES[i].when);
+    }
+    printf("%-10s %10.1f  before the first command of ish -c\n", "startup", eager);
+
+    //fork, exec, startup, exit of the whole shell
+    char *child_argv[] = {"ish", "-c", "", NULL};
+    double *took = (double*) malloc(runs * sizeof(double));
+    for (int i = 0; i < runs; i++) {
+        pid_t pid;
+        int status;
+        double start = metrics_now();
+        if (posix_spawn(&pid, "/proc/self/exe", NULL, NULL, child_argv, environ) != 0) {
+            printf("startup-bench: cannot start the shell\n");
+            free(took);
+            return 1;
+        }
+        waitpid(pid, &status, 0);
+        took[i] = (metrics_now() - start) * 1e6;
+    }
+    qsort(took, runs, sizeof(double), bench_compare);
+    printf("\nish -c '' x%d: min %.1f usec, median %.1f usec, max %.1f usec (spawn to exit)\n", runs, took[0],
+           took[runs / 2], took[runs - 1]);
+    free(took);
+    return 0;
+}
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* run FILE [-jN] [-L]
+   runs the named tasks of FILE in dependency order on N workers.
+
+   # comment
+   name: dep dep
+       command
+       command
+
+   each command of a task is launched as a background job, one after
+   another. -L starts the ready task with the longest runtime recorded
+   in FILE.times first. under a jobserver a task holds one token from
+   start to finish, N only caps what this run takes. */
+
+#define TASK_WAITING 0
+#define TASK_RUNNING 1
+#define TASK_DONE 2
+#define TASK_FAILED 3
+#define TASK_SKIPPED 4
+
+typedef struct task_ {
+    char *name;
+    char **deps;
+    int *dep_index;
+    int ndeps;
+    char **commands;
+    int ncommands;
+    int next_command;
+    int state;
+    int job_id;
+    int token;//jobserver
+    double started;
+    double estimate;//seconds, from FILE.times
+} task;
+
+typedef struct task_list_ {
+    task *tasks;
+    int ntasks;
+} task_list;
+
+static volatile sig_atomic_t run_interrupted = 0;
+
+static void handler_of_run_sigint(int signal) {
+    run_interrupted = 1;
+}
+
+static double task_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int task_find(task_list *list, char *name) {
+    for (int i = 0; i < list->ntasks; i++) {
+        if (strcmp(list->tasks[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void task_list_free(task_list *list) {
+    for (int i = 0; i < list->ntasks; i++) {
+        task *t = &list->tasks[i];
+        for (int j = 0; j < t->ndeps; j++) {
+            free(t->deps[j]);
+        }
+        for (int j = 0; j < t->ncommands; j++) {
+            free(t->commands[j]);
+        }
+        free(t->name);
+        free(t->deps);
+        free(t->dep_index);
+        free(t->commands);
+    }
+    free(list->tasks);
+}
+
+//FILE -> task list
+static int task_list_load(task_list *list, char *path) {
+    list->tasks = NULL;
+    list->ntasks = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("run: %s: no such file or directory\n", path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0;
+    task *cur = NULL;
+
+    while (getline(&line, &cap, fp) > 0) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        char *p = line + strspn(line, " \t");
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+
+        //command of the current task
+        if (p != line) {
+            if (cur == NULL) {
+                printf("run: %s:%d: command outside of a task\n", path, lineno);
+                goto fail;
+            }
+            cur->commands = realloc(cur->commands, (cur->ncommands + 1) * sizeof(char*));
+            cur->commands[cur->ncommands++] = strdup(p);
+            continue;
+        }
+
+        //name: deps...
+        char *colon = strchr(line, ':');
+        if (colon == NULL) {
+            printf("run: %s:%d: expected 'name: deps'\n", path, lineno);
+            goto fail;
+        }
+        *colon = '\0';
+
+        list->tasks = realloc(list->tasks, (list->ntasks + 1) * sizeof(task));
+        cur = &list->tasks[list->ntasks++];
+        memset(cur, 0, sizeof(task));
+        char *name = strtok(line, TOKEN_SEPARATION);
+        cur->name = strdup(name != NULL ? name : "");
+        cur->job_id = -1;
+        cur->token = JOBSERVER_NONE;
+
+        for (char *dep = strtok(colon + 1, TOKEN_SEPARATION); dep != NULL; dep = strtok(NULL, TOKEN_SEPARATION)) {
+            cur->deps = realloc(cur->deps, (cur->ndeps + 1) * sizeof(char*));
+            cur->deps[cur->ndeps++] = strdup(dep);
+        }
+
+        if (cur->name[0] == '\0' || task_find(list, cur->name) != list->ntasks - 1) {
+            printf("run: %s:%d: bad or duplicate task name\n", path, lineno);
+            goto fail;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    //dep names -> index
+    for (int i = 0; i < list->ntasks; i++) {
+        task *t = &list->tasks[i];
+        t->dep_index = malloc((t->ndeps + 1) * sizeof(int));
+        for (int j = 0; j < t->ndeps; j++) {
+            t->dep_index[j] = task_find(list, t->deps[j]);
+            if (t->dep_index[j] < 0) {
+                printf("run: %s: unknown dependency %s\n", t->name, t->deps[j]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+
+fail:
+    free(line);
+    fclose(fp);
+    return -1;
+}
+
+//FILE.times -> estimate of each task
+static void task_times_load(task_list *list, char *path) {
+    char times[PATH_DIR_BUFSIZE + 8];
+    snprintf(times, sizeof(times), "%s.times", path);
+
+    FILE *fp = fopen(times, "r");
+    if (fp == NULL) {
+        return;
+    }
+    char name[COMMAND_BUFSIZE];
+    double sec;
+    while (fscanf(fp, "%511s %lf", name, &sec) == 2) {
+        int i = task_find(list, name);
+        if (i >= 0) {
+            list->tasks[i].estimate = sec;
+        }
+    }
+    fclose(fp);
+}
+
+static void task_times_save(task_list *list, char *path) {
+    char times[PATH_DIR_BUFSIZE + 8];
+    char tmp[PATH_DIR_BUFSIZE + 16];
+    snprintf(times, sizeof(times), "%s.times", path);
+    snprintf(tmp, sizeof(tmp), "%s.times.tmp", path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        return;
+    }
+    for (int i = 0; i < list->ntasks; i++) {
+        if (list->tasks[i].estimate > 0) {
+            fprintf(fp, "%s %.3f\n", list->tasks[i].name, list->tasks[i].estimate);
+        }
+    }
+    if (fclose(fp) == 0) {
+        rename(tmp, times);
+    }
+}
+
+//skip every waiting task which depends on a failed or skipped one
+static void task_skip_dependents(task_list *list) {
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < list->ntasks; i++) {
+            task *t = &list->tasks[i];
+            if (t->state != TASK_WAITING) {
+                continue;
+            }
+            for (int j = 0; j < t->ndeps; j++) {
+                int state = list->tasks[t->dep_index[j]].state;
+                if (state == TASK_FAILED || state == TASK_SKIPPED) {
+                    t->state = TASK_SKIPPED;
+                    printf("[run] %s: skipped (%s failed)\n", t->name, t->deps[j]);
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+//waiting task whose deps are all done (longest estimate first with -L)
+static task* task_pick_ready(task_list *list, int longest_first) {
+    task *best = NULL;
+
+    for (int i = 0; i < list->ntasks; i++) {
+        task *t = &list->tasks[i];
+        if (t->state != TASK_WAITING) {
+            continue;
+        }
+        int ready = 1;
+        for (int j = 0; j < t->ndeps; j++) {
+            if (list->tasks[t->dep_index[j]].state != TASK_DONE) {
+                ready = 0;
+                break;
+            }
+        }
+        if (!ready) {
+            continue;
+        }
+        if (!longest_first) {
+            return t;
+        }
+        if (best == NULL || t->estimate > best->estimate) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+//launch the next command of the task as a background job
+//1 -> running, 0 -> no command left, -1 -> failed
+static int task_launch_next(task *t) {
+    while (t->next_command < t->ncommands) {
+        char *line = strdup(t->commands[t->next_command++]);
+        job *job_tmp = my_shell_parse_command(line);
+        free(line);
+
+        job_tmp->mode = BACKGROUND;
+        job_tmp->notify = 0;
+        job_tmp->token = JOBSERVER_CALLER;
+
+        //builtin runs in the shell right now
+        if (!command_runs_as_job(job_tmp->process_list->process_type)) {
+            my_shell_launch_job(job_tmp);
+            continue;
+        }
+        //the id it gets, the job is freed already when it forked nothing
+        int id = search_job_id_of_empty_job();
+        if (id < 0) {
+            destroy_job(job_tmp);
+            return -1;
+        }
+        if (my_shell_launch_job(job_tmp) < 0) {
+            return -1;
+        }
+        if (get_job_by_job_id(id) == NULL) {
+            if (shell->last_status != 0) {
+                return -1;
+            }
+            continue;
+        }
+        t->job_id = id;
+        return 1;
+    }
+    return 0;
+}
+
+static void task_finish(task *t, int state, int status) {
+    double elapsed = task_now() - t->started;
+
+    t->state = state;
+    t->job_id = -1;
+    jobserver_put(&t->token);
+    if (state == TASK_DONE) {
+        t->estimate = elapsed;
+        printf("[run] %s: done (%.2fs)\n", t->name, elapsed);
+    }
+    else {
+        printf("[run] %s: failed with status %d (%.2fs)\n", t->name, status, elapsed);
+    }
+}
+
+//job of the task finished -> exit status of the last process, else -1
+static int task_job_status(task *t) {
+    job *job_tmp = get_job_by_job_id(t->job_id);
+    process *proc;
+    int status = 0;
+
+    for (proc = job_tmp->process_list; proc != NULL; proc = proc->next) {
+        if (proc->process_status != STATUS_PROC_DONE && proc->process_status != STATUS_PROC_TERMINATED) {
+            return -1;
+        }
+        status = proc->exit_status;
+    }
+    return status;
+}
+
+//run
+int my_shell_run(int argc, char **argv) {
+    char *path = NULL;
+    int workers = 1;
+    int longest_first = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-j", 2) == 0) {
+            workers = atoi(argv[i][2] != '\0' ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "1"));
+        }
+        else if (strcmp(argv[i], "-L") == 0) {
+            longest_first = 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || workers < 1) {
+        printf("usage: run FILE [-jN] [-L]\n");
+        return 2;
+    }
+
+    task_list list;
+    if (task_list_load(&list, path) < 0) {
+        task_list_free(&list);
+        return 1;
+    }
+    task_times_load(&list, path);
+
+    struct sigaction sa, old_sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler_of_run_sigint;
+    sigaction(SIGINT, &sa, &old_sa);
+    run_interrupted = 0;
+
+    int running = 0;
+    int failed = 0;
+    while (1) {
+        task *t;
+        //start ready tasks while workers and job ids are free
+        while (!run_interrupted && running < workers && search_job_id_of_empty_job() > 0 &&
+               (t = task_pick_ready(&list, longest_first)) != NULL) {
+            //a token of the jobserver, waiting for one only when none of ours can give one back
+            if (!jobserver_take(&t->token, running == 0)) {
+                break;
+            }
+            t->state = TASK_RUNNING;
+            t->started = task_now();
+            printf("[run] %s: started\n", t->name);
+
+            int r = task_launch_next(t);
+            if (r == 1) {
+                running++;
+            }
+            else {
+                task_finish(t, r == 0 ? TASK_DONE : TASK_FAILED, r == 0 ? 0 : 1);
+                failed |= r < 0;
+                task_skip_dependents(&list);
+            }
+        }
+        if (running == 0) {
+            break;
+        }
+
+        fflush(stdout);
+        int status;
+        pid_t pid = deadline_waitpid(-1, &status);
+        if (pid < 0) {
+            if (errno != EINTR) {
+                break;
+            }
+            if (run_interrupted) {
+                //stop the running tasks, their jobs are reaped below
+                for (int i = 0; i < list.ntasks; i++) {
+                    job *job_tmp = get_job_by_job_id(list.tasks[i].job_id);
+                    if (list.tasks[i].state == TASK_RUNNING) {
+                        if (job_tmp != NULL && job_tmp->pgid > 0) {
+                            kill(-job_tmp->pgid, SIGTERM);
+                        }
+                        list.tasks[i].next_command = list.tasks[i].ncommands;
+                    }
+                }
+            }
+            continue;
+        }
+        reap_process(pid, status);
+
+        for (int i = 0; i < list.ntasks; i++) {
+            t = &list.tasks[i];
+            int job_status;
+            if (t->state != TASK_RUNNING || (job_status = task_job_status(t)) < 0) {
+                continue;
+            }
+            remove_id_from_job(t->job_id);
+
+            int r = job_status == 0 ? task_launch_next(t) : -1;
+            if (r == 1) {
+                continue;
+            }
+            running--;
+            if (r == 0 && !run_interrupted) {
+                task_finish(t, TASK_DONE, 0);
+            }
+            else {
+                task_finish(t, TASK_FAILED, job_status);
+                failed = 1;
+            }
+            task_skip_dependents(&list);
+        }
+    }
+    sigaction(SIGINT, &old_sa, NULL);
+
+    for (int i = 0; i < list.ntasks; i++) {
+        if (list.tasks[i].state == TASK_WAITING) {
+            printf("[run] %s: not started (dependency cycle or interrupted)\n", list.tasks[i].name);
+            failed = 1;
+        }
+        else if (list.tasks[i].state == TASK_SKIPPED) {
+            failed = 1;
+        }
+    }
+    task_times_save(&list, path);
+    task_list_free(&list);
+
+    return failed;
+}
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "shell.h"
+
+/* job deadlines.
+   timeout [-s SIG] [-k GRACE] DURATION cmd args
+   timeout [-s SIG] [-k GRACE] --deadline DURATION %job
+
+   pending deadlines live in a binary min-heap, a single timerfd is armed
+   for the earliest one. when it fires the job's process group gets SIG,
+   and SIGKILL GRACE seconds later if it is still there. */
+
+#define TIMEOUT_DEFAULT_GRACE 5.0
+
+typedef struct deadline_ {
+    double when;//CLOCK_MONOTONIC seconds
+    pid_t pgid;
+    int sig;
+    double grace;//seconds until SIGKILL, 0 -> none
+} deadline;
+
+static deadline *heap = NULL;
+static int heap_len = 0;
+static int heap_cap = 0;
+static int timer_fd = -1;
+static int sigchld_pipe[2] = {-1, -1};
+
+static double deadline_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void heap_swap(int a, int b) {
+    deadline tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+}
+
+static void heap_up(int i) {
+    while (i > 0 && heap[(i - 1) / 2].when > heap[i].when) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i) {
+    while (1) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap_len && heap[l].when < heap[m].when) m = l;
+        if (r < heap_len && heap[r].when < heap[m].when) m = r;
+        if (m == i) {
+            return;
+        }
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static void heap_remove(int i) {
+    heap[i] = heap[--heap_len];
+    if (i < heap_len) {
+        heap_up(i);
+        heap_down(i);
+    }
+}
+
+static void heap_push(deadline d) {
+    if (heap_len == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 16;
+        heap = realloc(heap, heap_cap * sizeof(deadline));
+    }
+    heap[heap_len++] = d;
+    heap_up(heap_len - 1);
+}
+
+static void handler_of_sigchld(int signal, siginfo_t *info, void *ctx) {
+    int saved = errno;
+    if (info->si_code == CLD_EXITED || info->si_code == CLD_KILLED || info->si_code == CLD_DUMPED) {
+        metrics_mark_sigchld(info->si_pid);
+    }
+    write(sigchld_pipe[1], "", 1);
+    errno = saved;
+}
+
+//timerfd and a SIGCHLD self-pipe, created with the first deadline
+static int deadline_init() {
+    if (timer_fd >= 0) {
+        return 0;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timer_fd < 0 || pipe2(sigchld_pipe, O_NONBLOCK|O_CLOEXEC) < 0) {
+        return -1;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = handler_of_sigchld;
+    sa.sa_flags = SA_RESTART|SA_SIGINFO;//stops wake the foreground wait too
+    sigaction(SIGCHLD, &sa, NULL);
+    return 0;
+}
+
+//arm the timerfd for the earliest deadline
+static void deadline_arm() {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (heap_len > 0) {
+        double when = heap[0].when;
+        its.it_value.tv_sec = (time_t) when;
+        its.it_value.tv_nsec = (long) ((when - (time_t) when) * 1e9);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+//job of pgid -> timed out
+static void deadline_mark_job(pid_t pgid) {
+    for (int id = 1; id <= MAX_JOBS_ID; id++) {
+        job *job_tmp = get_job_by_job_id(id);
+        if (job_tmp != NULL && job_tmp->pgid == pgid) {
+            job_tmp->timed_out = 1;
+        }
+    }
+}
+
+int deadline_add(pid_t pgid, double seconds, int sig, double grace) {
+    if (deadline_init() < 0) {
+        return -1;
+    }
+    deadline d = {deadline_now() + seconds, pgid, sig, grace};
+    heap_push(d);
+    if (heap[0].pgid == pgid) {
+        deadline_arm();
+    }
+    return 0;
+}
+
+void deadline_cancel(pid_t pgid) {
+    int first = heap_len > 0 && heap[0].pgid == pgid;
+
+    for (int i = heap_len - 1; i >= 0; i--) {
+        if (heap[i].pgid == pgid) {
+            heap_remove(i);
+        }
+    }
+    if (first) {
+        deadline_arm();
+    }
+}
+
+int deadline_pending() {
+    return heap_len > 0;
+}
+
+//signal every job whose deadline passed, SIGKILL follows after the grace period
+void deadline_dispatch() {
+    if (heap_len == 0) {
+        return;
+    }
+    uint64_t expirations;
+    read(timer_fd, &expirations, sizeof(expirations));
+
+    double now = deadline_now();
+    while (heap_len > 0 && heap[0].when <= now) {
+        deadline d = heap[0];
+        heap_remove(0);
+
+        deadline_mark_job(d.pgid);
+        if (kill(-d.pgid, d.sig) < 0) {
+            continue;//already gone
+        }
+        kill(-d.pgid, SIGCONT);
+        if (d.grace > 0 && d.sig != SIGKILL) {
+            deadline next = {now + d.grace, d.pgid, SIGKILL, 0};
+            heap_push(next);
+        }
+    }
+    deadline_arm();
+}
+
+//waitpid(target, WUNTRACED) which keeps firing deadlines while it waits
+pid_t deadline_waitpid(pid_t target, int *status) {
+    while (1) {
+        pid_t pid = waitpid(target, status, heap_len == 0 ? WUNTRACED : WUNTRACED|WNOHANG);
+        if (pid > 0) {
+            metrics_reaped(pid, *status);
+        }
+        if (heap_len == 0 || pid != 0) {
+            return pid;
+        }
+
+        struct pollfd pfd[2] = {{timer_fd, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+        char buf[64];
+        if (poll(pfd, 2, -1) < 0) {
+            //another signal than SIGCHLD -> let the caller see EINTR
+            if (errno != EINTR || read(sigchld_pipe[0], buf, sizeof(buf)) <= 0) {
+                errno = EINTR;
+                return -1;
+            }
+            continue;
+        }
+        if (pfd[0].revents & POLLIN) {
+            deadline_dispatch();
+        }
+        if (pfd[1].revents & POLLIN) {
+            while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+        }
+    }
+}
+
+//block until fd is readable, firing deadlines, reporting finished jobs and redrawing the prompt meanwhile
+void shell_wait_input(int fd) {
+    while (heap_len > 0 || count_jobs() > 0 || prompt_fd() >= 0) {
+        if (deadline_init() < 0) {
+            return;
+        }
+        struct pollfd pfd[4] = {{fd, POLLIN, 0}, {timer_fd, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}, {prompt_fd(), POLLIN, 0}};
+        if (poll(pfd, 4, -1) < 0 && errno != EINTR) {
+            return;
+        }
+        if (pfd[3].revents & POLLIN) {
+            prompt_redraw();
+        }
+        if (pfd[1].revents & POLLIN) {
+            deadline_dispatch();
+        }
+        if (pfd[2].revents & POLLIN) {
+            char buf[64];
+            while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+            if (check_zombi_process() > 0) {
+                my_shell_print_promt();
+                fflush(stdout);
+            }
+        }
+        if (pfd[0].revents) {
+            return;
+        }
+    }
+}
+
+//"1.5", "100ms", "30s", "2m", "1h" -> seconds
+static double parse_duration(char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) {
+        return -1;
+    }
+    if (strcmp(end, "ms") == 0) return v / 1000;
+    if (*end == '\0' || strcmp(end, "s") == 0) return v;
+    if (strcmp(end, "m") == 0) return v * 60;
+    if (strcmp(end, "h") == 0) return v * 3600;
+    return -1;
+}
+
+//"TERM", "SIGTERM", "15" -> signal number
+static int parse_signal(char *s) {
+    static const struct { const char *name; int sig; } SIGNAL_NAME[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    };
+    if (strncmp(s, "SIG", 3) == 0) {
+        s += 3;
+    }
+    for (size_t i = 0; i < sizeof(SIGNAL_NAME) / sizeof(SIGNAL_NAME[0]); i++) {
+        if (strcmp(s, SIGNAL_NAME[i].name) == 0) {
+            return SIGNAL_NAME[i].sig;
+        }
+    }
+    int sig = atoi(s);
+    return (sig > 0 && sig < NSIG) ? sig : -1;
+}
+
+//[-s SIG] [-k GRACE] -> index of the first other argument, -1 on error
+static int parse_timeout_options(int argc, char **argv, int *sig, double *grace) {
+    int i = 1;
+
+    *sig = SIGTERM;
+    *grace = TIMEOUT_DEFAULT_GRACE;
+    while (i + 1 < argc) {
+        if (strcmp(argv[i], "-s") == 0) {
+            if ((*sig = parse_signal(argv[i + 1])) < 0) {
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-k") == 0) {
+            if ((*grace = parse_duration(argv[i + 1])) < 0) {
+                return -1;
+            }
+        }
+        else {
+            break;
+        }
+        i += 2;
+    }
+    return i;
+}
+
+//timeout ... DURATION cmd args -> job running cmd args with a deadline
+//1 -> timeout ... --deadline, left to my_shell_timeout
+int timeout_prepare(job *job_tmp) {
+    process *proc = job_tmp->process_list;
+    int sig;
+    double grace;
+    int i = parse_timeout_options(proc->process_argc, proc->argument_list, &sig, &grace);
+
+    if (i >= 0 && i < proc->process_argc && strcmp(proc->argument_list[i], "--deadline") == 0) {
+        return 1;
+    }
+    if (i < 0 || i + 1 >= proc->process_argc) {
+        printf("usage: timeout [-s SIG] [-k GRACE] DURATION command [args...]\n");
+        return -1;
+    }
+    double seconds = parse_duration(proc->argument_list[i]);
+    if (seconds < 0) {
+        printf("timeout: %s: invalid duration\n", proc->argument_list[i]);
+        return -1;
+    }
+
+    //drop "timeout [options] DURATION"
+    i++;
+    for (int j = 0; j < i; j++) {
+        mem_free(MEM_JOBS, proc->argument_list[j]);
+    }
+    memmove(proc->argument_list, proc->argument_list + i, (proc->process_argc - i + 1) * sizeof(char*));
+    proc->process_argc -= i;
+    proc->process_type = get_command_type(proc->argument_list[0]);
+
+    job_tmp->timeout = seconds;
+    job_tmp->timeout_signal = sig;
+    job_tmp->timeout_grace = grace;
+    return 0;
+}
+
+//timeout --deadline DURATION %job
+int my_shell_timeout(int argc, char **argv) {
+    int sig;
+    double grace;
+    int i = parse_timeout_options(argc, argv, &sig, &grace);
+
+    if (i < 0 || i + 2 >= argc || strcmp(argv[i], "--deadline") != 0) {
+        printf("usage: timeout [-s SIG] [-k GRACE] --deadline DURATION %%job\n");
+        return 2;
+    }
+    double seconds = parse_duration(argv[i + 1]);
+    char *id = argv[i + 2][0] == '%' ? argv[i + 2] + 1 : argv[i + 2];
+    job *job_tmp = atoi(id) > 0 ? get_job_by_job_id(atoi(id)) : NULL;
+    if (seconds < 0 || job_tmp == NULL || job_tmp->pgid <= 0) {
+        printf("timeout: %s: no such job\n", argv[i + 2]);
+        return 1;
+    }
+
+    deadline_cancel(job_tmp->pgid);
+    return deadline_add(job_tmp->pgid, seconds, sig, grace) < 0 ? 1 : 0;
+}